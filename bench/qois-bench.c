@@ -0,0 +1,715 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <time.h>
+#include <dirent.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define BENCH_HAS_CYCLES
+#endif
+
+#include "qoi-stream.h"
+#include "qoi-stream-target.h"
+#include "qoi-stream-netpbm.h"
+
+// Benchmark of the encode and decode paths, results are printed as JSON.
+// All throughput numbers are measured against the size of the raw pixel data.
+
+typedef struct _bench_corpus
+{
+  char name[256];
+  qois_desc desc;
+
+  uint8_t *raw;
+  size_t raw_size;
+
+  uint8_t *qoi;
+  size_t qoi_size;
+
+  // What the raw pixels the paths are checked against come from: "synthetic" generated pixels, the
+  // pixels of a "source" PPM or PAM file next to a loaded image, or only a "round_trip" through the decoder
+  const char *reference;
+} bench_corpus;
+
+typedef struct _bench_path
+{
+  const char *name;
+  // Runs the path once over the corpus, the result is left in output. Returns the amount of bytes written.
+  size_t (*run)(const bench_corpus *corpus, uint8_t *output, size_t output_size);
+  // Encoders are checked against the corpus QOI data, decoders against the raw pixels
+  bool encode;
+  // Decoders into a qois_target are checked against the raw pixels converted to its format
+  bool target;
+  qois_format format;
+} bench_path;
+
+typedef struct _bench_options
+{
+  uint32_t width;
+  uint32_t height;
+  unsigned iterations;
+  const char *directory;
+  bool synthetic;
+} bench_options;
+
+// Util functions
+
+static uint32_t bench_random(uint32_t *seed)
+{
+  // xorshift32
+  uint32_t x = *seed;
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  *seed = x;
+  return x;
+}
+
+static double bench_seconds(void)
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (double)now.tv_sec + (double)now.tv_nsec / 1e9;
+}
+
+static uint64_t bench_cycles(void)
+{
+#ifdef BENCH_HAS_CYCLES
+  return __rdtsc();
+#else
+  return 0;
+#endif
+}
+
+// Encodes the raw pixels of the corpus with the bulk encoder, this is the reference output for the encoders
+static bool bench_corpus_encode(bench_corpus *corpus)
+{
+  qois_enc_state state;
+  qois_enc_state_init(&state, corpus->desc.width, corpus->desc.height, corpus->desc.channels,
+                      corpus->desc.colorspace);
+
+  size_t pixel_count = (size_t)corpus->desc.width * corpus->desc.height;
+  size_t bound = qois_encode_pixels_bound(&state, pixel_count);
+  corpus->qoi = malloc(bound);
+
+  size_t output_pos = 0;
+  size_t pixel_pos = 0;
+  do
+  {
+    size_t pixels = pixel_count - pixel_pos;
+    if (pixels > 1024 * 1024)
+      pixels = 1024 * 1024;
+
+    int outputted = qois_encode_pixels(&state, corpus->raw + pixel_pos * corpus->desc.channels, pixels,
+                                       corpus->qoi + output_pos, bound - output_pos);
+    if (outputted < 0)
+      return false;
+
+    output_pos += (size_t)outputted;
+    pixel_pos += pixels;
+  } while (state.state != QOIS_STATE_DONE);
+
+  corpus->qoi_size = output_pos;
+  return true;
+}
+
+// Synthetic corpora
+
+typedef enum _bench_pattern
+{
+  BENCH_FLAT,
+  BENCH_GRADIENT,
+  BENCH_NOISE,
+  BENCH_ALPHA,
+  BENCH_PHOTO,
+} bench_pattern;
+
+static const char *const bench_pattern_names[] = {"flat", "gradient", "noise", "alpha", "photo"};
+
+static void bench_generate(bench_corpus *corpus, bench_pattern pattern, uint32_t width, uint32_t height,
+                           uint8_t channels)
+{
+  snprintf(corpus->name, sizeof(corpus->name), "%s-%s", bench_pattern_names[pattern], channels == 4 ? "rgba" : "rgb");
+
+  corpus->desc.width = width;
+  corpus->desc.height = height;
+  corpus->desc.channels = channels;
+  corpus->desc.colorspace = 0;
+  corpus->reference = "synthetic";
+
+  corpus->raw_size = (size_t)width * height * channels;
+  corpus->raw = malloc(corpus->raw_size + 1);
+
+  uint32_t seed = 0x9e3779b9u ^ (uint32_t)pattern;
+  qois_pixel pixel = {128, 128, 128, 255};
+
+  for (uint32_t y = 0; y < height; y++)
+  {
+    for (uint32_t x = 0; x < width; x++)
+    {
+      uint8_t *out = corpus->raw + ((size_t)y * width + x) * channels;
+
+      switch (pattern)
+      {
+      case BENCH_FLAT:
+      {
+        // Large blocks of a single colour
+        uint32_t block = (x / 64) * 7919u + (y / 64) * 104729u;
+        pixel.r = (uint8_t)(block * 37u);
+        pixel.g = (uint8_t)(block * 91u);
+        pixel.b = (uint8_t)(block * 53u);
+        pixel.a = 255;
+        break;
+      }
+      case BENCH_GRADIENT:
+        pixel.r = (uint8_t)x;
+        pixel.g = (uint8_t)y;
+        pixel.b = (uint8_t)((x + y) / 2);
+        pixel.a = (uint8_t)(255 - (x + y) / 4);
+        break;
+      case BENCH_NOISE:
+      {
+        uint32_t value = bench_random(&seed);
+        memcpy(&pixel, &value, sizeof(pixel));
+        break;
+      }
+      case BENCH_ALPHA:
+      {
+        // Smooth colours, with an alpha channel that changes on almost every pixel
+        uint32_t value = bench_random(&seed);
+        pixel.r = (uint8_t)(x * 2);
+        pixel.g = (uint8_t)(y * 2);
+        pixel.b = 96;
+        pixel.a = (value & 3) ? (uint8_t)(value >> 24) : 255;
+        break;
+      }
+      case BENCH_PHOTO:
+      {
+        // A random walk that follows the row above, like the small changes in a photo
+        uint32_t value = bench_random(&seed);
+        if (x == 0 && y > 0)
+          memcpy(&pixel, corpus->raw + (size_t)(y - 1) * width * channels, channels);
+        pixel.r = (uint8_t)(pixel.r + (int)(value & 7) - 3);
+        pixel.g = (uint8_t)(pixel.g + (int)((value >> 3) & 7) - 3);
+        pixel.b = (uint8_t)(pixel.b + (int)((value >> 6) & 7) - 3);
+        if ((value >> 9 & 63) == 0)
+          pixel.a = (uint8_t)(pixel.a + (int)((value >> 15) & 7) - 3);
+        break;
+      }
+      }
+
+      memcpy(out, &pixel, channels);
+    }
+  }
+}
+
+// Replaces the raw pixels of the corpus with those of a PPM or PAM file with the same name next to the image,
+// so the decoders are checked against the source of the image instead of against themselves
+static void bench_load_source(bench_corpus *corpus, const char *path)
+{
+  static const char *const extensions[] = {".ppm", ".pam"};
+
+  size_t length = strlen(path) - strlen(".qoi");
+  for (size_t e = 0; e < sizeof(extensions) / sizeof(extensions[0]); e++)
+  {
+    char source_path[4096];
+    snprintf(source_path, sizeof(source_path), "%.*s%s", (int)length, path, extensions[e]);
+
+    FILE *file = fopen(source_path, "rb");
+    if (!file)
+      continue;
+
+    uint8_t header[1024];
+    size_t read = fread(header, 1, sizeof(header), file);
+
+    qois_pnm_parser parser;
+    qois_pnm_parser_init(&parser);
+    size_t consumed = 0;
+    bool valid = qois_pnm_parse(&parser, header, read, &consumed) == 1 &&
+                 parser.desc.width == corpus->desc.width && parser.desc.height == corpus->desc.height &&
+                 parser.desc.channels == corpus->desc.channels;
+
+    uint8_t *pixels = valid ? malloc(corpus->raw_size + 1) : NULL;
+    valid = pixels && fseek(file, (long)consumed, SEEK_SET) == 0 &&
+            fread(pixels, 1, corpus->raw_size, file) == corpus->raw_size;
+    fclose(file);
+
+    if (!valid)
+    {
+      free(pixels);
+      continue;
+    }
+
+    free(corpus->raw);
+    corpus->raw = pixels;
+    corpus->reference = "source";
+    return;
+  }
+}
+
+// Loads a QOI file and decodes it into the raw pixels of the corpus
+static bool bench_load(bench_corpus *corpus, const char *path, const char *name)
+{
+  FILE *file = fopen(path, "rb");
+  if (!file)
+    return false;
+
+  fseek(file, 0, SEEK_END);
+  long size = ftell(file);
+  fseek(file, 0, SEEK_SET);
+
+  uint8_t *data = malloc((size_t)(size > 0 ? size : 0) + 1);
+  bool valid = size > 0 && fread(data, 1, (size_t)size, file) == (size_t)size &&
+               qois_get_desc(data, (size_t)size, &corpus->desc);
+  fclose(file);
+
+  if (!valid)
+  {
+    free(data);
+    return false;
+  }
+
+  snprintf(corpus->name, sizeof(corpus->name), "%s", name);
+  corpus->raw_size = (size_t)corpus->desc.width * corpus->desc.height * corpus->desc.channels;
+  corpus->raw = malloc(corpus->raw_size + 1);
+
+  qois_dec_state state;
+  qois_dec_state_init(&state, 0);
+
+  size_t input_pos = 0;
+  size_t output_pos = 0;
+  while (input_pos < (size_t)size && state.state != QOIS_STATE_DONE)
+  {
+    size_t consumed = 0;
+    int outputted = qois_decode_buffer(&state, data + input_pos, (size_t)size - input_pos,
+                                       corpus->raw + output_pos, corpus->raw_size - output_pos, &consumed);
+    if (outputted < 0 || (outputted == 0 && consumed == 0))
+      break;
+
+    input_pos += consumed;
+    output_pos += (size_t)outputted;
+  }
+
+  free(data);
+
+  if (state.state != QOIS_STATE_DONE)
+  {
+    free(corpus->raw);
+    return false;
+  }
+
+  corpus->reference = "round_trip";
+  bench_load_source(corpus, path);
+  return true;
+}
+
+// Prints a string as a JSON string, file names can hold any character
+static void bench_print_string(const char *str)
+{
+  putchar('"');
+  for (; *str; str++)
+  {
+    unsigned char c = (unsigned char)*str;
+    if (c == '"' || c == '\\')
+      printf("\\%c", c);
+    else if (c < 0x20)
+      printf("\\u%04x", c);
+    else
+      putchar(c);
+  }
+  putchar('"');
+}
+
+// Benchmarked paths
+
+static size_t bench_encode_byte(const bench_corpus *corpus, uint8_t *output, size_t output_size)
+{
+  qois_enc_state state;
+  qois_enc_state_init(&state, corpus->desc.width, corpus->desc.height, corpus->desc.channels,
+                      corpus->desc.colorspace);
+
+  size_t output_pos = 0;
+  for (size_t i = 0; i < corpus->raw_size; i++)
+  {
+    int outputted = qois_encode_byte(&state, corpus->raw[i], output + output_pos, output_size - output_pos);
+    if (outputted < 0)
+      return 0;
+    output_pos += (size_t)outputted;
+  }
+
+  // Images without pixels only have a header and footer
+  if (corpus->raw_size == 0)
+  {
+    int outputted = qois_encode_pixels(&state, corpus->raw, 0, output, output_size);
+    output_pos = outputted > 0 ? (size_t)outputted : 0;
+  }
+
+  return output_pos;
+}
+
+static size_t bench_encode_pixels(const bench_corpus *corpus, uint8_t *output, size_t output_size)
+{
+  qois_enc_state state;
+  qois_enc_state_init(&state, corpus->desc.width, corpus->desc.height, corpus->desc.channels,
+                      corpus->desc.colorspace);
+
+  size_t pixel_count = (size_t)corpus->desc.width * corpus->desc.height;
+  size_t output_pos = 0;
+  size_t pixel_pos = 0;
+  do
+  {
+    size_t pixels = pixel_count - pixel_pos;
+    if (pixels > 1024 * 1024)
+      pixels = 1024 * 1024;
+
+    int outputted = qois_encode_pixels(&state, corpus->raw + pixel_pos * corpus->desc.channels, pixels,
+                                       output + output_pos, output_size - output_pos);
+    if (outputted < 0)
+      return 0;
+
+    output_pos += (size_t)outputted;
+    pixel_pos += pixels;
+  } while (state.state != QOIS_STATE_DONE);
+
+  return output_pos;
+}
+
+static size_t bench_decode_byte(const bench_corpus *corpus, uint8_t *output, size_t output_size)
+{
+  qois_dec_state state;
+  qois_dec_state_init(&state, 0);
+
+  size_t output_pos = 0;
+  for (size_t i = 0; i < corpus->qoi_size; i++)
+  {
+    int outputted = qois_decode_byte(&state, corpus->qoi[i], output + output_pos, output_size - output_pos);
+    if (outputted < 0)
+      return 0;
+    output_pos += (size_t)outputted;
+  }
+
+  return output_pos;
+}
+
+static size_t bench_decode_buffer(const bench_corpus *corpus, uint8_t *output, size_t output_size)
+{
+  qois_dec_state state;
+  qois_dec_state_init(&state, 0);
+
+  size_t input_pos = 0;
+  size_t output_pos = 0;
+  while (input_pos < corpus->qoi_size && state.state != QOIS_STATE_DONE)
+  {
+    size_t consumed = 0;
+    int outputted = qois_decode_buffer(&state, corpus->qoi + input_pos, corpus->qoi_size - input_pos,
+                                       output + output_pos, output_size - output_pos, &consumed);
+    if (outputted < 0 || (outputted == 0 && consumed == 0))
+      return 0;
+
+    input_pos += consumed;
+    output_pos += (size_t)outputted;
+  }
+
+  return output_pos;
+}
+
+static size_t bench_skip_buffer(const bench_corpus *corpus, uint8_t *output, size_t output_size)
+{
+  (void)output;
+  (void)output_size;
+
+  qois_dec_state state;
+  qois_dec_state_init(&state, 0);
+
+  size_t consumed = 0;
+  if (qois_skip_buffer(&state, corpus->qoi, corpus->qoi_size, SIZE_MAX, &consumed) < 0 ||
+      state.state != QOIS_STATE_DONE)
+    return 0;
+
+  return consumed;
+}
+
+static size_t bench_decode_target(const bench_corpus *corpus, uint8_t *output, size_t output_size, qois_format format)
+{
+  const size_t pixel_count = (size_t)corpus->desc.width * corpus->desc.height;
+  const uint8_t size = qois_format_size(format);
+  if (pixel_count * size > output_size)
+    return 0;
+
+  qois_target target;
+  qois_target_init(&target, output, (size_t)corpus->desc.width * size, format);
+
+  qois_dec_state state;
+  qois_dec_state_init(&state, 0);
+
+  size_t consumed = 0;
+  if (qois_decode_target(&state, corpus->qoi, corpus->qoi_size, &target, &consumed) < 0 ||
+      state.state != QOIS_STATE_DONE)
+    return 0;
+
+  return pixel_count * size;
+}
+
+// The 1 and 2 byte formats fill runs with their own repeat patterns
+static size_t bench_decode_rgb565(const bench_corpus *corpus, uint8_t *output, size_t output_size)
+{
+  return bench_decode_target(corpus, output, output_size, QOIS_FORMAT_RGB565);
+}
+
+static size_t bench_decode_a8(const bench_corpus *corpus, uint8_t *output, size_t output_size)
+{
+  return bench_decode_target(corpus, output, output_size, QOIS_FORMAT_A8);
+}
+
+static const bench_path bench_paths[] = {
+    {"encode_byte", bench_encode_byte, true, false, QOIS_FORMAT_RGB},
+    {"encode_pixels", bench_encode_pixels, true, false, QOIS_FORMAT_RGB},
+    {"decode_byte", bench_decode_byte, false, false, QOIS_FORMAT_RGB},
+    {"decode_buffer", bench_decode_buffer, false, false, QOIS_FORMAT_RGB},
+    {"skip_buffer", bench_skip_buffer, false, false, QOIS_FORMAT_RGB},
+    {"decode_rgb565", bench_decode_rgb565, false, true, QOIS_FORMAT_RGB565},
+    {"decode_a8", bench_decode_a8, false, true, QOIS_FORMAT_A8},
+};
+
+// Checks the output of a target decoder against the raw pixels of the corpus converted to its format
+static bool bench_verify_target(const bench_corpus *corpus, qois_format format, const uint8_t *output, size_t written)
+{
+  const size_t pixel_count = (size_t)corpus->desc.width * corpus->desc.height;
+  const uint8_t size = qois_format_size(format);
+  if (written != pixel_count * size)
+    return false;
+
+  for (size_t i = 0; i < pixel_count; i++)
+  {
+    qois_pixel pixel = {0, 0, 0, 255};
+    memcpy(&pixel, corpus->raw + i * corpus->desc.channels, corpus->desc.channels);
+
+    qois_pixel converted = _qois_convert_pixel(&pixel, format);
+    uint8_t expected[sizeof(qois_pixel)];
+    _qois_store_converted(expected, &converted, size);
+    if (memcmp(output + i * size, expected, size) != 0)
+      return false;
+  }
+
+  return true;
+}
+
+// Runs every path over the corpus, and prints the results as a JSON object
+static void bench_run_corpus(const bench_corpus *corpus, const bench_options *options, bool first)
+{
+  size_t pixel_count = (size_t)corpus->desc.width * corpus->desc.height;
+
+  // Room for the worst case encode, and for the run slack the byte decoder asks for
+  size_t output_size = pixel_count * (size_t)(corpus->desc.channels + 2) + 64 * sizeof(qois_pixel) + 64;
+  uint8_t *output = malloc(output_size);
+
+  printf("%s\n    {\n", first ? "" : ",");
+  printf("      \"name\": ");
+  bench_print_string(corpus->name);
+  printf(",\n");
+  printf("      \"reference\": \"%s\",\n", corpus->reference);
+  printf("      \"width\": %u,\n", corpus->desc.width);
+  printf("      \"height\": %u,\n", corpus->desc.height);
+  printf("      \"channels\": %u,\n", corpus->desc.channels);
+  printf("      \"raw_bytes\": %zu,\n", corpus->raw_size);
+  printf("      \"qoi_bytes\": %zu,\n", corpus->qoi_size);
+  printf("      \"results\": [");
+
+  for (size_t p = 0; p < sizeof(bench_paths) / sizeof(bench_paths[0]); p++)
+  {
+    const bench_path *path = &bench_paths[p];
+
+    double best_seconds = 0;
+    uint64_t best_cycles = 0;
+    size_t written = 0;
+    for (unsigned i = 0; i < options->iterations; i++)
+    {
+      double start = bench_seconds();
+      uint64_t start_cycles = bench_cycles();
+
+      written = path->run(corpus, output, output_size);
+
+      uint64_t cycles = bench_cycles() - start_cycles;
+      double seconds = bench_seconds() - start;
+      if (i == 0 || seconds < best_seconds)
+      {
+        best_seconds = seconds;
+        best_cycles = cycles;
+      }
+    }
+
+    bool verified;
+    if (path->target)
+      verified = bench_verify_target(corpus, path->format, output, written);
+    else if (path->run == bench_skip_buffer)
+      verified = written == corpus->qoi_size;
+    else if (path->encode)
+      verified = written == corpus->qoi_size && memcmp(output, corpus->qoi, written) == 0;
+    else
+      verified = written == corpus->raw_size && memcmp(output, corpus->raw, written) == 0;
+
+    if (best_seconds <= 0)
+      best_seconds = 1e-9;
+
+    printf("%s\n        {\n", p == 0 ? "" : ",");
+    printf("          \"path\": \"%s\",\n", path->name);
+    printf("          \"seconds\": %.9f,\n", best_seconds);
+    printf("          \"mb_per_s\": %.3f,\n", (double)corpus->raw_size / best_seconds / 1e6);
+    printf("          \"mpixels_per_s\": %.3f,\n", (double)pixel_count / best_seconds / 1e6);
+#ifdef BENCH_HAS_CYCLES
+    printf("          \"cycles_per_byte\": %.4f,\n",
+           corpus->raw_size > 0 ? (double)best_cycles / (double)corpus->raw_size : 0.0);
+#else
+    (void)best_cycles;
+    printf("          \"cycles_per_byte\": null,\n");
+#endif
+    printf("          \"verified\": %s\n", verified ? "true" : "false");
+    printf("        }");
+  }
+
+  printf("\n      ]\n    }");
+  free(output);
+}
+
+static bool bench_ends_with(const char *str, const char *suffix)
+{
+  size_t str_length = strlen(str);
+  size_t suffix_length = strlen(suffix);
+  return str_length >= suffix_length && strcmp(str + str_length - suffix_length, suffix) == 0;
+}
+
+static void print_usage(const char *name)
+{
+  fprintf(stderr, "Usage: %s [options]\n", name);
+  fprintf(stderr, "Options:\n");
+  fprintf(stderr, "  --dir <directory>         Also benchmark every .qoi file in the directory, checked against\n");
+  fprintf(stderr, "                            a .ppm or .pam file of the same name when there is one\n");
+  fprintf(stderr, "  --iterations <count>      Runs per path, the fastest one is reported (default: 5)\n");
+  fprintf(stderr, "  --no-synthetic            Skip the synthetic corpora\n");
+  fprintf(stderr, "  --size <width>x<height>   Size of the synthetic images (default: 1024x1024)\n");
+}
+
+int main(int argc, char **argv)
+{
+  bench_options options;
+  options.width = 1024;
+  options.height = 1024;
+  options.iterations = 5;
+  options.directory = NULL;
+  options.synthetic = true;
+
+  for (int i = 1; i < argc; i++)
+  {
+    if (strcmp(argv[i], "--size") == 0 && i + 1 < argc)
+    {
+      if (sscanf(argv[++i], "%ux%u", &options.width, &options.height) != 2)
+      {
+        print_usage(argv[0]);
+        return 1;
+      }
+    }
+    else if (strcmp(argv[i], "--iterations") == 0 && i + 1 < argc)
+    {
+      int iterations = atoi(argv[++i]);
+      if (iterations < 1)
+      {
+        fprintf(stderr, "Iterations must be at least 1\n");
+        return 1;
+      }
+      options.iterations = (unsigned)iterations;
+    }
+    else if (strcmp(argv[i], "--dir") == 0 && i + 1 < argc)
+      options.directory = argv[++i];
+    else if (strcmp(argv[i], "--no-synthetic") == 0)
+      options.synthetic = false;
+    else
+    {
+      print_usage(argv[0]);
+      return 1;
+    }
+  }
+
+  printf("{\n");
+  printf("  \"iterations\": %u,\n", options.iterations);
+  printf("  \"corpora\": [");
+
+  bool first = true;
+  bool failed = false;
+
+  if (options.synthetic)
+  {
+    for (int pattern = BENCH_FLAT; pattern <= BENCH_PHOTO; pattern++)
+    {
+      for (uint8_t channels = 3; channels <= 4; channels++)
+      {
+        // Alpha heavy images only make sense with an alpha channel
+        if (pattern == BENCH_ALPHA && channels == 3)
+          continue;
+
+        bench_corpus corpus;
+        bench_generate(&corpus, (bench_pattern)pattern, options.width, options.height, channels);
+        if (bench_corpus_encode(&corpus))
+        {
+          bench_run_corpus(&corpus, &options, first);
+          first = false;
+        }
+        else
+          failed = true;
+
+        free(corpus.raw);
+        free(corpus.qoi);
+      }
+    }
+  }
+
+  if (options.directory)
+  {
+    DIR *directory = opendir(options.directory);
+    if (!directory)
+    {
+      fprintf(stderr, "Failed to open directory '%s'\n", options.directory);
+      failed = true;
+    }
+
+    struct dirent *entry;
+    while (directory && (entry = readdir(directory)))
+    {
+      if (!bench_ends_with(entry->d_name, ".qoi"))
+        continue;
+
+      char path[4096];
+      snprintf(path, sizeof(path), "%s/%s", options.directory, entry->d_name);
+
+      bench_corpus corpus;
+      if (!bench_load(&corpus, path, entry->d_name))
+      {
+        fprintf(stderr, "Failed to load '%s'\n", path);
+        failed = true;
+        continue;
+      }
+
+      if (bench_corpus_encode(&corpus))
+      {
+        bench_run_corpus(&corpus, &options, first);
+        first = false;
+      }
+      else
+        failed = true;
+
+      free(corpus.raw);
+      free(corpus.qoi);
+    }
+
+    if (directory)
+      closedir(directory);
+  }
+
+  printf("\n  ]\n}\n");
+
+  return failed ? 1 : 0;
+}
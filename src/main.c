@@ -1,186 +1,4012 @@
+// vmsplice and the pipe size controls are Linux extensions
+#if defined(__linux__)
+#define _GNU_SOURCE
+#endif
+#define _POSIX_C_SOURCE 200809L
+#define _FILE_OFFSET_BITS 64
+
 #include <stdio.h>
 #include <stdint.h>
+#include <inttypes.h>
 #include <string.h>
 #include <stdlib.h>
 #include <stdbool.h>
 #include <time.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <poll.h>
+#include <errno.h>
+#include <stdarg.h>
+
+#if defined(__linux__)
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <sys/uio.h>
+#endif
 
 #include "qoi-stream.h"
+#include "qoi-stream-segments.h"
+#include "qoi-stream-index.h"
+#include "qoi-stream-target.h"
+#include "qoi-stream-source.h"
+#include "qoi-stream-sequence.h"
+#include "qoi-stream-lz.h"
+#include "qoi-stream-netpbm.h"
+#include "qoi-stream-scale.h"
 
-int main(int argc, char **argv)
+// Read and write files in blocks of 1MB
+#define BUFFER_SIZE (1024 * 1024)
+
+// Pixels handed to the codec per call in mmap mode, this keeps the output of every call below INT_MAX
+#define MAPPED_CHUNK_PIXELS (32 * 1024 * 1024)
+
+// Output buffers handed to a pipe with vmsplice, a buffer is only reused once the pipe has drained it
+#define SPLICE_BUFFERS 4
+
+typedef struct _cli_options
+{
+  // Amount of threads used for segmented containers and indexed images
+  unsigned threads;
+  // Rows per segment when encoding, 0 writes a plain QOI image
+  uint32_t segment_rows;
+  // Checkpoint index used to decode a plain QOI image in parallel
+  const char *index_path;
+  // Only decode the rows from first_row up to last_row, when rows is set
+  bool rows;
+  uint32_t first_row;
+  uint32_t last_row;
+  // Map the files into memory instead of copying them through buffers
+  bool mmap;
+  // Splice decoded buffers into the output when it is a pipe, only safe for readers that copy them out
+  bool splice;
+  // Print the op statistics at the end, needs QOIS_STATS
+  bool stats;
+  // Overlap reading, coding and writing on separate threads
+  bool pipeline;
+  size_t ring_depth;
+  size_t buffer_size;
+  // Pixel format and row pitch of the raw pixels, when format is set
+  bool format;
+  qois_format pixel_format;
+  size_t pitch;
+  // Frames between key frames of a sequence, 0 only makes the first frame a key frame
+  uint32_t key_interval;
+  // Window bits of the LZ stage after the encoder, 0 writes the QOI image as is
+  uint8_t lz_window_bits;
+  // Write the decoded pixels as a PPM or PAM image
+  qois_pnm_type netpbm;
+  // Average blocks of scale_x by scale_y pixels into one when decoding, 0 decodes at full size
+  uint32_t scale_x;
+  uint32_t scale_y;
+} cli_options;
+
+// Util functions
+
+static bool ends_with(const char *str, const char *suffix)
+{
+  size_t str_length = strlen(str);
+  size_t suffix_length = strlen(suffix);
+  return str_length > suffix_length && strcmp(str + str_length - suffix_length, suffix) == 0;
+}
+
+static bool is_regular_file(FILE *file)
+{
+  struct stat info;
+  return fstat(fileno(file), &info) == 0 && S_ISREG(info.st_mode);
+}
+
+static bool is_pipe(FILE *file)
+{
+  struct stat info;
+  return fstat(fileno(file), &info) == 0 && S_ISFIFO(info.st_mode);
+}
+
+static uint64_t file_size(FILE *file)
+{
+  struct stat info;
+  if (fstat(fileno(file), &info) != 0)
+    return 0;
+  return (uint64_t)info.st_size;
+}
+
+static bool read_at(FILE *file, void *buffer, size_t size, uint64_t offset)
 {
-  if (argc < 3)
+  uint8_t *position = buffer;
+  while (size > 0)
   {
-    fprintf(stderr, "Usage:\n");
-    fprintf(stderr, "  %s <input.qoi> <output> [channels = 3,4]", argv[0]);
-    fprintf(stderr, "  %s <input> <output.qoi> <width> <height> <channels = 3,4> <colorspace = 0,1>", argv[0]);
+    ssize_t result = pread(fileno(file), position, size, (off_t)offset);
+    if (result <= 0)
+      return false;
 
-    return 1;
+    position += result;
+    offset += (uint64_t)result;
+    size -= (size_t)result;
   }
+  return true;
+}
 
-  FILE *input = fopen(argv[1], "rb");
-  if (!input)
+static bool write_at(FILE *file, const void *buffer, size_t size, uint64_t offset)
+{
+  const uint8_t *position = buffer;
+  while (size > 0)
   {
-    fprintf(stderr, "Failed to open input file '%s'", argv[1]);
-    return 1;
+    ssize_t result = pwrite(fileno(file), position, size, (off_t)offset);
+    if (result <= 0)
+      return false;
+
+    position += result;
+    offset += (uint64_t)result;
+    size -= (size_t)result;
   }
+  return true;
+}
 
-  FILE *output = fopen(argv[2], "wb");
-  if (!output)
+// Messages about the file being converted. Batch workers convert many files on every thread, so they
+// set the path of their current file to name it in every message, and count an image that ended early
+// as failed. Other conversions only warn about it.
+
+typedef struct _cli_file_context
+{
+  const char *path;
+  bool incomplete;
+} cli_file_context;
+
+static __thread cli_file_context cli_file;
+
+static void cli_message(const char *format, ...)
+{
+  if (cli_file.path)
+    fprintf(stderr, "%s: ", cli_file.path);
+
+  va_list args;
+  va_start(args, format);
+  vfprintf(stderr, format, args);
+  va_end(args);
+}
+
+static void cli_incomplete(const char *message)
+{
+  cli_file.incomplete = true;
+  cli_message("%s\n", message);
+}
+
+// Allocations of buffers of a fixed or requested size only fail when the system runs out of memory,
+// they end the program with a message. Buffers sized from an image header are checked where they are
+// allocated, so a damaged header is reported as an image that is too large.
+
+static void *cli_malloc(size_t size)
+{
+  void *data = malloc(size);
+  if (!data && size > 0)
   {
-    fprintf(stderr, "Failed to open output file '%s'", argv[2]);
-    return 1;
+    fprintf(stderr, "Out of memory, failed to allocate %zu bytes\n", size);
+    exit(1);
   }
+  return data;
+}
 
-  bool input_ends_with_qoi = (strlen(argv[1]) > 4 && strcmp(argv[1] + strlen(argv[1]) - 4, ".qoi") == 0);
-  bool output_ends_with_qoi = (strlen(argv[2]) > 4 && strcmp(argv[2] + strlen(argv[2]) - 4, ".qoi") == 0);
+static void *cli_calloc(size_t count, size_t size)
+{
+  void *data = calloc(count, size);
+  if (!data && count > 0 && size > 0)
+  {
+    fprintf(stderr, "Out of memory, failed to allocate %zu bytes\n", count * size);
+    exit(1);
+  }
+  return data;
+}
 
-  // Refuse if both end in .qoi, or if neither end in .qoi
-  if (input_ends_with_qoi == output_ends_with_qoi)
+static void *cli_realloc(void *data, size_t size)
+{
+  data = realloc(data, size);
+  if (!data && size > 0)
   {
-    fprintf(stderr, "Only one of the input and output files may end in .qoi");
-    return 1;
+    fprintf(stderr, "Out of memory, failed to allocate %zu bytes\n", size);
+    exit(1);
   }
+  return data;
+}
+
+// Statistics of every codec state used by a conversion, printed with --stats
+
+#ifdef QOIS_STATS
+static qois_stats cli_stats;
+static pthread_mutex_t cli_stats_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void cli_add_stats(const qois_stats *stats)
+{
+  pthread_mutex_lock(&cli_stats_lock);
+  qois_stats_add(&cli_stats, stats);
+  pthread_mutex_unlock(&cli_stats_lock);
+}
+#endif
+
+static void collect_dec_stats(const qois_dec_state *state)
+{
+#ifdef QOIS_STATS
+  qois_stats stats;
+  qois_dec_get_stats(state, &stats);
+  cli_add_stats(&stats);
+#else
+  (void)state;
+#endif
+}
+
+static void collect_enc_stats(const qois_enc_state *state)
+{
+#ifdef QOIS_STATS
+  qois_stats stats;
+  qois_enc_get_stats(state, &stats);
+  cli_add_stats(&stats);
+#else
+  (void)state;
+#endif
+}
+
+static void collect_seg_dec_stats(const qois_seg_dec_state *state)
+{
+#ifdef QOIS_STATS
+  qois_stats stats;
+  qois_seg_dec_get_stats(state, &stats);
+  cli_add_stats(&stats);
+#else
+  (void)state;
+#endif
+}
+
+static void collect_seg_enc_stats(const qois_seg_enc_state *state)
+{
+#ifdef QOIS_STATS
+  qois_stats stats;
+  qois_seg_enc_get_stats(state, &stats);
+  cli_add_stats(&stats);
+#else
+  (void)state;
+#endif
+}
+
+static void print_stats(FILE *info)
+{
+#ifdef QOIS_STATS
+  static const char *const op_names[] = {"RGB", "RGBA", "INDEX", "DIFF", "LUMA", "RUN"};
+
+  fprintf(info, "Statistics:\n");
+  for (size_t i = 0; i < sizeof(op_names) / sizeof(op_names[0]); i++)
+    fprintf(info, "  %s ops: %" PRIu64 "\n", op_names[i], cli_stats.ops[i]);
+  fprintf(info, "  Pixels: %" PRIu64 "\n", cli_stats.pixels);
+  fprintf(info, "  Op bytes: %" PRIu64 "\n", cli_stats.bytes);
+  fprintf(info, "  Bytes per pixel: %.3f\n", qois_stats_bytes_per_pixel(&cli_stats));
+  fprintf(info, "  Cache hit rate: %.1f%%\n", qois_stats_cache_hit_rate(&cli_stats) * 100);
+  fprintf(info, "  Run lengths:\n");
+  for (size_t i = 0; i < sizeof(cli_stats.runs) / sizeof(cli_stats.runs[0]); i++)
+    if (cli_stats.runs[i] > 0)
+      fprintf(info, "    %zu: %" PRIu64 "\n", i + 1, cli_stats.runs[i]);
+#else
+  (void)info;
+#endif
+}
+
+// Streaming decode of plain and segmented images
+
+typedef struct _cli_decoder
+{
+  bool segmented;
+  qois_dec_state plain;
+  qois_seg_dec_state segments;
+} cli_decoder;
+
+static int cli_decode_buffer(cli_decoder *decoder, const uint8_t *input, size_t input_size,
+                             uint8_t *output, size_t output_size, size_t *consumed)
+{
+  if (decoder->segmented)
+    return qois_seg_decode_buffer(&decoder->segments, input, input_size, output, output_size, consumed);
+  return qois_decode_buffer(&decoder->plain, input, input_size, output, output_size, consumed);
+}
+
+static void cli_decoder_collect_stats(const cli_decoder *decoder)
+{
+  if (decoder->segmented)
+    collect_seg_dec_stats(&decoder->segments);
+  else
+    collect_dec_stats(&decoder->plain);
+}
+
+static bool cli_decoder_done(const cli_decoder *decoder)
+{
+  if (decoder->segmented)
+    return decoder->segments.state == QOIS_STATE_DONE;
+  return decoder->plain.state == QOIS_STATE_DONE;
+}
+
+static int write_row(void *user, uint32_t y, const uint8_t *row, size_t row_size)
+{
+  (void)y;
+  return fwrite(row, 1, row_size, (FILE *)user) == row_size ? 0 : -1;
+}
 
-  if (input_ends_with_qoi)
+// Decodes a plain image one row at a time, starting with the read bytes already in the input buffer.
+// The output buffer holds the row, unless the row is larger than BUFFER_SIZE.
+// With a netpbm type the pixels are preceded by a PPM or PAM header.
+static int decode_stream_rows(FILE *input, FILE *output, uint8_t channels, qois_pnm_type pnm, qois_desc *desc,
+                              uint8_t *input_buffer, size_t read, uint8_t *output_buffer)
+{
+  uint8_t *row = NULL;
+  int status = 0;
+
+  // Rows are written one at a time, a large stdio buffer keeps that from becoming a write call per row
+  setvbuf(output, NULL, _IOFBF, BUFFER_SIZE);
+
+  qois_row_dec_state state;
+  qois_row_dec_state_init(&state, QOIS_FORMAT_RGBA, NULL, 0, write_row, output);
+
+  while (read > 0 && state.dec.state != QOIS_STATE_DONE)
   {
-    // Check if channels is specified
-    uint8_t channels = 0;
-    if (argc > 3)
+    size_t input_pos = 0;
+    while (input_pos < read && state.dec.state != QOIS_STATE_DONE)
     {
-      channels = (uint8_t)atoi(argv[3]);
-      if (channels != 3 && channels != 4)
+      size_t consumed = 0;
+      if (qois_row_decode_buffer(&state, input_buffer + input_pos, read - input_pos, &consumed) < 0)
       {
-        fprintf(stderr, "Channels override must be 3 or 4");
-        return 1;
+        cli_message("Failed to decode byte: %d\n", input_buffer[input_pos + consumed]);
+        status = 1;
+        goto cleanup;
+      }
+      input_pos += consumed;
+
+      // The header is decoded, so the row can be sized
+      if (!state.row && state.dec.state != QOIS_STATE_HEADER)
+      {
+        qois_format format = qois_format_from_channels(channels != 0 ? channels : state.dec.desc.channels);
+
+        if (pnm != QOIS_PNM_NONE)
+        {
+          qois_desc pnm_desc = state.dec.desc;
+          pnm_desc.channels = qois_format_size(format);
+
+          uint8_t header[QOIS_PNM_HEADER_BOUND];
+          int header_size = qois_pnm_write_header(&pnm_desc, pnm, header, sizeof(header));
+          if (header_size < 0)
+          {
+            cli_message("Failed to write the netpbm header\n");
+            status = 1;
+            goto cleanup;
+          }
+          fwrite(header, 1, (size_t)header_size, output);
+        }
+
+        size_t row_size = (size_t)state.dec.desc.width * qois_format_size(format);
+        if (row_size > BUFFER_SIZE && !(row = malloc(row_size)))
+        {
+          cli_message("Image of %" PRIu32 " pixels wide is too large to decode a row at a time\n",
+                      state.dec.desc.width);
+          status = 1;
+          goto cleanup;
+        }
+        qois_row_dec_set_row(&state, format, row ? row : output_buffer, row_size);
       }
     }
 
-    // Read file in blocks of 1MB
-    const size_t input_buffer_size = 1024 * 1024;
-    uint8_t *input_buffer = malloc(input_buffer_size);
+    read = state.dec.state != QOIS_STATE_DONE ? fread(input_buffer, 1, BUFFER_SIZE, input) : 0;
+  }
 
-    // Write file in blocks of 1MB
-    const size_t output_buffer_size = 1024 * 1024;
-    uint8_t *output_buffer = malloc(output_buffer_size);
-    size_t output_buffer_pos = 0;
+  if (state.dec.state != QOIS_STATE_DONE)
+  {
+    cli_incomplete("Image ended before decoding was complete");
 
-    // Read the file in blocks of 1MB and print each byte to stdout
-    qois_dec_state state;
-    qois_dec_state_init(&state, channels);
+    // The pixels of the row that was cut off are written as well, like the other decode paths do
+    if (state.row && state.x > 0)
+      fwrite(state.row, 1, (size_t)state.x * qois_format_size(state.format), output);
+  }
 
-    while (true)
-    {
-      size_t read = fread(input_buffer, 1, input_buffer_size, input);
-      if (read == 0)
-        break;
+  collect_dec_stats(&state.dec);
 
-      for (size_t i = 0; i < read; i++)
-      {
+  *desc = state.dec.desc;
+  if (channels != 0)
+    desc->channels = channels;
 
-        if (output_buffer_pos >= output_buffer_size - 256)
-        {
-          fwrite(output_buffer, 1, output_buffer_pos, output);
-          output_buffer_pos = 0;
-        }
+cleanup:
+  free(row);
+  return status;
+}
+
+// Decodes a plain image that went through the LZ stage, starting with the read bytes already in the input buffer.
+// The QOI bytes are decompressed a buffer at a time into a buffer in between.
+static int decode_lz_stream(FILE *input, FILE *output, uint8_t channels, qois_desc *desc,
+                            uint8_t *input_buffer, size_t read, uint8_t *output_buffer)
+{
+  uint8_t *lz_memory = cli_malloc(qois_lz_dec_memory_size(QOIS_LZ_MAX_WINDOW_BITS));
+  uint8_t *qoi_buffer = cli_malloc(BUFFER_SIZE);
+  int status = 0;
+
+  qois_lz_dec_state lz;
+  qois_lz_dec_state_init(&lz, QOIS_LZ_MAX_WINDOW_BITS, lz_memory);
+
+  qois_dec_state state;
+  qois_dec_state_init(&state, channels);
+
+  size_t output_buffer_pos = 0;
 
-        uint8_t *out = output_buffer + output_buffer_pos;
-        size_t out_size = output_buffer_size - output_buffer_pos;
+  while (read > 0 && state.state != QOIS_STATE_DONE)
+  {
+    size_t input_pos = 0;
+    while (input_pos < read && lz.state != QOIS_STATE_DONE && state.state != QOIS_STATE_DONE)
+    {
+      size_t consumed = 0;
+      int decompressed = qois_lz_decompress(&lz, input_buffer + input_pos, read - input_pos,
+                                            qoi_buffer, BUFFER_SIZE, &consumed);
+      if (decompressed < 0)
+      {
+        cli_message("Failed to decompress byte: %d\n", input_buffer[input_pos + consumed]);
+        status = 1;
+        goto cleanup;
+      }
+      input_pos += consumed;
 
-        int outputted = qois_decode_byte(&state, input_buffer[i], out, out_size);
+      size_t qoi_pos = 0;
+      while (qoi_pos < (size_t)decompressed && state.state != QOIS_STATE_DONE)
+      {
+        int outputted = qois_decode_buffer(&state, qoi_buffer + qoi_pos, (size_t)decompressed - qoi_pos,
+                                           output_buffer + output_buffer_pos, BUFFER_SIZE - output_buffer_pos,
+                                           &consumed);
         if (outputted < 0)
         {
-          fprintf(stderr, "Failed to decode byte: %d", input_buffer[i]);
-          return 1;
+          cli_message("Failed to decode byte: %d\n", qoi_buffer[qoi_pos + consumed]);
+          status = 1;
+          goto cleanup;
         }
 
+        qoi_pos += consumed;
         output_buffer_pos += (size_t)outputted;
-      }
-    }
 
-    if (state.state != QOIS_STATE_DONE)
-    {
-      fprintf(stderr, "Image ended before decoding was complete");
+        // The decoder stopped early because the output buffer is full
+        if (state.state != QOIS_STATE_DONE &&
+            (qoi_pos < (size_t)decompressed || state.run_remaining > 0))
+        {
+          fwrite(output_buffer, 1, output_buffer_pos, output);
+          output_buffer_pos = 0;
+        }
+      }
     }
 
-    fwrite(output_buffer, 1, output_buffer_pos, output);
+    read = state.state != QOIS_STATE_DONE && lz.state != QOIS_STATE_DONE ? fread(input_buffer, 1, BUFFER_SIZE, input) : 0;
+  }
 
-    printf("Image Info:\n");
-    printf("  Width: %d\n", state.desc.width);
-    printf("  Height: %d\n", state.desc.height);
-    printf("  Channels: %d\n", state.desc.channels);
-    printf("  Colorspace: %d\n", state.desc.colorspace);
+  if (state.state != QOIS_STATE_DONE)
+  {
+    cli_incomplete("Image ended before decoding was complete");
   }
-  else
+
+  fwrite(output_buffer, 1, output_buffer_pos, output);
+
+  collect_dec_stats(&state);
+  *desc = state.desc;
+
+cleanup:
+  free(lz_memory);
+  free(qoi_buffer);
+  return status;
+}
+
+// Uses the given buffers of BUFFER_SIZE bytes, so they can be reused between files
+static int decode_stream_buffers(FILE *input, FILE *output, uint8_t channels, qois_desc *desc,
+                                 uint8_t *input_buffer, uint8_t *output_buffer)
+{
+  size_t read = fread(input_buffer, 1, BUFFER_SIZE, input);
+
+  if (qois_is_qoi_lz(input_buffer, read))
+    return decode_lz_stream(input, output, channels, desc, input_buffer, read, output_buffer);
+
+  // Plain images are handed to the output a row at a time
+  if (read < sizeof(qois_seg_magic) || memcmp(input_buffer, qois_seg_magic, sizeof(qois_seg_magic)) != 0)
+    return decode_stream_rows(input, output, channels, QOIS_PNM_NONE, desc, input_buffer, read, output_buffer);
+
+  // Everything else is a segmented container, decoded front to back
+  size_t output_buffer_pos = 0;
+
+  qois_seg_dec_state state;
+  qois_seg_dec_state_init(&state, channels);
+
+  while (read > 0 && state.state != QOIS_STATE_DONE)
   {
-    // Require 4 more arguments: with, height, channels, and colorspace
-    if (argc < 7)
+    size_t input_pos = 0;
+    while (input_pos < read && state.state != QOIS_STATE_DONE)
     {
-      fprintf(stderr, "Usage: %s <input[.qoi]> <output[.qoi]> [width] [height] [channels] [colorspace]", argv[0]);
-      return 1;
+      size_t consumed = 0;
+      int outputted = qois_seg_decode_buffer(&state, input_buffer + input_pos, read - input_pos,
+                                             output_buffer + output_buffer_pos, BUFFER_SIZE - output_buffer_pos,
+                                             &consumed);
+      if (outputted < 0)
+      {
+        cli_message("Failed to decode byte: %d\n", input_buffer[input_pos + consumed]);
+        return 1;
+      }
+
+      input_pos += consumed;
+      output_buffer_pos += (size_t)outputted;
+
+      // The decoder stopped early because the output buffer is full
+      if (input_pos < read && state.state != QOIS_STATE_DONE)
+      {
+        fwrite(output_buffer, 1, output_buffer_pos, output);
+        output_buffer_pos = 0;
+      }
     }
 
-    uint32_t width = (uint32_t)atoi(argv[3]);
-    uint32_t height = (uint32_t)atoi(argv[4]);
-    uint8_t channels = (uint8_t)atoi(argv[5]);
-    uint8_t colorspace = (uint8_t)atoi(argv[6]);
+    read = state.state != QOIS_STATE_DONE ? fread(input_buffer, 1, BUFFER_SIZE, input) : 0;
+  }
+
+  if (state.state != QOIS_STATE_DONE)
+  {
+    cli_incomplete("Image ended before decoding was complete");
+  }
 
-    // Read file in blocks of 1MB
-    const size_t input_buffer_size = 1024 * 1024;
-    uint8_t *input_buffer = malloc(input_buffer_size);
+  fwrite(output_buffer, 1, output_buffer_pos, output);
 
-    // Write file in blocks of 1MB
-    const size_t output_buffer_size = 1024 * 1024;
-    uint8_t *output_buffer = malloc(output_buffer_size);
-    size_t output_buffer_pos = 0;
+  collect_seg_dec_stats(&state);
 
-    // Read the file in blocks of 1MB and print each byte to stdout
+  *desc = state.info.desc;
+  if (channels != 0)
+    desc->channels = channels;
 
-    qois_enc_state state;
-    qois_enc_state_init(&state, width, height, channels, colorspace);
+  return 0;
+}
+
+static int decode_stream(FILE *input, FILE *output, uint8_t channels, qois_desc *desc)
+{
+  uint8_t *input_buffer = cli_malloc(BUFFER_SIZE);
+  uint8_t *output_buffer = cli_malloc(BUFFER_SIZE);
+
+  int status = decode_stream_buffers(input, output, channels, desc, input_buffer, output_buffer);
+
+  free(input_buffer);
+  free(output_buffer);
+  return status;
+}
+
+// Decodes a plain QOI image into a framebuffer with the given format and row pitch, and writes the framebuffer.
+// A pitch of 0 packs the rows without padding.
+static int decode_framebuffer(FILE *input, FILE *output, qois_format format, size_t pitch, qois_desc *desc)
+{
+  uint8_t *input_buffer = cli_malloc(BUFFER_SIZE);
+  uint8_t *pixels = NULL;
+  size_t pixels_size = 0;
+  int status = 0;
+
+  if (!input_buffer)
+  {
+    cli_message("Failed to allocate the input buffer\n");
+    return 1;
+  }
+
+  qois_dec_state state;
+  qois_dec_state_init(&state, 0);
+
+  qois_target target;
+  qois_target_init(&target, NULL, 0, format);
+
+  bool first_read = true;
+  while (state.state != QOIS_STATE_DONE)
+  {
+    size_t read = fread(input_buffer, 1, BUFFER_SIZE, input);
+    if (read == 0)
+      break;
 
-    while (true)
+    // Files behind the LZ stage are turned down before, streams only show it in their first bytes
+    if (first_read && qois_is_qoi_lz(input_buffer, read))
     {
-      size_t read = fread(input_buffer, 1, input_buffer_size, input);
-      if (read == 0)
-        break;
+      cli_message("Formats can only be decoded from a plain QOI file\n");
+      status = 1;
+      goto cleanup;
+    }
+    first_read = false;
+
+    size_t input_pos = 0;
 
-      for (size_t i = 0; i < read; i++)
+    // The framebuffer can only be made once the header is read
+    if (!pixels)
+    {
+      size_t consumed = 0;
+      if (qois_skip_buffer(&state, input_buffer, read, 0, &consumed) < 0)
       {
+        cli_message("Failed to decode byte: %d\n", input_buffer[consumed]);
+        status = 1;
+        goto cleanup;
+      }
+      input_pos = consumed;
 
-        if (output_buffer_pos >= output_buffer_size - 256)
-        {
-          fwrite(output_buffer, 1, output_buffer_pos, output);
-          output_buffer_pos = 0;
-        }
+      if (state.state == QOIS_STATE_HEADER)
+        continue;
 
-        uint8_t *out = output_buffer + output_buffer_pos;
-        size_t out_size = output_buffer_size - output_buffer_pos;
+      size_t row_size = (size_t)state.desc.width * qois_format_size(format);
+      if (pitch == 0)
+        pitch = row_size;
+      if (pitch < row_size)
+      {
+        cli_message("Pitch must be at least %zu bytes\n", row_size);
+        status = 1;
+        goto cleanup;
+      }
 
-        int outputted = qois_encode_byte(&state, input_buffer[i], out, out_size);
-        if (outputted < 0)
-        {
-          fprintf(stderr, "Failed to decode byte: %d", input_buffer[i]);
-          return 1;
-        }
+      // The whole framebuffer is held in memory, the header decides its size
+      if (state.desc.height > 0 && pitch > (SIZE_MAX - 1) / state.desc.height)
+        pixels = NULL;
+      else
+      {
+        pixels_size = pitch * state.desc.height;
+        pixels = calloc(pixels_size + 1, 1);
+      }
 
-        output_buffer_pos += (size_t)outputted;
+      if (!pixels)
+      {
+        cli_message("Image of %" PRIu32 " rows of %zu bytes is too large for a framebuffer\n", state.desc.height,
+                    pitch);
+        status = 1;
+        goto cleanup;
       }
+      qois_target_init(&target, pixels, pitch, format);
     }
 
-    if (state.state != QOIS_STATE_DONE)
+    while (input_pos < read && state.state != QOIS_STATE_DONE)
     {
-      fprintf(stderr, "Data ended before encoding was complete");
+      size_t consumed = 0;
+      if (qois_decode_target(&state, input_buffer + input_pos, read - input_pos, &target, &consumed) < 0)
+      {
+        cli_message("Failed to decode byte: %d\n", input_buffer[input_pos + consumed]);
+        status = 1;
+        goto cleanup;
+      }
+      input_pos += consumed;
     }
+  }
 
-    fwrite(output_buffer, 1, output_buffer_pos, output);
+  if (state.state != QOIS_STATE_DONE)
+    cli_incomplete("Image ended before decoding was complete");
+
+  if (pixels && fwrite(pixels, 1, pixels_size, output) != pixels_size)
+  {
+    cli_message("Failed to write output file\n");
+    status = 1;
+    goto cleanup;
   }
 
-  printf("Done\n");
+  collect_dec_stats(&state);
+  *desc = state.desc;
 
-  // Close the files
-  fclose(input);
-  fclose(output);
+cleanup:
+  free(input_buffer);
+  free(pixels);
+  return status;
+}
 
-  return 0;
+// Streaming encode of plain and segmented images
+
+typedef struct _cli_encoder
+{
+  bool segmented;
+  qois_enc_state plain;
+  qois_seg_enc_state segments;
+  qois_seg_entry *table;
+} cli_encoder;
+
+static size_t cli_encode_bound(const cli_encoder *encoder, size_t pixel_count)
+{
+  if (encoder->segmented)
+    return qois_seg_encode_pixels_bound(&encoder->segments, pixel_count);
+  return qois_encode_pixels_bound(&encoder->plain, pixel_count);
+}
+
+static int cli_encode_pixels(cli_encoder *encoder, const uint8_t *pixels, size_t pixel_count,
+                             uint8_t *output, size_t output_size)
+{
+  if (encoder->segmented)
+    return qois_seg_encode_pixels(&encoder->segments, pixels, pixel_count, output, output_size);
+  return qois_encode_pixels(&encoder->plain, pixels, pixel_count, output, output_size);
+}
+
+static void cli_encoder_collect_stats(const cli_encoder *encoder)
+{
+  if (encoder->segmented)
+    collect_seg_enc_stats(&encoder->segments);
+  else
+    collect_enc_stats(&encoder->plain);
+}
+
+static bool cli_encoder_done(const cli_encoder *encoder)
+{
+  if (encoder->segmented)
+    return encoder->segments.state == QOIS_STATE_DONE;
+  return encoder->plain.state == QOIS_STATE_DONE;
+}
+
+// Uses the given buffers of BUFFER_SIZE bytes, so they can be reused between files.
+// The first leftover bytes of the input buffer are pixels that were already read.
+static int encode_stream_buffers(FILE *input, FILE *output, const qois_desc *desc, uint32_t segment_rows,
+                                 uint8_t *input_buffer, size_t leftover, uint8_t *output_buffer)
+{
+  size_t output_buffer_pos = 0;
+  int status = 0;
+
+  const size_t channels = desc->channels;
+
+  cli_encoder encoder;
+  encoder.segmented = segment_rows > 0;
+  encoder.table = NULL;
+  qois_enc_state_init(&encoder.plain, desc->width, desc->height, desc->channels, desc->colorspace);
+  if (encoder.segmented)
+  {
+    qois_seg_info info;
+    qois_seg_info_init(&info, desc->width, desc->height, desc->channels, desc->colorspace, segment_rows);
+    encoder.table = cli_malloc(info.segment_count * sizeof(qois_seg_entry) + 1);
+    qois_seg_enc_state_init(&encoder.segments, desc->width, desc->height, desc->channels, desc->colorspace,
+                            segment_rows, encoder.table);
+  }
+
+  // Always call the encoder at least once, so images without pixels are written as well.
+  // Bytes of a pixel split over two reads are moved to the front of the buffer, as leftover bytes.
+  bool first_pass = true;
+  while (!cli_encoder_done(&encoder))
+  {
+    size_t read = fread(input_buffer + leftover, 1, BUFFER_SIZE - leftover, input);
+    if (read == 0 && !first_pass)
+      break;
+    first_pass = false;
+
+    size_t available = leftover + read;
+    size_t input_pos = 0;
+    while (!cli_encoder_done(&encoder))
+    {
+      // Make sure there is always room for at least one more pixel
+      if (BUFFER_SIZE - output_buffer_pos < cli_encode_bound(&encoder, 1))
+      {
+        fwrite(output_buffer, 1, output_buffer_pos, output);
+        output_buffer_pos = 0;
+      }
+
+      uint8_t *out = output_buffer + output_buffer_pos;
+      size_t out_size = BUFFER_SIZE - output_buffer_pos;
+
+      size_t pixels = (available - input_pos) / channels;
+      size_t max_pixels = (out_size - cli_encode_bound(&encoder, 0)) / (channels + 2);
+      if (pixels > max_pixels)
+        pixels = max_pixels;
+
+      int outputted = cli_encode_pixels(&encoder, input_buffer + input_pos, pixels, out, out_size);
+      if (outputted < 0)
+      {
+        cli_message("Failed to encode pixels\n");
+        status = 1;
+        goto cleanup;
+      }
+
+      input_pos += pixels * channels;
+      output_buffer_pos += (size_t)outputted;
+
+      if (available - input_pos < channels)
+        break;
+    }
+
+    leftover = available - input_pos;
+    memmove(input_buffer, input_buffer + input_pos, leftover);
+  }
+
+  if (!cli_encoder_done(&encoder))
+  {
+    cli_incomplete("Data ended before encoding was complete");
+  }
+
+  fwrite(output_buffer, 1, output_buffer_pos, output);
+
+  cli_encoder_collect_stats(&encoder);
+
+cleanup:
+  free(encoder.table);
+  return status;
+}
+
+static int encode_stream(FILE *input, FILE *output, const qois_desc *desc, uint32_t segment_rows)
+{
+  uint8_t *input_buffer = cli_malloc(BUFFER_SIZE);
+  uint8_t *output_buffer = cli_malloc(BUFFER_SIZE);
+
+  int status = encode_stream_buffers(input, output, desc, segment_rows, input_buffer, 0, output_buffer);
+
+  free(input_buffer);
+  free(output_buffer);
+  return status;
+}
+
+// Encodes a plain image and passes the QOI bytes through the LZ stage before writing them
+static int encode_lz_stream(FILE *input, FILE *output, const qois_desc *desc, uint8_t window_bits)
+{
+  const size_t channels = desc->channels;
+
+  uint8_t *lz_memory = cli_malloc(qois_lz_enc_memory_size(window_bits));
+  uint8_t *input_buffer = cli_malloc(BUFFER_SIZE);
+  uint8_t *qoi_buffer = cli_malloc(BUFFER_SIZE);
+  uint8_t *output_buffer = cli_malloc(BUFFER_SIZE);
+  int status = 0;
+
+  qois_lz_enc_state lz;
+  qois_lz_enc_state_init(&lz, window_bits, lz_memory);
+
+  qois_enc_state state;
+  qois_enc_state_init(&state, desc->width, desc->height, desc->channels, desc->colorspace);
+
+  // Bytes of a pixel split over two reads are moved to the front of the buffer
+  size_t leftover = 0;
+
+  // Always call the encoder at least once, so images without pixels are written as well
+  bool first_pass = true;
+  while (lz.state != QOIS_STATE_DONE)
+  {
+    size_t read = state.state != QOIS_STATE_DONE ? fread(input_buffer + leftover, 1, BUFFER_SIZE - leftover, input) : 0;
+    if (read == 0 && !first_pass && state.state != QOIS_STATE_DONE)
+      break;
+    first_pass = false;
+
+    size_t available = leftover + read;
+    size_t input_pos = 0;
+    do
+    {
+      size_t pixels = (available - input_pos) / channels;
+      size_t max_pixels = (BUFFER_SIZE - qois_encode_pixels_bound(&state, 0)) / (channels + 2);
+      if (pixels > max_pixels)
+        pixels = max_pixels;
+
+      int encoded = qois_encode_pixels(&state, input_buffer + input_pos, pixels, qoi_buffer, BUFFER_SIZE);
+      if (encoded < 0)
+      {
+        fprintf(stderr, "Failed to encode pixels\n");
+        status = 1;
+        goto cleanup;
+      }
+      input_pos += pixels * channels;
+
+      // The stream is finished with the last bytes of the image
+      size_t qoi_pos = 0;
+      do
+      {
+        size_t consumed = 0;
+        int compressed = state.state == QOIS_STATE_DONE
+                             ? qois_lz_compress_finish(&lz, qoi_buffer + qoi_pos, (size_t)encoded - qoi_pos,
+                                                       output_buffer, BUFFER_SIZE, &consumed)
+                             : qois_lz_compress(&lz, qoi_buffer + qoi_pos, (size_t)encoded - qoi_pos,
+                                                output_buffer, BUFFER_SIZE, &consumed);
+        qoi_pos += consumed;
+
+        if (fwrite(output_buffer, 1, (size_t)compressed, output) != (size_t)compressed)
+        {
+          fprintf(stderr, "Failed to write output file\n");
+          status = 1;
+          goto cleanup;
+        }
+      } while (qoi_pos < (size_t)encoded || (state.state == QOIS_STATE_DONE && lz.state != QOIS_STATE_DONE));
+    } while (available - input_pos >= channels && state.state != QOIS_STATE_DONE);
+
+    leftover = available - input_pos;
+    memmove(input_buffer, input_buffer + input_pos, leftover);
+  }
+
+  if (state.state != QOIS_STATE_DONE)
+  {
+    fprintf(stderr, "Data ended before encoding was complete\n");
+  }
+
+  collect_enc_stats(&state);
+
+cleanup:
+  free(lz_memory);
+  free(input_buffer);
+  free(qoi_buffer);
+  free(output_buffer);
+  return status;
+}
+
+typedef struct _cli_row_reader
+{
+  FILE *input;
+  uint8_t *row;
+  size_t pitch;
+  size_t row_size;
+} cli_row_reader;
+
+static int read_row(void *user, uint32_t y, const uint8_t **planes)
+{
+  (void)y;
+  cli_row_reader *reader = user;
+
+  // The padding after the last row may be left out
+  size_t read = fread(reader->row, 1, reader->pitch, reader->input);
+  if (read < reader->row_size)
+    return -1;
+
+  planes[0] = reader->row;
+  return 0;
+}
+
+// Encodes raw pixels in the given format and row pitch, pulling one row at a time from the input.
+// A pitch of 0 means the rows are packed without padding.
+static int encode_source_file(FILE *input, FILE *output, const qois_desc *desc, qois_format format, size_t pitch)
+{
+  if (format != QOIS_FORMAT_RGB && format != QOIS_FORMAT_RGBA && format != QOIS_FORMAT_BGRA &&
+      format != QOIS_FORMAT_BGRX)
+  {
+    fprintf(stderr, "Only rgb, rgba, bgra and bgrx input can be encoded\n");
+    return 1;
+  }
+
+  cli_row_reader reader;
+  reader.input = input;
+  reader.row_size = (size_t)desc->width * qois_format_size(format);
+  reader.pitch = pitch != 0 ? pitch : reader.row_size;
+  if (reader.pitch < reader.row_size)
+  {
+    fprintf(stderr, "Pitch must be at least %zu bytes\n", reader.row_size);
+    return 1;
+  }
+
+  qois_enc_state state;
+  qois_enc_state_init(&state, desc->width, desc->height, desc->channels, desc->colorspace);
+
+  qois_source source;
+  qois_source_init_callback(&source, format, false, read_row, &reader);
+
+  // Encode as many rows per call as fit in about one buffer of output
+  size_t row_bound = (size_t)desc->width * (desc->channels + 2u);
+  uint32_t rows = row_bound > 0 && BUFFER_SIZE / row_bound > 1 ? (uint32_t)(BUFFER_SIZE / row_bound) : 1;
+  size_t output_size = qois_encode_pixels_bound(&state, (size_t)rows * desc->width);
+
+  reader.row = cli_malloc(reader.pitch + 1);
+  uint8_t *output_buffer = cli_malloc(output_size);
+  int status = 0;
+
+  while (state.state != QOIS_STATE_DONE)
+  {
+    int outputted = qois_encode_rows(&state, &source, rows, output_buffer, output_size);
+    if (outputted < 0)
+    {
+      fprintf(stderr, "Image ended before encoding was complete\n");
+      status = 1;
+      break;
+    }
+
+    if (fwrite(output_buffer, 1, (size_t)outputted, output) != (size_t)outputted)
+    {
+      fprintf(stderr, "Failed to write output file\n");
+      status = 1;
+      break;
+    }
+  }
+
+  collect_enc_stats(&state);
+
+  free(reader.row);
+  free(output_buffer);
+  return status;
+}
+
+// Frame sequences
+
+// Encodes raw frames of the given size, read back to back from the input, into a sequence.
+// Every key_interval frames a key frame is written, 0 only makes the first frame a key frame.
+static int encode_sequence(FILE *input, FILE *output, const qois_desc *desc, uint32_t key_interval,
+                           uint32_t *frames)
+{
+  qois_seq_enc_state state;
+  uint8_t *previous = cli_malloc(qois_seq_frame_size(desc) + 1);
+  qois_seq_enc_state_init(&state, desc->width, desc->height, desc->channels, desc->colorspace, previous);
+
+  size_t row_size = (size_t)desc->width * desc->channels;
+  size_t row_bound = qois_seq_encode_row_bound(&state);
+  size_t output_size = row_bound + sizeof(qois_seq_header) + 1 > BUFFER_SIZE
+                           ? row_bound + sizeof(qois_seq_header) + 1
+                           : BUFFER_SIZE;
+
+  uint8_t *row = cli_malloc(row_size + 1);
+  uint8_t *output_buffer = cli_malloc(output_size);
+  size_t output_buffer_pos = 0;
+  int status = 0;
+
+  // A frame is only started once its first row could be read
+  while (row_size == 0 || fread(row, 1, row_size, input) == row_size)
+  {
+    bool key_frame = state.frames == 0 || (key_interval > 0 && state.frames % key_interval == 0);
+    output_buffer_pos += (size_t)qois_seq_begin_frame(&state, key_frame, output_buffer + output_buffer_pos,
+                                                      output_size - output_buffer_pos);
+
+    for (uint32_t y = 0; y < desc->height; y++)
+    {
+      if (y > 0 && fread(row, 1, row_size, input) != row_size)
+      {
+        fprintf(stderr, "Frame %u ended before encoding was complete\n", state.frames);
+        status = 1;
+        goto cleanup;
+      }
+
+      if (output_size - output_buffer_pos < row_bound)
+      {
+        fwrite(output_buffer, 1, output_buffer_pos, output);
+        output_buffer_pos = 0;
+      }
+
+      int outputted = qois_seq_encode_row(&state, row, output_buffer + output_buffer_pos,
+                                          output_size - output_buffer_pos);
+      if (outputted < 0)
+      {
+        fprintf(stderr, "Failed to encode frame %u\n", state.frames);
+        status = 1;
+        goto cleanup;
+      }
+      output_buffer_pos += (size_t)outputted;
+    }
+
+    if (output_size - output_buffer_pos < sizeof(qois_seq_header) + 1)
+    {
+      fwrite(output_buffer, 1, output_buffer_pos, output);
+      output_buffer_pos = 0;
+    }
+
+    // Frames without pixels can not be told apart in the input, so there is only one
+    if (row_size == 0)
+      break;
+  }
+
+  output_buffer_pos += (size_t)qois_seq_end(&state, output_buffer + output_buffer_pos, output_size - output_buffer_pos);
+
+  if (fwrite(output_buffer, 1, output_buffer_pos, output) != output_buffer_pos)
+  {
+    fprintf(stderr, "Failed to write output file\n");
+    status = 1;
+  }
+
+  collect_enc_stats(&state.enc);
+  *frames = state.frames;
+
+cleanup:
+  free(previous);
+  free(row);
+  free(output_buffer);
+  return status;
+}
+
+// Decodes a sequence, writing every frame in full to the output
+static int decode_sequence(FILE *input, FILE *output, qois_desc *desc, uint32_t *frames)
+{
+  uint8_t *input_buffer = cli_malloc(BUFFER_SIZE);
+  uint8_t *frame = NULL;
+  int status = 0;
+
+  qois_seq_dec_state state;
+  qois_seq_dec_state_init(&state, NULL, 0);
+
+  size_t read;
+  while (state.state != QOIS_STATE_DONE && (read = fread(input_buffer, 1, BUFFER_SIZE, input)) > 0)
+  {
+    size_t input_pos = 0;
+    while (input_pos < read && state.state != QOIS_STATE_DONE)
+    {
+      size_t consumed = 0;
+      int result = qois_seq_decode_buffer(&state, input_buffer + input_pos, read - input_pos, &consumed);
+      if (result < 0)
+      {
+        fprintf(stderr, "Failed to decode byte: %d\n", input_buffer[input_pos + consumed]);
+        status = 1;
+        goto cleanup;
+      }
+      input_pos += consumed;
+
+      // The header is decoded, so the frame can be sized
+      if (!frame && state.state != QOIS_STATE_HEADER)
+      {
+        // Frames are held whole, the header decides their size
+        size_t row_size = (size_t)state.desc.width * state.desc.channels;
+        size_t frame_size = qois_seq_frame_size(&state.desc);
+        if ((state.desc.height > 0 && row_size > (SIZE_MAX - 1) / state.desc.height) ||
+            !(frame = malloc(frame_size + 1)))
+        {
+          fprintf(stderr, "Frames of %" PRIu32 "x%" PRIu32 " pixels are too large\n", state.desc.width,
+                  state.desc.height);
+          status = 1;
+          goto cleanup;
+        }
+        qois_seq_dec_set_frame(&state, frame, frame_size);
+      }
+
+      if (result == 1 && fwrite(frame, 1, state.frame_size, output) != state.frame_size)
+      {
+        fprintf(stderr, "Failed to write output file\n");
+        status = 1;
+        goto cleanup;
+      }
+    }
+  }
+
+  if (state.state != QOIS_STATE_DONE)
+  {
+    fprintf(stderr, "Sequence ended before decoding was complete\n");
+  }
+
+  collect_dec_stats(&state.dec);
+  *desc = state.desc;
+  *frames = state.frames;
+
+cleanup:
+  free(input_buffer);
+  free(frame);
+  return status;
+}
+
+// Netpbm images, the PPM or PAM header is handled here and the pixels are streamed as raw pixels
+
+// Encodes a PPM or PAM image, the header decides the size and channels of the image
+static int encode_netpbm(FILE *input, FILE *output, uint32_t segment_rows, qois_desc *desc)
+{
+  uint8_t *input_buffer = cli_malloc(BUFFER_SIZE);
+  uint8_t *output_buffer = cli_malloc(BUFFER_SIZE);
+  int status = 0;
+
+  qois_pnm_parser parser;
+  qois_pnm_parser_init(&parser);
+
+  size_t read = 0;
+  size_t consumed = 0;
+  int result = 0;
+  while (result == 0)
+  {
+    read = fread(input_buffer, 1, BUFFER_SIZE, input);
+    if (read == 0)
+      break;
+    result = qois_pnm_parse(&parser, input_buffer, read, &consumed);
+  }
+
+  if (result != 1)
+  {
+    fprintf(stderr, "Input is not a PPM or PAM image with 8 bit RGB or RGBA samples\n");
+    status = 1;
+    goto cleanup;
+  }
+
+  // The pixels read along with the header are handed to the encoder first
+  memmove(input_buffer, input_buffer + consumed, read - consumed);
+
+  *desc = parser.desc;
+  status = encode_stream_buffers(input, output, desc, segment_rows, input_buffer, read - consumed, output_buffer);
+
+cleanup:
+  free(input_buffer);
+  free(output_buffer);
+  return status;
+}
+
+// Decodes a plain image into a PPM or PAM image, PPM images always get 3 channels
+static int decode_netpbm(FILE *input, FILE *output, uint8_t channels, qois_pnm_type pnm, qois_desc *desc)
+{
+  uint8_t *input_buffer = cli_malloc(BUFFER_SIZE);
+  uint8_t *output_buffer = cli_malloc(BUFFER_SIZE);
+  int status;
+
+  size_t read = fread(input_buffer, 1, BUFFER_SIZE, input);
+  if (!qois_is_qoi(input_buffer, read))
+  {
+    fprintf(stderr, "Netpbm images can only be decoded from a plain QOI image\n");
+    status = 1;
+  }
+  else
+    status = decode_stream_rows(input, output, pnm == QOIS_PNM_PPM ? 3 : channels, pnm, desc, input_buffer, read,
+                                output_buffer);
+
+  free(input_buffer);
+  free(output_buffer);
+  return status;
+}
+
+// Downscaled decode, every block of pixels is averaged into a single pixel of a smaller image
+
+typedef struct _cli_scale_writer
+{
+  FILE *output;
+  // Encode the scaled rows into a QOI image again, instead of writing the pixels
+  bool encode;
+  qois_enc_state enc;
+  uint8_t *buffer;
+} cli_scale_writer;
+
+static int write_scaled_row(void *user, uint32_t y, const uint8_t *row, size_t row_size)
+{
+  cli_scale_writer *writer = (cli_scale_writer *)user;
+  (void)y;
+
+  if (!writer->encode)
+    return fwrite(row, 1, row_size, writer->output) == row_size ? 0 : -1;
+
+  size_t pixels = row_size / writer->enc.desc.channels;
+  int outputted = qois_encode_pixels(&writer->enc, row, pixels, writer->buffer,
+                                     qois_encode_pixels_bound(&writer->enc, pixels));
+  if (outputted < 0)
+    return -1;
+  return fwrite(writer->buffer, 1, (size_t)outputted, writer->output) == (size_t)outputted ? 0 : -1;
+}
+
+// Decodes a plain image into one that is scale_x times narrower and scale_y times lower, as raw pixels,
+// a PPM or PAM image, or a QOI image when encode is set
+static int decode_scaled(FILE *input, FILE *output, uint8_t channels, uint32_t scale_x, uint32_t scale_y,
+                         qois_pnm_type pnm, bool encode, qois_desc *desc)
+{
+  uint8_t *input_buffer = cli_malloc(BUFFER_SIZE);
+  uint32_t *sums = NULL;
+  uint8_t *row = NULL;
+  int status = 0;
+
+  setvbuf(output, NULL, _IOFBF, BUFFER_SIZE);
+
+  cli_scale_writer writer;
+  writer.output = output;
+  writer.encode = encode;
+  writer.buffer = NULL;
+
+  qois_scale_dec_state state;
+  qois_scale_dec_state_init(&state, scale_x, scale_y, pnm == QOIS_PNM_PPM ? 3 : channels, NULL, NULL,
+                            write_scaled_row, &writer);
+
+  size_t read = fread(input_buffer, 1, BUFFER_SIZE, input);
+
+  // Files behind the LZ stage are turned down before, streams only show it in their first bytes
+  if (qois_is_qoi_lz(input_buffer, read))
+  {
+    fprintf(stderr, "Images can only be downscaled from a plain QOI file, without --rows or --format\n");
+    status = 1;
+    goto cleanup;
+  }
+  while (read > 0 && state.dec.state != QOIS_STATE_DONE)
+  {
+    size_t input_pos = 0;
+    while (input_pos < read && state.dec.state != QOIS_STATE_DONE)
+    {
+      size_t consumed = 0;
+      if (qois_scale_decode_buffer(&state, input_buffer + input_pos, read - input_pos, &consumed) < 0)
+      {
+        fprintf(stderr, "Failed to decode byte: %d\n", input_buffer[input_pos + consumed]);
+        status = 1;
+        goto cleanup;
+      }
+      input_pos += consumed;
+
+      // The header is decoded, so the rows can be sized
+      if (!sums && state.dec.state != QOIS_STATE_HEADER)
+      {
+        if (pnm != QOIS_PNM_NONE)
+        {
+          uint8_t header[QOIS_PNM_HEADER_BOUND];
+          int header_size = qois_pnm_write_header(&state.desc, pnm, header, sizeof(header));
+          if (header_size < 0)
+          {
+            fprintf(stderr, "Failed to write the netpbm header\n");
+            status = 1;
+            goto cleanup;
+          }
+          fwrite(header, 1, (size_t)header_size, output);
+        }
+
+        if (encode)
+        {
+          qois_enc_state_init(&writer.enc, state.desc.width, state.desc.height, state.desc.channels,
+                              state.desc.colorspace);
+          writer.buffer = malloc(qois_encode_pixels_bound(&writer.enc, state.desc.width));
+        }
+
+        // The rows of the scaled image are sized from the header
+        sums = malloc(qois_scale_sums_size(&state.desc) + 1);
+        row = malloc(qois_scale_row_size(&state.desc) + 1);
+        if (!sums || !row || (encode && !writer.buffer))
+        {
+          fprintf(stderr, "Scaled image of %" PRIu32 " pixels wide is too large\n", state.desc.width);
+          status = 1;
+          goto cleanup;
+        }
+        qois_scale_dec_set_rows(&state, sums, row);
+      }
+    }
+
+    read = state.dec.state != QOIS_STATE_DONE ? fread(input_buffer, 1, BUFFER_SIZE, input) : 0;
+  }
+
+  if (state.dec.state != QOIS_STATE_DONE)
+  {
+    fprintf(stderr, "Image ended before decoding was complete\n");
+  }
+
+  collect_dec_stats(&state.dec);
+  if (encode)
+    collect_enc_stats(&writer.enc);
+
+  *desc = state.desc;
+
+cleanup:
+  free(input_buffer);
+  free(sums);
+  free(row);
+  free(writer.buffer);
+  return status;
+}
+
+// Spliced pipe output
+//
+// Decoded buffers are mapped into the output pipe with vmsplice instead of being copied into it.
+// The pipe then refers to the pages of the buffer, so a buffer is only decoded into again once the
+// pipe holds less than the bytes queued after it. When no buffer is free yet, the decoder writes into
+// a spare buffer that is copied with write, which also blocks until the reader catches up.
+// The pipe draining does not mean the pages are free: a reader that splices them on, like tee, still
+// refers to them after they left this pipe. That is why this mode is only used with --splice.
+
+typedef struct _cli_splice_writer
+{
+  int fd;
+  bool splice;
+
+  uint8_t *buffers[SPLICE_BUFFERS];
+  uint8_t *spare;
+
+  // Bytes queued in the pipe in total, and the total right after every buffer was queued
+  uint64_t queued;
+  uint64_t queued_after[SPLICE_BUFFERS];
+  unsigned next;
+} cli_splice_writer;
+
+static bool write_all(int fd, const uint8_t *data, size_t size)
+{
+  while (size > 0)
+  {
+    ssize_t result = write(fd, data, size);
+    if (result < 0 && errno == EINTR)
+      continue;
+    if (result <= 0)
+      return false;
+
+    data += result;
+    size -= (size_t)result;
+  }
+  return true;
+}
+
+static void splice_writer_init(cli_splice_writer *writer, int fd)
+{
+  writer->fd = fd;
+  writer->splice = false;
+  writer->queued = 0;
+  writer->next = 0;
+
+  for (unsigned i = 0; i < SPLICE_BUFFERS; i++)
+  {
+    writer->buffers[i] = NULL;
+    writer->queued_after[i] = 0;
+  }
+
+#if defined(__linux__)
+  struct stat info;
+  if (fstat(fd, &info) == 0 && S_ISFIFO(info.st_mode))
+  {
+    // A pipe that holds a whole buffer lets the decoder run ahead of the reader by one buffer
+    fcntl(fd, F_SETPIPE_SZ, BUFFER_SIZE);
+
+    // The buffers are mapped on their own, so unmapping them never touches pages the pipe still refers to
+    writer->splice = true;
+    for (unsigned i = 0; i < SPLICE_BUFFERS; i++)
+    {
+      void *buffer = mmap(NULL, BUFFER_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+      writer->buffers[i] = buffer != MAP_FAILED ? buffer : NULL;
+      writer->splice &= writer->buffers[i] != NULL;
+    }
+  }
+#endif
+
+  writer->spare = cli_malloc(BUFFER_SIZE);
+}
+
+static void splice_writer_free(cli_splice_writer *writer)
+{
+  for (unsigned i = 0; i < SPLICE_BUFFERS; i++)
+    if (writer->buffers[i])
+      munmap(writer->buffers[i], BUFFER_SIZE);
+  free(writer->spare);
+}
+
+// Returns the buffer to decode the next BUFFER_SIZE bytes into
+static uint8_t *splice_writer_buffer(cli_splice_writer *writer)
+{
+#if defined(__linux__)
+  int pending = 0;
+  if (writer->splice && ioctl(writer->fd, FIONREAD, &pending) == 0 &&
+      writer->queued - (uint64_t)pending >= writer->queued_after[writer->next])
+    return writer->buffers[writer->next];
+#endif
+  return writer->spare;
+}
+
+// Queues the first size bytes of the buffer from splice_writer_buffer, returns false on error
+static bool splice_writer_commit(cli_splice_writer *writer, uint8_t *buffer, size_t size)
+{
+#if defined(__linux__)
+  if (buffer != writer->spare)
+  {
+    struct iovec vector;
+    vector.iov_base = buffer;
+    vector.iov_len = size;
+
+    while (vector.iov_len > 0)
+    {
+      ssize_t result = vmsplice(writer->fd, &vector, 1, 0);
+      if (result < 0 && errno == EINTR)
+        continue;
+      if (result <= 0)
+      {
+        // Not every pipe end supports vmsplice, copy the rest and stay with copies from now on
+        writer->splice = false;
+        if (!write_all(writer->fd, vector.iov_base, vector.iov_len))
+          return false;
+        break;
+      }
+
+      vector.iov_base = (uint8_t *)vector.iov_base + result;
+      vector.iov_len -= (size_t)result;
+    }
+
+    writer->queued += size;
+    writer->queued_after[writer->next] = writer->queued;
+    writer->next = (writer->next + 1) % SPLICE_BUFFERS;
+    return true;
+  }
+#endif
+
+  if (!write_all(writer->fd, buffer, size))
+    return false;
+  writer->queued += size;
+  return true;
+}
+
+// Decodes a plain or segmented image to a pipe, splicing the decoded buffers into it
+static int decode_spliced(FILE *input, FILE *output, uint8_t channels, qois_desc *desc)
+{
+  uint8_t *input_buffer = cli_malloc(BUFFER_SIZE);
+  size_t read = fread(input_buffer, 1, BUFFER_SIZE, input);
+  int status = 0;
+
+  // Images behind the LZ stage go through the regular streaming decoder
+  if (qois_is_qoi_lz(input_buffer, read))
+  {
+    uint8_t *output_buffer = cli_malloc(BUFFER_SIZE);
+    status = decode_lz_stream(input, output, channels, desc, input_buffer, read, output_buffer);
+    free(output_buffer);
+    free(input_buffer);
+    return status;
+  }
+
+  cli_decoder decoder;
+  decoder.segmented = read >= sizeof(qois_seg_magic) && memcmp(input_buffer, qois_seg_magic, sizeof(qois_seg_magic)) == 0;
+  qois_dec_state_init(&decoder.plain, channels);
+  qois_seg_dec_state_init(&decoder.segments, channels);
+
+  fflush(output);
+  cli_splice_writer writer;
+  splice_writer_init(&writer, fileno(output));
+
+  uint8_t *output_buffer = splice_writer_buffer(&writer);
+  size_t output_buffer_pos = 0;
+
+  while (read > 0 && !cli_decoder_done(&decoder))
+  {
+    size_t input_pos = 0;
+    while (input_pos < read && !cli_decoder_done(&decoder))
+    {
+      size_t consumed = 0;
+      int outputted = cli_decode_buffer(&decoder, input_buffer + input_pos, read - input_pos,
+                                        output_buffer + output_buffer_pos, BUFFER_SIZE - output_buffer_pos,
+                                        &consumed);
+      if (outputted < 0)
+      {
+        fprintf(stderr, "Failed to decode byte: %d\n", input_buffer[input_pos + consumed]);
+        status = 1;
+        goto cleanup;
+      }
+
+      input_pos += consumed;
+      output_buffer_pos += (size_t)outputted;
+
+      // Buffers are handed to the pipe once no further pixel fits, the size is not a multiple of 3
+      if (BUFFER_SIZE - output_buffer_pos < sizeof(qois_pixel))
+      {
+        if (!splice_writer_commit(&writer, output_buffer, output_buffer_pos))
+        {
+          fprintf(stderr, "Failed to write output\n");
+          status = 1;
+          goto cleanup;
+        }
+        output_buffer = splice_writer_buffer(&writer);
+        output_buffer_pos = 0;
+      }
+    }
+
+    read = !cli_decoder_done(&decoder) ? fread(input_buffer, 1, BUFFER_SIZE, input) : 0;
+  }
+
+  if (!cli_decoder_done(&decoder))
+  {
+    fprintf(stderr, "Image ended before decoding was complete\n");
+  }
+
+  if (!splice_writer_commit(&writer, output_buffer, output_buffer_pos))
+  {
+    fprintf(stderr, "Failed to write output\n");
+    status = 1;
+    goto cleanup;
+  }
+
+  cli_decoder_collect_stats(&decoder);
+
+  *desc = decoder.segmented ? decoder.segments.info.desc : decoder.plain.desc;
+  if (channels != 0)
+    desc->channels = channels;
+
+cleanup:
+  splice_writer_free(&writer);
+  free(input_buffer);
+  return status;
+}
+
+// Memory mapped decode and encode, the codec reads and writes the file mappings directly
+
+typedef struct _cli_mapping
+{
+  uint8_t *data;
+  size_t size;
+} cli_mapping;
+
+static bool map_file(FILE *file, size_t size, bool writable, cli_mapping *mapping)
+{
+  mapping->data = NULL;
+  mapping->size = size;
+
+  // Empty files can not be mapped, but there is nothing to access either
+  if (size == 0)
+    return true;
+
+  int protection = writable ? PROT_READ | PROT_WRITE : PROT_READ;
+  void *data = mmap(NULL, size, protection, MAP_SHARED, fileno(file), 0);
+  if (data == MAP_FAILED)
+    return false;
+
+  mapping->data = data;
+  return true;
+}
+
+static void unmap_file(cli_mapping *mapping)
+{
+  if (mapping->data)
+    munmap(mapping->data, mapping->size);
+}
+
+static int decode_mapped(FILE *input, FILE *output, uint8_t channels, qois_desc *desc)
+{
+  cli_mapping in;
+  if (!map_file(input, (size_t)file_size(input), false, &in))
+  {
+    fprintf(stderr, "Failed to map input file\n");
+    return 1;
+  }
+
+  cli_decoder decoder;
+  qois_dec_state_init(&decoder.plain, channels);
+  qois_seg_dec_state_init(&decoder.segments, channels);
+
+  // The output is sized from the header, so the decoder can write straight into it
+  qois_seg_info info;
+  decoder.segmented = qois_seg_read_header(in.data, in.size, &info);
+  if (decoder.segmented)
+    *desc = info.desc;
+  else if (!qois_get_desc(in.data, in.size, desc))
+  {
+    fprintf(stderr, "Invalid image header\n");
+    unmap_file(&in);
+    return 1;
+  }
+
+  if (channels != 0)
+    desc->channels = channels;
+
+  int status = 0;
+  size_t output_size = (size_t)desc->width * desc->height * desc->channels;
+
+  cli_mapping out;
+  if (ftruncate(fileno(output), (off_t)output_size) != 0 || !map_file(output, output_size, true, &out))
+  {
+    fprintf(stderr, "Failed to map output file\n");
+    unmap_file(&in);
+    return 1;
+  }
+
+  size_t input_pos = 0;
+  size_t output_pos = 0;
+  while (!cli_decoder_done(&decoder))
+  {
+    size_t window = output_size - output_pos;
+    if (window > (size_t)MAPPED_CHUNK_PIXELS * desc->channels)
+      window = (size_t)MAPPED_CHUNK_PIXELS * desc->channels;
+
+    size_t consumed = 0;
+    int outputted = cli_decode_buffer(&decoder, in.data + input_pos, in.size - input_pos,
+                                      out.data + output_pos, window, &consumed);
+    if (outputted < 0)
+    {
+      fprintf(stderr, "Failed to decode byte: %d\n", in.data[input_pos + consumed]);
+      status = 1;
+      break;
+    }
+
+    input_pos += consumed;
+    output_pos += (size_t)outputted;
+
+    if (outputted == 0 && consumed == 0)
+      break;
+  }
+
+  if (status == 0 && !cli_decoder_done(&decoder))
+  {
+    fprintf(stderr, "Image ended before decoding was complete\n");
+  }
+
+  cli_decoder_collect_stats(&decoder);
+
+  unmap_file(&in);
+  unmap_file(&out);
+
+  // The output was sized for the whole image, an image that stopped early only keeps the decoded bytes
+  if (!cli_decoder_done(&decoder) && ftruncate(fileno(output), (off_t)output_pos) != 0)
+  {
+    fprintf(stderr, "Failed to resize output file\n");
+    status = 1;
+  }
+
+  return status;
+}
+
+static int encode_mapped(FILE *input, FILE *output, const qois_desc *desc, uint32_t segment_rows)
+{
+  const size_t channels = desc->channels;
+  const size_t pixel_count = (size_t)desc->width * desc->height;
+
+  cli_mapping in;
+  if (file_size(input) < pixel_count * channels || !map_file(input, pixel_count * channels, false, &in))
+  {
+    fprintf(stderr, "Failed to map input file, it has to hold the whole image\n");
+    return 1;
+  }
+
+  cli_encoder encoder;
+  encoder.segmented = segment_rows > 0;
+  encoder.table = NULL;
+  qois_enc_state_init(&encoder.plain, desc->width, desc->height, desc->channels, desc->colorspace);
+  if (encoder.segmented)
+  {
+    qois_seg_info info;
+    qois_seg_info_init(&info, desc->width, desc->height, desc->channels, desc->colorspace, segment_rows);
+    encoder.table = cli_malloc(info.segment_count * sizeof(qois_seg_entry) + 1);
+    qois_seg_enc_state_init(&encoder.segments, desc->width, desc->height, desc->channels, desc->colorspace,
+                            segment_rows, encoder.table);
+  }
+
+  // Map enough output for the worst case, and cut the file to the real size afterwards
+  int status = 0;
+  size_t output_size = cli_encode_bound(&encoder, pixel_count);
+
+  cli_mapping out;
+  if (ftruncate(fileno(output), (off_t)output_size) != 0 || !map_file(output, output_size, true, &out))
+  {
+    fprintf(stderr, "Failed to map output file\n");
+    unmap_file(&in);
+    free(encoder.table);
+    return 1;
+  }
+
+  size_t input_pos = 0;
+  size_t output_pos = 0;
+  while (!cli_encoder_done(&encoder))
+  {
+    size_t pixels = pixel_count - input_pos / channels;
+    if (pixels > MAPPED_CHUNK_PIXELS)
+      pixels = MAPPED_CHUNK_PIXELS;
+
+    int outputted = cli_encode_pixels(&encoder, in.data + input_pos, pixels,
+                                      out.data + output_pos, output_size - output_pos);
+    if (outputted < 0)
+    {
+      fprintf(stderr, "Failed to encode pixels\n");
+      status = 1;
+      break;
+    }
+
+    input_pos += pixels * channels;
+    output_pos += (size_t)outputted;
+  }
+
+  cli_encoder_collect_stats(&encoder);
+
+  unmap_file(&in);
+  unmap_file(&out);
+  free(encoder.table);
+
+  if (ftruncate(fileno(output), (off_t)output_pos) != 0)
+  {
+    fprintf(stderr, "Failed to resize output file\n");
+    status = 1;
+  }
+
+  return status;
+}
+
+// Pipelined decode and encode, a reader and a writer thread keep the I/O going while the codec runs.
+// Buffers are passed between the threads through single producer, single consumer rings. A thread that
+// finds its ring empty or full sleeps on the condition of the ring, so waiting threads leave the cores
+// to the codec. The other side only takes the lock to wake it when a thread is actually waiting.
+
+typedef struct _pipe_buffer
+{
+  uint8_t *data;
+  size_t capacity;
+  size_t size;
+  // Set on the last buffer of the stream
+  bool end;
+} pipe_buffer;
+
+typedef struct _spsc_ring
+{
+  pipe_buffer **slots;
+  size_t capacity;
+  // Only written by the producer
+  size_t head;
+  // Only written by the consumer
+  size_t tail;
+
+  pthread_mutex_t lock;
+  pthread_cond_t changed;
+  unsigned waiting;
+} spsc_ring;
+
+static void ring_init(spsc_ring *ring, size_t capacity)
+{
+  ring->slots = cli_malloc(capacity * sizeof(pipe_buffer *));
+  ring->capacity = capacity;
+  ring->head = 0;
+  ring->tail = 0;
+
+  pthread_mutex_init(&ring->lock, NULL);
+  pthread_cond_init(&ring->changed, NULL);
+  ring->waiting = 0;
+}
+
+static void ring_free(spsc_ring *ring)
+{
+  free(ring->slots);
+  pthread_mutex_destroy(&ring->lock);
+  pthread_cond_destroy(&ring->changed);
+}
+
+static void ring_wake(spsc_ring *ring)
+{
+  pthread_mutex_lock(&ring->lock);
+  pthread_cond_broadcast(&ring->changed);
+  pthread_mutex_unlock(&ring->lock);
+}
+
+// Wakes the other side after a push or a pop, if it is waiting. The fence pairs with the one in
+// ring_wait_begin, so either this sees the waiter or the waiter sees the change.
+static void ring_notify(spsc_ring *ring)
+{
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  if (__atomic_load_n(&ring->waiting, __ATOMIC_RELAXED) > 0)
+    ring_wake(ring);
+}
+
+static void ring_wait_begin(spsc_ring *ring)
+{
+  pthread_mutex_lock(&ring->lock);
+  __atomic_add_fetch(&ring->waiting, 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+static void ring_wait_end(spsc_ring *ring)
+{
+  __atomic_sub_fetch(&ring->waiting, 1, __ATOMIC_RELAXED);
+  pthread_mutex_unlock(&ring->lock);
+}
+
+static bool ring_try_push(spsc_ring *ring, pipe_buffer *buffer)
+{
+  size_t head = __atomic_load_n(&ring->head, __ATOMIC_RELAXED);
+  size_t tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+  if (head - tail == ring->capacity)
+    return false;
+
+  ring->slots[head % ring->capacity] = buffer;
+  __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+  return true;
+}
+
+static pipe_buffer *ring_try_pop(spsc_ring *ring)
+{
+  size_t tail = __atomic_load_n(&ring->tail, __ATOMIC_RELAXED);
+  size_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+  if (head == tail)
+    return NULL;
+
+  pipe_buffer *buffer = ring->slots[tail % ring->capacity];
+  __atomic_store_n(&ring->tail, tail + 1, __ATOMIC_RELEASE);
+  return buffer;
+}
+
+// Waits for a buffer, returns NULL when cancel is set first
+static pipe_buffer *ring_pop_wait(spsc_ring *ring, const bool *cancel)
+{
+  pipe_buffer *buffer = ring_try_pop(ring);
+  if (!buffer)
+  {
+    ring_wait_begin(ring);
+    while (!(buffer = ring_try_pop(ring)) && !__atomic_load_n(cancel, __ATOMIC_ACQUIRE))
+      pthread_cond_wait(&ring->changed, &ring->lock);
+    ring_wait_end(ring);
+  }
+
+  if (buffer)
+    ring_notify(ring);
+  return buffer;
+}
+
+// Every ring can hold all buffers of its pool, so pushing only waits if the pool is misused
+static void ring_push_always(spsc_ring *ring, pipe_buffer *buffer)
+{
+  if (!ring_try_push(ring, buffer))
+  {
+    ring_wait_begin(ring);
+    while (!ring_try_push(ring, buffer))
+      pthread_cond_wait(&ring->changed, &ring->lock);
+    ring_wait_end(ring);
+  }
+
+  ring_notify(ring);
+}
+
+typedef struct _pipeline
+{
+  FILE *input;
+  FILE *output;
+  size_t depth;
+  // Input buffers are handed on in multiples of input_granule bytes, and the first one with at least
+  // input_minimum bytes unless the input ends first
+  size_t input_granule;
+  size_t input_minimum;
+
+  pipe_buffer *input_buffers;
+  pipe_buffer *output_buffers;
+
+  // Reader to codec, and back
+  spsc_ring input_full;
+  spsc_ring input_free;
+  // Codec to writer, and back
+  spsc_ring output_full;
+  spsc_ring output_free;
+
+  // Set by the codec when it needs no more input
+  bool done;
+  // Set when the codec or the writer gives up
+  bool failed;
+  bool read_error;
+
+  // Written to when done or failed is set, this wakes a reader that waits for input from a pipe
+  int wake[2];
+
+  pthread_t reader;
+  pthread_t writer;
+} pipeline;
+
+// Sets done or failed, and wakes every thread that waits on the pipeline
+static void pipeline_cancel(pipeline *stages, bool *flag)
+{
+  __atomic_store_n(flag, true, __ATOMIC_RELEASE);
+
+  ring_wake(&stages->input_full);
+  ring_wake(&stages->input_free);
+  ring_wake(&stages->output_full);
+  ring_wake(&stages->output_free);
+
+  // The wake pipe is written to at most twice, so this never blocks
+  uint8_t byte = 0;
+  ssize_t written;
+  do
+    written = write(stages->wake[1], &byte, 1);
+  while (written < 0 && errno == EINTR);
+}
+
+static bool input_ready(int fd)
+{
+  struct pollfd input;
+  input.fd = fd;
+  input.events = POLLIN;
+  return poll(&input, 1, 0) != 0;
+}
+
+// Fills the buffer up to its capacity or the end of the input. A pipe that has nothing more to read right
+// now hands on what arrived so far, like the end of an image that is followed by more data later.
+// Reads only start once the input is ready, so a reader on an open pipe can be stopped.
+// Returns false when the pipeline is stopped first.
+static bool pipeline_fill(pipeline *stages, pipe_buffer *buffer, size_t minimum)
+{
+  int fd = fileno(stages->input);
+
+  buffer->size = 0;
+  buffer->end = false;
+  while (buffer->size < buffer->capacity)
+  {
+    if (buffer->size > 0 && buffer->size >= minimum && buffer->size % stages->input_granule == 0 &&
+        !input_ready(fd))
+      break;
+
+    struct pollfd fds[2];
+    fds[0].fd = fd;
+    fds[0].events = POLLIN;
+    fds[1].fd = stages->wake[0];
+    fds[1].events = POLLIN;
+
+    int ready = poll(fds, 2, -1);
+    if (ready < 0 && errno == EINTR)
+      continue;
+    if (ready > 0 && fds[1].revents != 0)
+      return false;
+
+    ssize_t result = ready > 0 ? read(fd, buffer->data + buffer->size, buffer->capacity - buffer->size) : -1;
+    if (result < 0 && (errno == EINTR || errno == EAGAIN))
+      continue;
+    if (result <= 0)
+    {
+      if (result < 0)
+        __atomic_store_n(&stages->read_error, true, __ATOMIC_RELEASE);
+      buffer->end = true;
+      break;
+    }
+
+    buffer->size += (size_t)result;
+  }
+
+  return true;
+}
+
+static void *pipeline_reader(void *arg)
+{
+  pipeline *stages = arg;
+
+  pipe_buffer *buffer;
+  size_t minimum = stages->input_minimum;
+  while ((buffer = ring_pop_wait(&stages->input_free, &stages->done)))
+  {
+    if (!pipeline_fill(stages, buffer, minimum))
+      break;
+    minimum = 0;
+
+    ring_push_always(&stages->input_full, buffer);
+    if (buffer->end)
+      break;
+  }
+
+  return NULL;
+}
+
+static void *pipeline_writer(void *arg)
+{
+  pipeline *stages = arg;
+
+  pipe_buffer *buffer;
+  while ((buffer = ring_pop_wait(&stages->output_full, &stages->failed)))
+  {
+    bool end = buffer->end;
+    if (fwrite(buffer->data, 1, buffer->size, stages->output) != buffer->size)
+    {
+      fprintf(stderr, "Failed to write output file\n");
+      pipeline_cancel(stages, &stages->failed);
+      break;
+    }
+
+    buffer->size = 0;
+    ring_push_always(&stages->output_free, buffer);
+    if (end)
+      break;
+  }
+
+  return NULL;
+}
+
+static void pipeline_init_buffers(pipe_buffer *buffers, size_t count, size_t capacity)
+{
+  for (size_t i = 0; i < count; i++)
+  {
+    buffers[i].data = cli_malloc(capacity);
+    buffers[i].capacity = capacity;
+    buffers[i].size = 0;
+    buffers[i].end = false;
+  }
+}
+
+// Starts the reader and the writer. Input buffers hold up to input_capacity bytes, see input_granule and
+// input_minimum in pipeline.
+static bool pipeline_start(pipeline *stages, FILE *input, FILE *output, size_t depth, size_t input_capacity,
+                           size_t input_granule, size_t input_minimum, size_t output_capacity)
+{
+  stages->input = input;
+  stages->output = output;
+  stages->depth = depth;
+  stages->input_granule = input_granule;
+  stages->input_minimum = input_minimum;
+  stages->done = false;
+  stages->failed = false;
+  stages->read_error = false;
+
+  stages->input_buffers = cli_malloc(depth * sizeof(pipe_buffer));
+  stages->output_buffers = cli_malloc(depth * sizeof(pipe_buffer));
+  pipeline_init_buffers(stages->input_buffers, depth, input_capacity);
+  pipeline_init_buffers(stages->output_buffers, depth, output_capacity);
+
+  ring_init(&stages->input_full, depth);
+  ring_init(&stages->input_free, depth);
+  ring_init(&stages->output_full, depth);
+  ring_init(&stages->output_free, depth);
+
+  for (size_t i = 0; i < depth; i++)
+  {
+    ring_push_always(&stages->input_free, &stages->input_buffers[i]);
+    ring_push_always(&stages->output_free, &stages->output_buffers[i]);
+  }
+
+  if (pipe(stages->wake) != 0)
+    return false;
+  if (pthread_create(&stages->reader, NULL, pipeline_reader, stages) != 0)
+    return false;
+  if (pthread_create(&stages->writer, NULL, pipeline_writer, stages) != 0)
+  {
+    pipeline_cancel(stages, &stages->done);
+    pthread_join(stages->reader, NULL);
+    return false;
+  }
+
+  return true;
+}
+
+// Returns the next filled input buffer, or NULL if the pipeline failed
+static pipe_buffer *pipeline_input(pipeline *stages)
+{
+  return ring_pop_wait(&stages->input_full, &stages->failed);
+}
+
+static void pipeline_release_input(pipeline *stages, pipe_buffer *buffer)
+{
+  ring_push_always(&stages->input_free, buffer);
+}
+
+// Returns an empty output buffer, or NULL if the pipeline failed
+static pipe_buffer *pipeline_output(pipeline *stages)
+{
+  return ring_pop_wait(&stages->output_free, &stages->failed);
+}
+
+static void pipeline_write(pipeline *stages, pipe_buffer *buffer)
+{
+  ring_push_always(&stages->output_full, buffer);
+}
+
+// Writes the last output buffer, stops the threads and frees the pipeline. Returns 0 if everything was written.
+static int pipeline_finish(pipeline *stages, pipe_buffer *last, bool failed)
+{
+  if (failed || !last)
+    pipeline_cancel(stages, &stages->failed);
+  else
+  {
+    last->end = true;
+    pipeline_write(stages, last);
+  }
+
+  // The reader may still wait on the input, it is woken up through the wake pipe
+  pipeline_cancel(stages, &stages->done);
+  pthread_join(stages->reader, NULL);
+  pthread_join(stages->writer, NULL);
+  close(stages->wake[0]);
+  close(stages->wake[1]);
+
+  int status = stages->failed ? 1 : 0;
+  if (stages->read_error)
+  {
+    fprintf(stderr, "Failed to read input file\n");
+    status = 1;
+  }
+
+  for (size_t i = 0; i < stages->depth; i++)
+  {
+    free(stages->input_buffers[i].data);
+    free(stages->output_buffers[i].data);
+  }
+  free(stages->input_buffers);
+  free(stages->output_buffers);
+  ring_free(&stages->input_full);
+  ring_free(&stages->input_free);
+  ring_free(&stages->output_full);
+  ring_free(&stages->output_free);
+
+  return status;
+}
+
+static int decode_pipelined(FILE *input, FILE *output, uint8_t channels, size_t depth, size_t buffer_size,
+                            qois_desc *desc)
+{
+  // Runs that do not fit in an output buffer are continued in the next one
+  pipeline stages;
+  if (!pipeline_start(&stages, input, output, depth, buffer_size, 1, sizeof(qois_lz_header), buffer_size))
+  {
+    fprintf(stderr, "Failed to start the pipeline threads\n");
+    return 1;
+  }
+
+  int status = 0;
+
+  cli_decoder decoder;
+  decoder.segmented = false;
+  qois_dec_state_init(&decoder.plain, channels);
+  qois_seg_dec_state_init(&decoder.segments, channels);
+
+  pipe_buffer *out = pipeline_output(&stages);
+  bool first_read = true;
+  while (out && status == 0 && !cli_decoder_done(&decoder))
+  {
+    pipe_buffer *in = pipeline_input(&stages);
+    if (!in)
+      break;
+
+    // Images behind the LZ stage are only seen here when they come from a stream, files go to decode_stream
+    if (first_read && qois_is_qoi_lz(in->data, in->size))
+    {
+      fprintf(stderr, "LZ input can not be decoded with --pipeline\n");
+      status = 1;
+      pipeline_release_input(&stages, in);
+      break;
+    }
+
+    if (first_read)
+      decoder.segmented = in->size >= sizeof(qois_seg_magic) &&
+                          memcmp(in->data, qois_seg_magic, sizeof(qois_seg_magic)) == 0;
+    first_read = false;
+
+    size_t input_pos = 0;
+    while (input_pos < in->size && !cli_decoder_done(&decoder))
+    {
+      size_t consumed = 0;
+      int outputted = cli_decode_buffer(&decoder, in->data + input_pos, in->size - input_pos,
+                                        out->data + out->size, out->capacity - out->size, &consumed);
+      if (outputted < 0)
+      {
+        fprintf(stderr, "Failed to decode byte: %d\n", in->data[input_pos + consumed]);
+        status = 1;
+        break;
+      }
+
+      input_pos += consumed;
+      out->size += (size_t)outputted;
+
+      // The decoder stopped early because the output buffer is full
+      if (input_pos < in->size && !cli_decoder_done(&decoder))
+      {
+        pipeline_write(&stages, out);
+        if (!(out = pipeline_output(&stages)))
+          break;
+      }
+    }
+
+    bool end = in->end;
+    pipeline_release_input(&stages, in);
+    if (end)
+      break;
+  }
+
+  if (status == 0 && out && !cli_decoder_done(&decoder))
+  {
+    fprintf(stderr, "Image ended before decoding was complete\n");
+  }
+
+  cli_decoder_collect_stats(&decoder);
+
+  *desc = decoder.segmented ? decoder.segments.info.desc : decoder.plain.desc;
+  if (decoder.segmented && channels != 0)
+    desc->channels = channels;
+
+  if (pipeline_finish(&stages, out, status != 0) != 0)
+    status = 1;
+  return status;
+}
+
+static int encode_pipelined(FILE *input, FILE *output, const qois_desc *desc, uint32_t segment_rows,
+                            size_t depth, size_t buffer_size)
+{
+  const size_t channels = desc->channels;
+  int status = 0;
+
+  cli_encoder encoder;
+  encoder.segmented = segment_rows > 0;
+  encoder.table = NULL;
+  qois_enc_state_init(&encoder.plain, desc->width, desc->height, desc->channels, desc->colorspace);
+  if (encoder.segmented)
+  {
+    qois_seg_info info;
+    qois_seg_info_init(&info, desc->width, desc->height, desc->channels, desc->colorspace, segment_rows);
+    encoder.table = cli_malloc(info.segment_count * sizeof(qois_seg_entry) + 1);
+    qois_seg_enc_state_init(&encoder.segments, desc->width, desc->height, desc->channels, desc->colorspace,
+                            segment_rows, encoder.table);
+  }
+
+  // Input buffers only hold whole pixels, and output buffers always fit at least one more pixel
+  size_t input_capacity = buffer_size - buffer_size % channels;
+  size_t output_capacity = buffer_size + cli_encode_bound(&encoder, 1);
+
+  pipeline stages;
+  if (!pipeline_start(&stages, input, output, depth, input_capacity, channels, 0, output_capacity))
+  {
+    fprintf(stderr, "Failed to start the pipeline threads\n");
+    free(encoder.table);
+    return 1;
+  }
+
+  pipe_buffer *out = pipeline_output(&stages);
+  while (out && status == 0 && !cli_encoder_done(&encoder))
+  {
+    pipe_buffer *in = pipeline_input(&stages);
+    if (!in)
+      break;
+
+    // Always call the encoder at least once, so images without pixels are written as well
+    size_t input_pos = 0;
+    do
+    {
+      if (out->capacity - out->size < cli_encode_bound(&encoder, 1))
+      {
+        pipeline_write(&stages, out);
+        if (!(out = pipeline_output(&stages)))
+          break;
+      }
+
+      size_t pixels = (in->size - input_pos) / channels;
+      size_t max_pixels = (out->capacity - out->size - cli_encode_bound(&encoder, 0)) / (channels + 2);
+      if (pixels > max_pixels)
+        pixels = max_pixels;
+
+      int outputted = cli_encode_pixels(&encoder, in->data + input_pos, pixels,
+                                        out->data + out->size, out->capacity - out->size);
+      if (outputted < 0)
+      {
+        fprintf(stderr, "Failed to encode pixels\n");
+        status = 1;
+        break;
+      }
+
+      input_pos += pixels * channels;
+      out->size += (size_t)outputted;
+    } while (!cli_encoder_done(&encoder) && in->size - input_pos >= channels);
+
+    bool end = in->end;
+    pipeline_release_input(&stages, in);
+    if (end)
+      break;
+  }
+
+  if (status == 0 && out && !cli_encoder_done(&encoder))
+  {
+    fprintf(stderr, "Data ended before encoding was complete\n");
+  }
+
+  cli_encoder_collect_stats(&encoder);
+
+  if (pipeline_finish(&stages, out, status != 0) != 0)
+    status = 1;
+
+  free(encoder.table);
+  return status;
+}
+
+// Parallel encode and decode of segmented containers and indexed images
+
+typedef struct _parallel_job
+{
+  FILE *input;
+  FILE *output;
+  uint64_t input_size;
+  uint8_t channels;
+
+  // Segmented containers
+  qois_seg_info info;
+  qois_seg_entry *table;
+
+  // Indexed images
+  qois_desc desc;
+  qois_checkpoint *checkpoints;
+
+  pthread_mutex_t lock;
+  pthread_cond_t changed;
+  uint32_t part_count;
+  uint32_t next_part;
+  bool failed;
+
+  // Encoding only: parts are written in order, workers may run ahead by at most window parts
+  uint32_t written;
+  uint32_t window;
+  uint8_t **results;
+  size_t *result_sizes;
+} parallel_job;
+
+static bool parallel_job_next(parallel_job *job, uint32_t *part)
+{
+  pthread_mutex_lock(&job->lock);
+
+  while (!job->failed && job->results && job->next_part < job->part_count &&
+         job->next_part >= job->written + job->window)
+    pthread_cond_wait(&job->changed, &job->lock);
+
+  bool found = !job->failed && job->next_part < job->part_count;
+  if (found)
+    *part = job->next_part++;
+
+  pthread_mutex_unlock(&job->lock);
+  return found;
+}
+
+static void parallel_job_fail(parallel_job *job)
+{
+  pthread_mutex_lock(&job->lock);
+  job->failed = true;
+  pthread_cond_broadcast(&job->changed);
+  pthread_mutex_unlock(&job->lock);
+}
+
+static void *decode_segment_worker(void *arg)
+{
+  parallel_job *job = arg;
+
+  uint8_t *input_buffer = NULL;
+  uint8_t *output_buffer = NULL;
+  size_t input_buffer_size = 0;
+  size_t output_buffer_size = 0;
+
+  uint32_t segment;
+  while (parallel_job_next(job, &segment))
+  {
+    size_t input_size = (size_t)qois_seg_size(&job->info, job->table, segment, job->input_size);
+    size_t output_size = (size_t)qois_seg_rows(&job->info, segment) * job->info.desc.width * job->channels;
+
+    if (input_size > input_buffer_size)
+    {
+      free(input_buffer);
+      input_buffer_size = input_size;
+      input_buffer = cli_malloc(input_buffer_size);
+    }
+    if (output_size > output_buffer_size)
+    {
+      free(output_buffer);
+      output_buffer_size = output_size;
+      output_buffer = cli_malloc(output_buffer_size);
+    }
+
+    if (!read_at(job->input, input_buffer, input_size, job->table[segment].byte_offset))
+    {
+      fprintf(stderr, "Failed to read segment %u\n", segment);
+      parallel_job_fail(job);
+      break;
+    }
+
+    qois_dec_state state;
+    qois_dec_state_init(&state, job->channels);
+
+    // Segments are large, so decode them in parts that fit in an int
+    size_t input_pos = 0;
+    size_t output_pos = 0;
+    while (input_pos < input_size && state.state != QOIS_STATE_DONE)
+    {
+      size_t consumed = 0;
+      int outputted = qois_decode_buffer(&state, input_buffer + input_pos, input_size - input_pos,
+                                         output_buffer + output_pos, output_size - output_pos, &consumed);
+      if (outputted < 0 || (outputted == 0 && consumed == 0))
+        break;
+
+      input_pos += consumed;
+      output_pos += (size_t)outputted;
+    }
+
+    if (state.state != QOIS_STATE_DONE || output_pos != output_size ||
+        state.desc.width != job->info.desc.width || state.desc.height != qois_seg_rows(&job->info, segment))
+    {
+      fprintf(stderr, "Failed to decode segment %u\n", segment);
+      parallel_job_fail(job);
+      break;
+    }
+
+    collect_dec_stats(&state);
+
+    if (!write_at(job->output, output_buffer, output_size, job->table[segment].pixel_offset * job->channels))
+    {
+      fprintf(stderr, "Failed to write segment %u\n", segment);
+      parallel_job_fail(job);
+      break;
+    }
+  }
+
+  free(input_buffer);
+  free(output_buffer);
+  return NULL;
+}
+
+static void *decode_checkpoint_worker(void *arg)
+{
+  parallel_job *job = arg;
+
+  uint8_t *input_buffer = NULL;
+  uint8_t *output_buffer = NULL;
+  size_t input_buffer_size = 0;
+  size_t output_buffer_size = 0;
+
+  const uint64_t pixel_count = (uint64_t)job->desc.width * job->desc.height;
+
+  uint32_t part;
+  while (parallel_job_next(job, &part))
+  {
+    const qois_checkpoint *checkpoint = &job->checkpoints[part];
+    bool last = part + 1 == job->part_count;
+
+    // Every part ends where the next checkpoint starts, the last one includes the footer
+    uint64_t input_end = last ? job->input_size : job->checkpoints[part + 1].input_offset;
+    uint64_t pixel_end = last ? pixel_count : job->checkpoints[part + 1].pixel_offset;
+
+    size_t input_size = (size_t)(input_end - checkpoint->input_offset);
+    size_t output_size = (size_t)(pixel_end - checkpoint->pixel_offset) * job->channels;
+
+    if (input_size > input_buffer_size)
+    {
+      free(input_buffer);
+      input_buffer_size = input_size;
+      input_buffer = cli_malloc(input_buffer_size);
+    }
+    if (output_size > output_buffer_size)
+    {
+      free(output_buffer);
+      output_buffer_size = output_size;
+      output_buffer = cli_malloc(output_buffer_size);
+    }
+
+    if (!read_at(job->input, input_buffer, input_size, checkpoint->input_offset))
+    {
+      fprintf(stderr, "Failed to read part %u\n", part);
+      parallel_job_fail(job);
+      break;
+    }
+
+    qois_dec_state state;
+    qois_dec_state_restore(&state, &job->desc, checkpoint, job->channels);
+
+    size_t input_pos = 0;
+    size_t output_pos = 0;
+    while (input_pos < input_size && state.state != QOIS_STATE_DONE)
+    {
+      size_t consumed = 0;
+      int outputted = qois_decode_buffer(&state, input_buffer + input_pos, input_size - input_pos,
+                                         output_buffer + output_pos, output_size - output_pos, &consumed);
+      if (outputted < 0 || (outputted == 0 && consumed == 0))
+        break;
+
+      input_pos += consumed;
+      output_pos += (size_t)outputted;
+    }
+
+    bool complete = last ? state.state == QOIS_STATE_DONE
+                         : state.state == QOIS_OP_NONE && state.pixels_out == pixel_end;
+    if (!complete || output_pos != output_size)
+    {
+      fprintf(stderr, "Failed to decode part %u\n", part);
+      parallel_job_fail(job);
+      break;
+    }
+
+    collect_dec_stats(&state);
+
+    if (!write_at(job->output, output_buffer, output_size, checkpoint->pixel_offset * job->channels))
+    {
+      fprintf(stderr, "Failed to write part %u\n", part);
+      parallel_job_fail(job);
+      break;
+    }
+  }
+
+  free(input_buffer);
+  free(output_buffer);
+  return NULL;
+}
+
+static void *encode_segment_worker(void *arg)
+{
+  parallel_job *job = arg;
+  const size_t channels = job->info.desc.channels;
+
+  uint32_t segment;
+  while (parallel_job_next(job, &segment))
+  {
+    size_t pixel_count = (size_t)qois_seg_rows(&job->info, segment) * job->info.desc.width;
+    uint8_t *pixels = cli_malloc(pixel_count * channels + 1);
+
+    if (!read_at(job->input, pixels, pixel_count * channels, qois_seg_pixel_offset(&job->info, segment) * channels))
+    {
+      fprintf(stderr, "Failed to read segment %u\n", segment);
+      free(pixels);
+      parallel_job_fail(job);
+      break;
+    }
+
+    qois_enc_state state;
+    qois_enc_state_init(&state, job->info.desc.width, qois_seg_rows(&job->info, segment),
+                        job->info.desc.channels, job->info.desc.colorspace);
+
+    size_t output_size = qois_encode_pixels_bound(&state, pixel_count);
+    uint8_t *output = cli_malloc(output_size);
+
+    int outputted = qois_encode_pixels(&state, pixels, pixel_count, output, output_size);
+    free(pixels);
+
+    if (outputted < 0 || state.state != QOIS_STATE_DONE)
+    {
+      fprintf(stderr, "Failed to encode segment %u\n", segment);
+      free(output);
+      parallel_job_fail(job);
+      break;
+    }
+
+    collect_enc_stats(&state);
+
+    pthread_mutex_lock(&job->lock);
+    job->results[segment] = output;
+    job->result_sizes[segment] = (size_t)outputted;
+    pthread_cond_broadcast(&job->changed);
+    pthread_mutex_unlock(&job->lock);
+  }
+
+  return NULL;
+}
+
+static void parallel_job_init(parallel_job *job, FILE *input, FILE *output)
+{
+  memset(job, 0, sizeof(*job));
+  job->input = input;
+  job->output = output;
+  pthread_mutex_init(&job->lock, NULL);
+  pthread_cond_init(&job->changed, NULL);
+}
+
+static unsigned start_workers(pthread_t *workers, unsigned threads, void *(*worker)(void *), parallel_job *job)
+{
+  unsigned started = 0;
+  for (; started < threads; started++)
+    if (pthread_create(&workers[started], NULL, worker, job) != 0)
+      break;
+  return started;
+}
+
+// Runs the worker on the given amount of threads, or on the current thread if none can be started
+static void run_workers(unsigned threads, void *(*worker)(void *), parallel_job *job)
+{
+  pthread_t *workers = cli_malloc(threads * sizeof(pthread_t));
+  unsigned started = start_workers(workers, threads, worker, job);
+  if (started == 0)
+    worker(job);
+  for (unsigned i = 0; i < started; i++)
+    pthread_join(workers[i], NULL);
+  free(workers);
+}
+
+static int decode_segments_parallel(FILE *input, FILE *output, uint8_t channels, unsigned threads, qois_desc *desc)
+{
+  parallel_job job;
+  parallel_job_init(&job, input, output);
+  job.input_size = file_size(input);
+
+  uint8_t header[sizeof(qois_seg_header)];
+  if (!read_at(input, header, sizeof(header), 0) || !qois_seg_read_header(header, sizeof(header), &job.info))
+  {
+    fprintf(stderr, "Invalid segmented image header\n");
+    return 1;
+  }
+
+  job.channels = channels != 0 ? channels : job.info.desc.channels;
+  job.part_count = job.info.segment_count;
+
+  size_t table_size = qois_seg_table_size(&job.info);
+  uint8_t *table_data = cli_malloc(table_size + 1);
+  job.table = cli_malloc(job.info.segment_count * sizeof(qois_seg_entry) + 1);
+
+  int status = 0;
+  if (job.input_size < table_size ||
+      !read_at(input, table_data, table_size, job.input_size - table_size) ||
+      !qois_seg_read_table(&job.info, table_data, table_size, job.input_size, job.table))
+  {
+    fprintf(stderr, "Invalid segment table\n");
+    status = 1;
+    goto cleanup;
+  }
+
+  uint64_t output_size = (uint64_t)job.info.desc.width * job.info.desc.height * job.channels;
+  if (ftruncate(fileno(output), (off_t)output_size) != 0)
+  {
+    fprintf(stderr, "Failed to resize output file\n");
+    status = 1;
+    goto cleanup;
+  }
+
+  run_workers(threads, decode_segment_worker, &job);
+  if (job.failed)
+    status = 1;
+
+  *desc = job.info.desc;
+  desc->channels = job.channels;
+
+cleanup:
+  free(table_data);
+  free(job.table);
+  return status;
+}
+
+// Reads and validates the checkpoints of an index file, returns NULL on error
+static qois_checkpoint *load_index(const char *index_path, const qois_desc *desc, uint64_t input_size,
+                                   uint32_t *checkpoint_count)
+{
+  FILE *index = fopen(index_path, "rb");
+  if (!index)
+  {
+    fprintf(stderr, "Failed to open index file '%s'\n", index_path);
+    return NULL;
+  }
+
+  uint64_t index_size = file_size(index);
+  uint8_t *index_data = cli_malloc(index_size + 1);
+  qois_checkpoint *checkpoints = NULL;
+
+  uint32_t interval;
+  if (!read_at(index, index_data, index_size, 0) ||
+      !qois_index_read_header(index_data, index_size, desc, input_size, &interval))
+  {
+    fprintf(stderr, "Index file '%s' does not belong to this image\n", index_path);
+    goto cleanup;
+  }
+
+  uint32_t count = (uint32_t)((index_size - sizeof(qois_index_header)) / sizeof(qois_checkpoint_data));
+  if (count == 0)
+  {
+    fprintf(stderr, "Index file '%s' has no checkpoints\n", index_path);
+    goto cleanup;
+  }
+
+  checkpoints = cli_malloc(count * sizeof(qois_checkpoint));
+
+  // Checkpoints have to move forward through the file, starting right after the header
+  for (uint32_t i = 0; i < count; i++)
+  {
+    qois_checkpoint_read(index_data + sizeof(qois_index_header) + i * sizeof(qois_checkpoint_data), &checkpoints[i]);
+
+    bool valid = i == 0 ? checkpoints[i].input_offset == sizeof(qois_header) && checkpoints[i].pixel_offset == 0
+                        : checkpoints[i].input_offset > checkpoints[i - 1].input_offset &&
+                              checkpoints[i].pixel_offset > checkpoints[i - 1].pixel_offset;
+    if (!valid || checkpoints[i].input_offset >= input_size ||
+        checkpoints[i].pixel_offset >= (uint64_t)desc->width * desc->height)
+    {
+      fprintf(stderr, "Index file '%s' is corrupt\n", index_path);
+      free(checkpoints);
+      checkpoints = NULL;
+      goto cleanup;
+    }
+  }
+
+  *checkpoint_count = count;
+
+cleanup:
+  fclose(index);
+  free(index_data);
+  return checkpoints;
+}
+
+static bool read_qoi_desc(FILE *input, qois_desc *desc)
+{
+  uint8_t header[sizeof(qois_header)];
+  if (!read_at(input, header, sizeof(header), 0) || !qois_get_desc(header, sizeof(header), desc))
+  {
+    fprintf(stderr, "Invalid image header\n");
+    return false;
+  }
+
+  return true;
+}
+
+static int decode_indexed_parallel(FILE *input, FILE *output, const char *index_path, uint8_t channels,
+                                   unsigned threads, qois_desc *desc)
+{
+  parallel_job job;
+  parallel_job_init(&job, input, output);
+  job.input_size = file_size(input);
+
+  if (!read_qoi_desc(input, &job.desc))
+    return 1;
+
+  job.channels = channels != 0 ? channels : job.desc.channels;
+
+  // Images without pixels have no checkpoints, there is nothing to split up
+  if ((uint64_t)job.desc.width * job.desc.height == 0)
+    return decode_stream(input, output, channels, desc);
+
+  job.checkpoints = load_index(index_path, &job.desc, job.input_size, &job.part_count);
+  if (!job.checkpoints)
+    return 1;
+
+  int status = 0;
+  uint64_t output_size = (uint64_t)job.desc.width * job.desc.height * job.channels;
+  if (ftruncate(fileno(output), (off_t)output_size) != 0)
+  {
+    fprintf(stderr, "Failed to resize output file\n");
+    status = 1;
+    goto cleanup;
+  }
+
+  run_workers(threads, decode_checkpoint_worker, &job);
+  if (job.failed)
+    status = 1;
+
+  *desc = job.desc;
+  desc->channels = job.channels;
+
+cleanup:
+  free(job.checkpoints);
+  return status;
+}
+
+// Decodes a band of rows, using the index to skip ahead when one is given
+static int decode_rows_file(FILE *input, FILE *output, const char *index_path, uint32_t y0, uint32_t y1,
+                            uint8_t channels, qois_desc *desc)
+{
+  if (!read_qoi_desc(input, desc))
+    return 1;
+
+  if (y1 > desc->height)
+    y1 = desc->height;
+  if (y0 > y1)
+  {
+    fprintf(stderr, "Rows %u to %u are outside the image\n", y0, y1);
+    return 1;
+  }
+
+  uint64_t input_size = file_size(input);
+
+  qois_checkpoint *checkpoints = NULL;
+  uint32_t checkpoint_count = 0;
+  if (index_path && (uint64_t)desc->width * desc->height > 0)
+  {
+    checkpoints = load_index(index_path, desc, input_size, &checkpoint_count);
+    if (!checkpoints)
+      return 1;
+  }
+
+  if (channels == 0)
+    channels = desc->channels;
+
+  int status = 0;
+  size_t output_size = (size_t)(y1 - y0) * desc->width * channels;
+  uint8_t *input_data = cli_malloc(input_size + 1);
+  uint8_t *output_data = cli_malloc(output_size + 1);
+
+  if (!read_at(input, input_data, input_size, 0))
+  {
+    fprintf(stderr, "Failed to read input file\n");
+    status = 1;
+    goto cleanup;
+  }
+
+  if (qois_decode_rows(input_data, input_size, checkpoints, checkpoint_count, y0, y1, channels,
+                       output_data, output_size) < 0)
+  {
+    fprintf(stderr, "Failed to decode rows %u to %u\n", y0, y1);
+    status = 1;
+    goto cleanup;
+  }
+
+  if (fwrite(output_data, 1, output_size, output) != output_size)
+  {
+    fprintf(stderr, "Failed to write output file\n");
+    status = 1;
+    goto cleanup;
+  }
+
+  desc->height = y1 - y0;
+  desc->channels = channels;
+
+cleanup:
+  free(input_data);
+  free(output_data);
+  free(checkpoints);
+  return status;
+}
+
+static int build_index(FILE *input, FILE *output, uint32_t interval)
+{
+  uint8_t *input_buffer = cli_malloc(BUFFER_SIZE);
+  uint8_t *output_buffer = cli_malloc(BUFFER_SIZE);
+  int status = 0;
+
+  qois_index_state state;
+  qois_index_state_init(&state, interval);
+
+  // The header needs the image description, it is written once the whole image is indexed
+  uint8_t header[sizeof(qois_index_header)] = {0};
+  fwrite(header, 1, sizeof(header), output);
+
+  while (state.dec.state != QOIS_STATE_DONE)
+  {
+    size_t read = fread(input_buffer, 1, BUFFER_SIZE, input);
+    if (read == 0)
+      break;
+
+    size_t input_pos = 0;
+    while (input_pos < read && state.dec.state != QOIS_STATE_DONE)
+    {
+      size_t consumed = 0;
+      int outputted = qois_index_buffer(&state, input_buffer + input_pos, read - input_pos,
+                                        output_buffer, BUFFER_SIZE, &consumed);
+      if (outputted < 0)
+      {
+        fprintf(stderr, "Failed to index byte: %d\n", input_buffer[input_pos + consumed]);
+        status = 1;
+        goto cleanup;
+      }
+
+      input_pos += consumed;
+      fwrite(output_buffer, 1, (size_t)outputted, output);
+    }
+  }
+
+  if (state.dec.state != QOIS_STATE_DONE)
+  {
+    fprintf(stderr, "Image ended before indexing was complete\n");
+    status = 1;
+    goto cleanup;
+  }
+
+  collect_dec_stats(&state.dec);
+
+  qois_index_write_header(&state.dec.desc, state.interval, state.input_offset, header, sizeof(header));
+  if (fseek(output, 0, SEEK_SET) != 0 || fwrite(header, 1, sizeof(header), output) != sizeof(header))
+  {
+    fprintf(stderr, "Failed to write index header\n");
+    status = 1;
+  }
+
+cleanup:
+  free(input_buffer);
+  free(output_buffer);
+  return status;
+}
+
+static int encode_segments_parallel(FILE *input, FILE *output, const qois_desc *desc, uint32_t segment_rows,
+                                    unsigned threads)
+{
+  parallel_job job;
+  parallel_job_init(&job, input, output);
+  qois_seg_info_init(&job.info, desc->width, desc->height, desc->channels, desc->colorspace, segment_rows);
+  job.part_count = job.info.segment_count;
+
+  uint64_t needed = (uint64_t)desc->width * desc->height * desc->channels;
+  if (file_size(input) < needed)
+  {
+    fprintf(stderr, "Data ended before encoding was complete\n");
+    return 1;
+  }
+
+  job.table = cli_malloc(job.info.segment_count * sizeof(qois_seg_entry) + 1);
+  job.results = cli_calloc(job.info.segment_count + 1, sizeof(uint8_t *));
+  job.result_sizes = cli_calloc(job.info.segment_count + 1, sizeof(size_t));
+  job.window = threads * 2;
+
+  pthread_t *workers = cli_malloc(threads * sizeof(pthread_t));
+  unsigned started = start_workers(workers, threads, encode_segment_worker, &job);
+  if (started == 0)
+  {
+    // Without workers everything has to fit in memory at once
+    job.window = job.info.segment_count;
+    encode_segment_worker(&job);
+  }
+
+  // Write the segments in order while the workers encode the next ones
+  uint8_t buffer[sizeof(qois_seg_header)];
+  int header_size = qois_seg_write_header(&job.info, buffer, sizeof(buffer));
+  fwrite(buffer, 1, (size_t)header_size, output);
+
+  uint64_t offset = (uint64_t)header_size;
+  for (uint32_t segment = 0; segment < job.info.segment_count; segment++)
+  {
+    pthread_mutex_lock(&job.lock);
+    while (!job.failed && job.results[segment] == NULL)
+      pthread_cond_wait(&job.changed, &job.lock);
+    bool failed = job.failed;
+    pthread_mutex_unlock(&job.lock);
+
+    if (failed)
+      break;
+
+    job.table[segment].byte_offset = offset;
+    job.table[segment].pixel_offset = qois_seg_pixel_offset(&job.info, segment);
+
+    fwrite(job.results[segment], 1, job.result_sizes[segment], output);
+    offset += job.result_sizes[segment];
+
+    pthread_mutex_lock(&job.lock);
+    free(job.results[segment]);
+    job.results[segment] = NULL;
+    job.written++;
+    pthread_cond_broadcast(&job.changed);
+    pthread_mutex_unlock(&job.lock);
+  }
+
+  for (unsigned i = 0; i < started; i++)
+    pthread_join(workers[i], NULL);
+  free(workers);
+
+  int status = 0;
+  if (job.failed)
+    status = 1;
+  else
+  {
+    size_t table_size = qois_seg_table_size(&job.info);
+    uint8_t *table_data = cli_malloc(table_size + 1);
+    qois_seg_write_table(&job.info, job.table, table_data, table_size);
+    fwrite(table_data, 1, table_size, output);
+    free(table_data);
+  }
+
+  for (uint32_t segment = 0; segment < job.info.segment_count; segment++)
+    free(job.results[segment]);
+  free(job.results);
+  free(job.result_sizes);
+  free(job.table);
+  return status;
+}
+
+// Batch conversion, files are spread over a pool of workers that steal work from each other
+
+typedef struct _batch_file
+{
+  char *input;
+  char *output;
+  // Encode when set, decode otherwise
+  bool encode;
+  qois_desc desc;
+  uint8_t channels;
+} batch_file;
+
+// The files left for a worker, packed as begin << 32 | end so it can be updated in a single compare and swap.
+// The owner takes files from the front, thieves take half of the remaining files from the back.
+typedef struct _batch_queue
+{
+  uint64_t range;
+} batch_queue;
+
+typedef struct _batch_job
+{
+  batch_file *files;
+  uint32_t file_count;
+  uint32_t segment_rows;
+
+  batch_queue *queues;
+  unsigned worker_count;
+} batch_job;
+
+typedef struct _batch_worker
+{
+  batch_job *job;
+  unsigned id;
+
+  uint32_t converted;
+  uint64_t bytes_in;
+  uint64_t bytes_out;
+} batch_worker;
+
+static uint64_t batch_range(uint32_t begin, uint32_t end)
+{
+  return (uint64_t)begin << 32 | end;
+}
+
+static bool batch_pop(batch_queue *queue, uint32_t *file)
+{
+  uint64_t range = __atomic_load_n(&queue->range, __ATOMIC_ACQUIRE);
+  while (true)
+  {
+    uint32_t begin = (uint32_t)(range >> 32);
+    uint32_t end = (uint32_t)range;
+    if (begin >= end)
+      return false;
+
+    if (__atomic_compare_exchange_n(&queue->range, &range, batch_range(begin + 1, end), false,
+                                    __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+    {
+      *file = begin;
+      return true;
+    }
+  }
+}
+
+// Moves half of the files left in the victim to the empty queue of the thief
+static bool batch_steal(batch_queue *victim, batch_queue *thief)
+{
+  uint64_t range = __atomic_load_n(&victim->range, __ATOMIC_ACQUIRE);
+  while (true)
+  {
+    uint32_t begin = (uint32_t)(range >> 32);
+    uint32_t end = (uint32_t)range;
+    if (begin >= end)
+      return false;
+
+    uint32_t middle = end - (end - begin + 1) / 2;
+    if (__atomic_compare_exchange_n(&victim->range, &range, batch_range(begin, middle), false,
+                                    __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+    {
+      __atomic_store_n(&thief->range, batch_range(middle, end), __ATOMIC_RELEASE);
+      return true;
+    }
+  }
+}
+
+static bool batch_next(batch_job *job, unsigned id, uint32_t *file)
+{
+  if (batch_pop(&job->queues[id], file))
+    return true;
+
+  for (unsigned i = 1; i < job->worker_count; i++)
+  {
+    if (batch_steal(&job->queues[(id + i) % job->worker_count], &job->queues[id]) &&
+        batch_pop(&job->queues[id], file))
+      return true;
+  }
+
+  return false;
+}
+
+// Converts a single file. A file that fails, also by ending early, leaves no output behind.
+static int batch_convert(const batch_file *file, uint32_t segment_rows, uint8_t *input_buffer,
+                         uint8_t *output_buffer, uint64_t *bytes_in, uint64_t *bytes_out)
+{
+  cli_file.path = file->input;
+  cli_file.incomplete = false;
+
+  FILE *input = fopen(file->input, "rb");
+  if (!input)
+  {
+    cli_message("Failed to open input file\n");
+    cli_file.path = NULL;
+    return 1;
+  }
+
+  FILE *output = fopen(file->output, "wb");
+  if (!output)
+  {
+    cli_message("Failed to open output file '%s'\n", file->output);
+    fclose(input);
+    cli_file.path = NULL;
+    return 1;
+  }
+
+  int status;
+  if (file->encode)
+    status = encode_stream_buffers(input, output, &file->desc, segment_rows, input_buffer, 0, output_buffer);
+  else
+  {
+    qois_desc desc;
+    status = decode_stream_buffers(input, output, file->channels, &desc, input_buffer, output_buffer);
+  }
+
+  if (ferror(output) || cli_file.incomplete)
+    status = 1;
+
+  *bytes_in = (uint64_t)ftell(input);
+  *bytes_out = (uint64_t)ftell(output);
+
+  fclose(input);
+  if (fclose(output) != 0)
+    status = 1;
+
+  if (status != 0)
+  {
+    cli_message("Conversion failed\n");
+    remove(file->output);
+  }
+
+  cli_file.path = NULL;
+  return status;
+}
+
+static void *batch_worker_run(void *arg)
+{
+  batch_worker *worker = arg;
+
+  // Every worker reuses its buffers for all of its files
+  uint8_t *input_buffer = cli_malloc(BUFFER_SIZE);
+  uint8_t *output_buffer = cli_malloc(BUFFER_SIZE);
+
+  uint32_t index;
+  while (batch_next(worker->job, worker->id, &index))
+  {
+    uint64_t bytes_in = 0;
+    uint64_t bytes_out = 0;
+    if (batch_convert(&worker->job->files[index], worker->job->segment_rows, input_buffer, output_buffer,
+                      &bytes_in, &bytes_out) == 0)
+    {
+      worker->converted++;
+      worker->bytes_in += bytes_in;
+      worker->bytes_out += bytes_out;
+    }
+  }
+
+  free(input_buffer);
+  free(output_buffer);
+  return NULL;
+}
+
+static char *copy_string(const char *str)
+{
+  size_t length = strlen(str) + 1;
+  char *copy = cli_malloc(length);
+  memcpy(copy, str, length);
+  return copy;
+}
+
+static bool batch_add(batch_file **files, uint32_t *count, uint32_t *capacity, const batch_file *file)
+{
+  if (*count == UINT32_MAX)
+    return false;
+
+  if (*count == *capacity)
+  {
+    *capacity = *capacity ? *capacity * 2 : 64;
+    *files = cli_realloc(*files, *capacity * sizeof(batch_file));
+  }
+
+  (*files)[(*count)++] = *file;
+  return true;
+}
+
+// Every line of the manifest takes the same arguments as a single conversion:
+// <input.qoi> <output> [channels] or <input> <output.qoi> <width> <height> <channels> <colorspace>
+static bool batch_read_manifest(const char *path, batch_file **files, uint32_t *count)
+{
+  FILE *manifest = fopen(path, "r");
+  if (!manifest)
+  {
+    fprintf(stderr, "Failed to open manifest '%s'\n", path);
+    return false;
+  }
+
+  uint32_t capacity = 0;
+  bool valid = true;
+  char line[4096];
+  for (unsigned line_number = 1; fgets(line, sizeof(line), manifest); line_number++)
+  {
+    char *args[6];
+    int arg_count = 0;
+    for (char *token = strtok(line, " \t\r\n"); token && arg_count < 6; token = strtok(NULL, " \t\r\n"))
+      args[arg_count++] = token;
+
+    if (arg_count == 0 || args[0][0] == '#')
+      continue;
+
+    batch_file file;
+    file.channels = 0;
+    file.encode = arg_count > 1 && ends_with(args[1], ".qoi");
+    _qois_desc_init(&file.desc);
+
+    // Exactly one of the files has to end in .qoi, like a single conversion
+    if (arg_count < 2 || file.encode == ends_with(args[0], ".qoi") || (file.encode && arg_count < 6))
+    {
+      fprintf(stderr, "%s:%u: invalid line\n", path, line_number);
+      valid = false;
+      continue;
+    }
+
+    if (file.encode)
+    {
+      file.desc.width = (uint32_t)atoi(args[2]);
+      file.desc.height = (uint32_t)atoi(args[3]);
+      file.desc.channels = (uint8_t)atoi(args[4]);
+      file.desc.colorspace = (uint8_t)atoi(args[5]);
+      if (file.desc.channels != 3 && file.desc.channels != 4)
+      {
+        fprintf(stderr, "%s:%u: channels must be 3 or 4\n", path, line_number);
+        valid = false;
+        continue;
+      }
+    }
+    else if (arg_count > 2)
+    {
+      file.channels = (uint8_t)atoi(args[2]);
+      if (file.channels != 3 && file.channels != 4)
+      {
+        fprintf(stderr, "%s:%u: channels override must be 3 or 4\n", path, line_number);
+        valid = false;
+        continue;
+      }
+    }
+
+    file.input = copy_string(args[0]);
+    file.output = copy_string(args[1]);
+    if (!batch_add(files, count, &capacity, &file))
+      break;
+  }
+
+  fclose(manifest);
+  return valid;
+}
+
+// Every QOI image in the directory is decoded to a .raw file in the output directory
+static bool batch_read_directory(const char *path, const char *output_path, batch_file **files, uint32_t *count)
+{
+  DIR *directory = opendir(path);
+  if (!directory)
+  {
+    fprintf(stderr, "Failed to open directory '%s'\n", path);
+    return false;
+  }
+
+  uint32_t capacity = 0;
+  struct dirent *entry;
+  while ((entry = readdir(directory)))
+  {
+    size_t name_length = strlen(entry->d_name);
+    if (!ends_with(entry->d_name, ".qoi") || name_length == 4)
+      continue;
+
+    batch_file file;
+    file.encode = false;
+    file.channels = 0;
+    _qois_desc_init(&file.desc);
+
+    file.input = cli_malloc(strlen(path) + name_length + 2);
+    sprintf(file.input, "%s/%s", path, entry->d_name);
+
+    file.output = cli_malloc(strlen(output_path) + name_length + 2);
+    sprintf(file.output, "%s/%.*s.raw", output_path, (int)(name_length - 4), entry->d_name);
+
+    if (!batch_add(files, count, &capacity, &file))
+      break;
+  }
+
+  closedir(directory);
+  return true;
+}
+
+static int run_batch(const char *source, const char *output_path, const cli_options *options)
+{
+  batch_job job;
+  job.files = NULL;
+  job.file_count = 0;
+  job.segment_rows = options->segment_rows;
+
+  struct stat info;
+  bool is_directory = stat(source, &info) == 0 && S_ISDIR(info.st_mode);
+  if (is_directory && !output_path)
+  {
+    fprintf(stderr, "Converting a directory needs an output directory\n");
+    return 1;
+  }
+
+  bool valid = is_directory ? batch_read_directory(source, output_path, &job.files, &job.file_count)
+                            : batch_read_manifest(source, &job.files, &job.file_count);
+
+  // Spread the files evenly over the workers, stealing takes care of the imbalance
+  job.worker_count = options->threads;
+  if (job.worker_count > job.file_count)
+    job.worker_count = job.file_count > 0 ? job.file_count : 1;
+
+  job.queues = cli_malloc(job.worker_count * sizeof(batch_queue));
+  batch_worker *workers = cli_malloc(job.worker_count * sizeof(batch_worker));
+  pthread_t *threads = cli_malloc(job.worker_count * sizeof(pthread_t));
+  bool *started = cli_malloc(job.worker_count * sizeof(bool));
+
+  for (unsigned i = 0; i < job.worker_count; i++)
+  {
+    uint32_t begin = (uint32_t)((uint64_t)job.file_count * i / job.worker_count);
+    uint32_t end = (uint32_t)((uint64_t)job.file_count * (i + 1) / job.worker_count);
+    job.queues[i].range = batch_range(begin, end);
+
+    workers[i].job = &job;
+    workers[i].id = i;
+    workers[i].converted = 0;
+    workers[i].bytes_in = 0;
+    workers[i].bytes_out = 0;
+  }
+
+  struct timespec start, end;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+
+  // The current thread is the first worker
+  for (unsigned i = 1; i < job.worker_count; i++)
+    started[i] = pthread_create(&threads[i], NULL, batch_worker_run, &workers[i]) == 0;
+  batch_worker_run(&workers[0]);
+  for (unsigned i = 1; i < job.worker_count; i++)
+    if (started[i])
+      pthread_join(threads[i], NULL);
+
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  double seconds = (double)(end.tv_sec - start.tv_sec) + (double)(end.tv_nsec - start.tv_nsec) / 1e9;
+
+  uint32_t converted = 0;
+  uint64_t bytes_in = 0;
+  uint64_t bytes_out = 0;
+  for (unsigned i = 0; i < job.worker_count; i++)
+  {
+    converted += workers[i].converted;
+    bytes_in += workers[i].bytes_in;
+    bytes_out += workers[i].bytes_out;
+  }
+
+  // Workers that could not be started leave their files to be stolen by the others
+  uint32_t failed = job.file_count - converted;
+
+  if (seconds <= 0)
+    seconds = 1e-9;
+
+  printf("Batch Info:\n");
+  printf("  Converted: %u\n", converted);
+  printf("  Failed: %u\n", failed);
+  printf("  Workers: %u\n", job.worker_count);
+  printf("  Time: %.3f s\n", seconds);
+  printf("  Files/s: %.1f\n", (double)converted / seconds);
+  printf("  Input MB/s: %.1f\n", (double)bytes_in / seconds / 1e6);
+  printf("  Output MB/s: %.1f\n", (double)bytes_out / seconds / 1e6);
+
+  for (uint32_t i = 0; i < job.file_count; i++)
+  {
+    free(job.files[i].input);
+    free(job.files[i].output);
+  }
+  free(job.files);
+  free(job.queues);
+  free(workers);
+  free(threads);
+  free(started);
+
+  return valid && failed == 0 ? 0 : 1;
+}
+
+// What main knows about the files of a conversion before the output is opened
+typedef struct _cli_files
+{
+  // The encode and decode subcommands, which read stdin and write stdout
+  bool piped;
+  bool decode;
+  // A .qoiv frame sequence on either side, or a PPM or PAM image to encode
+  bool sequence;
+  bool netpbm_input;
+  bool input_regular;
+  // Output files that do not exist yet count as regular
+  bool output_regular;
+  bool output_pipe;
+  // Read from the magic of a regular input file
+  bool segmented;
+  bool compressed;
+} cli_files;
+
+// Returns why the options can not be used for these files, or NULL when every option takes effect
+static const char *check_options(const cli_options *options, const cli_files *files)
+{
+  bool random_access = files->input_regular && files->output_regular;
+  int transports = options->mmap + options->pipeline + options->splice + (options->index_path != NULL);
+
+  if (files->sequence)
+  {
+    if (options->segment_rows > 0 || options->index_path || options->rows || options->mmap || options->splice ||
+        options->pipeline || options->format || options->pitch > 0 || options->lz_window_bits > 0 ||
+        options->netpbm != QOIS_PNM_NONE || options->scale_x > 0)
+      return "Sequences can only be converted with --key-interval, --threads and --stats";
+    if (files->decode && options->key_interval > 0)
+      return "--key-interval only applies when encoding a sequence";
+    return NULL;
+  }
+
+  if (options->key_interval > 0)
+    return "--key-interval only applies when encoding a sequence";
+  if (options->pitch > 0 && !options->format)
+    return "--pitch only applies together with --format";
+
+  if (!files->decode)
+  {
+    if (options->index_path || options->rows || options->scale_x > 0 || options->netpbm != QOIS_PNM_NONE ||
+        options->splice)
+      return "--index, --rows, --scale, --netpbm and --splice only apply when decoding";
+    if (files->netpbm_input && (options->format || options->lz_window_bits > 0))
+      return "Netpbm images can only be encoded from their own pixels, without --format or --lz";
+    if (files->netpbm_input && (options->mmap || options->pipeline))
+      return "Netpbm images are encoded front to back, without --mmap or --pipeline";
+    if (options->format && options->segment_rows > 0)
+      return "Formats can only be encoded to a plain QOI file";
+    if (options->lz_window_bits > 0 && (options->format || options->segment_rows > 0))
+      return "The LZ stage can only follow a plain encode of raw pixels";
+    if ((options->lz_window_bits > 0 || options->format) && (options->mmap || options->pipeline))
+      return "--lz and --format encode front to back, without --mmap or --pipeline";
+    if (options->mmap && options->pipeline)
+      return "Only one of --mmap and --pipeline can be used";
+    if (options->mmap && (!random_access || files->piped))
+      return "--mmap needs a regular input and output file, not the encode subcommand";
+    if (options->segment_rows > 0 && options->threads > 1 && files->input_regular &&
+        (options->mmap || options->pipeline))
+      return "Segmented containers are encoded in parallel, use --threads 1 for --mmap or --pipeline";
+    return NULL;
+  }
+
+  if (options->segment_rows > 0 || options->lz_window_bits > 0)
+    return "--segment-rows and --lz only apply when encoding";
+  if (options->scale_x > 0 && (options->rows || options->format))
+    return "Images can only be downscaled from a plain QOI file, without --rows or --format";
+  if (options->netpbm != QOIS_PNM_NONE && (options->rows || options->format))
+    return "Netpbm images are decoded in full, without --rows or --format";
+  if (options->rows && options->format)
+    return "Only one of --rows and --format can be used";
+
+  if (files->compressed && (options->scale_x > 0 || options->netpbm != QOIS_PNM_NONE || options->rows ||
+                            options->format || transports > 0))
+    return "LZ input can only be decoded front to back into raw pixels";
+  if (files->segmented && (options->index_path || options->rows || options->scale_x > 0 ||
+                            options->netpbm != QOIS_PNM_NONE || options->format))
+    return "--index, --rows, --scale, --netpbm and --format only apply to a plain QOI file";
+
+  // Downscaled, netpbm and format decodes stream the image from front to back
+  if ((options->scale_x > 0 || options->netpbm != QOIS_PNM_NONE || options->format) && transports > 0)
+    return "--scale, --netpbm and --format decode front to back, without --index, --mmap, --pipeline or --splice";
+  if (options->rows && (options->mmap || options->pipeline || options->splice))
+    return "--rows can only be combined with --index";
+  if (options->rows && !files->input_regular)
+    return "Rows can only be decoded from a plain QOI file";
+
+  if (transports > 1)
+    return "Only one of --index, --mmap, --pipeline and --splice can be used";
+  if (options->index_path && !options->rows && !random_access)
+    return "--index needs a regular input and output file";
+  if (options->mmap && (!random_access || files->piped))
+    return "--mmap needs a regular input and output file, not the decode subcommand";
+  if (options->splice && !files->output_pipe)
+    return "--splice needs the output to be a pipe";
+  if (files->segmented && random_access && options->threads > 1 && transports > 0)
+    return "Segmented containers are decoded in parallel, use --threads 1 for --mmap, --pipeline or --splice";
+  return NULL;
+}
+
+static void print_usage(const char *name)
+{
+  fprintf(stderr, "Usage:\n");
+  fprintf(stderr, "  %s [options] <input.qoi> <output> [channels = 3,4]\n", name);
+  fprintf(stderr, "  %s [options] <input> <output.qoi> <width> <height> <channels = 3,4> <colorspace = 0,1>\n", name);
+  fprintf(stderr, "  %s [options] <input.qoiv> <output>\n", name);
+  fprintf(stderr, "  %s [options] <input> <output.qoiv> <width> <height> <channels = 3,4> <colorspace = 0,1>\n", name);
+  fprintf(stderr, "  %s [options] <input.ppm | input.pam> <output.qoi>\n", name);
+  fprintf(stderr, "  %s [options] <input.qoi> <output.ppm | output.pam> [channels = 3,4]\n", name);
+  fprintf(stderr, "  %s [options] --scale <x>x<y> <input.qoi> <output.qoi>\n", name);
+  fprintf(stderr, "  %s [options] decode [channels = 3,4] < input.qoi > output\n", name);
+  fprintf(stderr, "  %s [options] encode <width> <height> <channels = 3,4> <colorspace = 0,1> < input > output.qoi\n", name);
+  fprintf(stderr, "  %s [options] encode < input.ppm | input.pam > output.qoi\n", name);
+  fprintf(stderr, "  %s index <input.qoi> <output.qoix> [interval = 65536]\n", name);
+  fprintf(stderr, "  %s batch <manifest | directory> [output directory]\n", name);
+  fprintf(stderr, "Options:\n");
+  fprintf(stderr, "  --buffer-size <bytes>  Size of the pipeline buffers (default: 1MB)\n");
+  fprintf(stderr, "  --format <format>      Decode into rgb, rgba, bgra, bgrx, rgb565 or a8 pixels, or encode from rgb to bgrx\n");
+  fprintf(stderr, "  --index <file.qoix>    Decode a plain QOI image in parallel using a checkpoint index\n");
+  fprintf(stderr, "  --key-interval <count> Frames between key frames of a .qoiv sequence (default: 0, only the first)\n");
+  fprintf(stderr, "  --lz <window bits>     Pass the encoded image through an LZ stage with a window of 8 to 16 bits\n");
+  fprintf(stderr, "  --mmap                 Map the files into memory instead of copying them through buffers\n");
+  fprintf(stderr, "  --netpbm <ppm | pam>   Decode into a PPM or PAM image, the extension of an output file does the same\n");
+  fprintf(stderr, "  --pipeline             Read, convert and write on separate threads\n");
+  fprintf(stderr, "  --pitch <bytes>        Bytes per row of the --format pixels, decoded rows are padded with zeros\n");
+  fprintf(stderr, "  --ring-depth <count>   Buffers in flight between the pipeline threads (default: 4)\n");
+  fprintf(stderr, "  --rows <first>:<last>  Only decode rows first up to last, skipping ahead with --index if given\n");
+  fprintf(stderr, "  --scale <x>x<y>        Decode a downscaled image, averaging every block of x by y pixels\n");
+  fprintf(stderr, "  --segment-rows <rows>  Encode a segmented container that can be processed in parallel\n");
+  fprintf(stderr, "  --splice               Splice decoded pixels into an output pipe, for readers that copy them out\n");
+  fprintf(stderr, "  --stats                Print op statistics, needs a build with QOIS_STATS defined\n");
+  fprintf(stderr, "  --threads <count>      Threads used for segmented containers, indexes and batches (default: all cores)\n");
+}
+
+int main(int argc, char **argv)
+{
+  cli_options options;
+  long cores = sysconf(_SC_NPROCESSORS_ONLN);
+  options.threads = cores > 0 ? (unsigned)cores : 1;
+  options.segment_rows = 0;
+  options.index_path = NULL;
+  options.rows = false;
+  options.first_row = 0;
+  options.last_row = 0;
+  options.mmap = false;
+  options.pipeline = false;
+  options.stats = false;
+  options.ring_depth = 4;
+  options.buffer_size = BUFFER_SIZE;
+  options.format = false;
+  options.pixel_format = QOIS_FORMAT_RGBA;
+  options.pitch = 0;
+  options.key_interval = 0;
+  options.lz_window_bits = 0;
+  options.splice = false;
+  options.netpbm = QOIS_PNM_NONE;
+  options.scale_x = 0;
+  options.scale_y = 0;
+
+  // Split the options from the positional arguments
+  char **args = cli_malloc((size_t)argc * sizeof(char *));
+  int arg_count = 0;
+  for (int i = 1; i < argc; i++)
+  {
+    if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc)
+    {
+      int threads = atoi(argv[++i]);
+      if (threads < 1)
+      {
+        fprintf(stderr, "Threads must be at least 1\n");
+        return 1;
+      }
+      options.threads = (unsigned)threads;
+    }
+    else if (strcmp(argv[i], "--segment-rows") == 0 && i + 1 < argc)
+    {
+      int segment_rows = atoi(argv[++i]);
+      if (segment_rows < 1)
+      {
+        fprintf(stderr, "Segment rows must be at least 1\n");
+        return 1;
+      }
+      options.segment_rows = (uint32_t)segment_rows;
+    }
+    else if (strcmp(argv[i], "--mmap") == 0)
+      options.mmap = true;
+    else if (strcmp(argv[i], "--splice") == 0)
+      options.splice = true;
+    else if (strcmp(argv[i], "--pipeline") == 0)
+      options.pipeline = true;
+    else if (strcmp(argv[i], "--stats") == 0)
+    {
+#ifndef QOIS_STATS
+      fprintf(stderr, "Statistics are not available, build with QOIS_STATS defined\n");
+      return 1;
+#endif
+      options.stats = true;
+    }
+    else if (strcmp(argv[i], "--ring-depth") == 0 && i + 1 < argc)
+    {
+      int ring_depth = atoi(argv[++i]);
+      if (ring_depth < 2)
+      {
+        fprintf(stderr, "Ring depth must be at least 2\n");
+        return 1;
+      }
+      options.ring_depth = (size_t)ring_depth;
+    }
+    else if (strcmp(argv[i], "--buffer-size") == 0 && i + 1 < argc)
+    {
+      long buffer_size = atol(argv[++i]);
+      if (buffer_size < 64)
+      {
+        fprintf(stderr, "Buffer size must be at least 64 bytes\n");
+        return 1;
+      }
+      options.buffer_size = (size_t)buffer_size;
+    }
+    else if (strcmp(argv[i], "--index") == 0 && i + 1 < argc)
+      options.index_path = argv[++i];
+    else if (strcmp(argv[i], "--format") == 0 && i + 1 < argc)
+    {
+      static const char *formats[] = {"rgb", "rgba", "bgra", "bgrx", "rgb565", "a8"};
+      const char *name = argv[++i];
+
+      options.format = false;
+      for (size_t f = 0; f < sizeof(formats) / sizeof(formats[0]); f++)
+      {
+        if (strcmp(name, formats[f]) == 0)
+        {
+          options.format = true;
+          options.pixel_format = (qois_format)f;
+        }
+      }
+
+      if (!options.format)
+      {
+        fprintf(stderr, "Unknown format '%s'\n", name);
+        return 1;
+      }
+    }
+    else if (strcmp(argv[i], "--pitch") == 0 && i + 1 < argc)
+    {
+      long pitch = atol(argv[++i]);
+      if (pitch < 1)
+      {
+        fprintf(stderr, "Pitch must be at least 1 byte\n");
+        return 1;
+      }
+      options.pitch = (size_t)pitch;
+    }
+    else if (strcmp(argv[i], "--key-interval") == 0 && i + 1 < argc)
+    {
+      int key_interval = atoi(argv[++i]);
+      if (key_interval < 0)
+      {
+        fprintf(stderr, "Key interval must be at least 0\n");
+        return 1;
+      }
+      options.key_interval = (uint32_t)key_interval;
+    }
+    else if (strcmp(argv[i], "--lz") == 0 && i + 1 < argc)
+    {
+      int window_bits = atoi(argv[++i]);
+      if (window_bits < QOIS_LZ_MIN_WINDOW_BITS || window_bits > QOIS_LZ_MAX_WINDOW_BITS)
+      {
+        fprintf(stderr, "LZ window bits must be from %d to %d\n", QOIS_LZ_MIN_WINDOW_BITS, QOIS_LZ_MAX_WINDOW_BITS);
+        return 1;
+      }
+      options.lz_window_bits = (uint8_t)window_bits;
+    }
+    else if (strcmp(argv[i], "--netpbm") == 0 && i + 1 < argc)
+    {
+      const char *type = argv[++i];
+      if (strcmp(type, "ppm") == 0)
+        options.netpbm = QOIS_PNM_PPM;
+      else if (strcmp(type, "pam") == 0)
+        options.netpbm = QOIS_PNM_PAM;
+      else
+      {
+        fprintf(stderr, "Netpbm type must be ppm or pam\n");
+        return 1;
+      }
+    }
+    else if (strcmp(argv[i], "--scale") == 0 && i + 1 < argc)
+    {
+      unsigned scale_x, scale_y;
+      int count = sscanf(argv[++i], "%ux%u", &scale_x, &scale_y);
+      if (count == 1)
+        scale_y = scale_x;
+      if (count < 1 || scale_x < 1 || scale_y < 1 || scale_x > QOIS_SCALE_MAX || scale_y > QOIS_SCALE_MAX)
+      {
+        fprintf(stderr, "Scale must be given as <x>x<y> or <n>, from 1 to %d\n", QOIS_SCALE_MAX);
+        return 1;
+      }
+      options.scale_x = scale_x;
+      options.scale_y = scale_y;
+    }
+    else if (strcmp(argv[i], "--rows") == 0 && i + 1 < argc)
+    {
+      unsigned first_row, last_row;
+      if (sscanf(argv[++i], "%u:%u", &first_row, &last_row) != 2 || first_row > last_row)
+      {
+        fprintf(stderr, "Rows must be given as <first>:<last>\n");
+        return 1;
+      }
+      options.rows = true;
+      options.first_row = first_row;
+      options.last_row = last_row;
+    }
+    else if (strncmp(argv[i], "--", 2) == 0)
+    {
+      print_usage(argv[0]);
+      return 1;
+    }
+    else
+      args[arg_count++] = argv[i];
+  }
+
+  if (arg_count < 1 || (arg_count < 2 && strcmp(args[0], "decode") != 0 && strcmp(args[0], "encode") != 0))
+  {
+    print_usage(argv[0]);
+    return 1;
+  }
+
+  // Convert every file in a manifest or directory
+  if (strcmp(args[0], "batch") == 0)
+  {
+    int status = run_batch(args[1], arg_count > 2 ? args[2] : NULL, &options);
+    if (options.stats)
+      print_stats(stdout);
+    free(args);
+    return status;
+  }
+
+  // Build a checkpoint index for a plain QOI image
+  if (strcmp(args[0], "index") == 0)
+  {
+    if (arg_count < 3)
+    {
+      print_usage(argv[0]);
+      return 1;
+    }
+
+    int interval = arg_count > 3 ? atoi(args[3]) : 65536;
+    if (interval < 1)
+    {
+      fprintf(stderr, "Interval must be at least 1\n");
+      return 1;
+    }
+
+    FILE *input = fopen(args[1], "rb");
+    if (!input)
+    {
+      fprintf(stderr, "Failed to open input file '%s'", args[1]);
+      return 1;
+    }
+
+    FILE *output = fopen(args[2], "wb");
+    if (!output)
+    {
+      fprintf(stderr, "Failed to open output file '%s'", args[2]);
+      return 1;
+    }
+
+    int status = build_index(input, output, (uint32_t)interval);
+    if (status == 0 && options.stats)
+      print_stats(stdout);
+    if (status == 0)
+      printf("Done\n");
+
+    free(args);
+    fclose(input);
+    fclose(output);
+    return status;
+  }
+
+  // The encode and decode subcommands read stdin and write stdout, the info goes to stderr instead
+  bool piped = strcmp(args[0], "encode") == 0 || strcmp(args[0], "decode") == 0;
+  FILE *info = piped ? stderr : stdout;
+
+  FILE *input;
+  FILE *output = stdout;
+  cli_files files;
+  bool reencode = false;
+  char **params;
+  int param_count;
+
+  files.piped = piped;
+  if (piped)
+  {
+    input = stdin;
+    files.decode = strcmp(args[0], "decode") == 0;
+    files.sequence = false;
+    params = args + 1;
+    param_count = arg_count - 1;
+  }
+  else
+  {
+    input = fopen(args[0], "rb");
+    if (!input)
+    {
+      fprintf(stderr, "Failed to open input file '%s'", args[0]);
+      return 1;
+    }
+
+    params = args + 2;
+    param_count = arg_count - 2;
+
+    // Frame sequences are told apart by their own extension
+    files.sequence = ends_with(args[0], ".qoiv") || ends_with(args[1], ".qoiv");
+    if (files.sequence)
+    {
+      if (ends_with(args[0], ".qoiv") == ends_with(args[1], ".qoiv"))
+      {
+        fprintf(stderr, "Only one of the input and output files may end in .qoiv\n");
+        return 1;
+      }
+      files.decode = ends_with(args[0], ".qoiv");
+    }
+    else
+    {
+      bool input_ends_with_qoi = ends_with(args[0], ".qoi");
+      bool output_ends_with_qoi = ends_with(args[1], ".qoi");
+
+      // Refuse if both end in .qoi, or if neither end in .qoi. Only downscaled images can be encoded again.
+      reencode = options.scale_x > 0 && input_ends_with_qoi && output_ends_with_qoi;
+      if (input_ends_with_qoi == output_ends_with_qoi && !reencode)
+      {
+        fprintf(stderr, "Only one of the input and output files may end in .qoi");
+        return 1;
+      }
+
+      files.decode = input_ends_with_qoi;
+
+      // Netpbm images are told apart by their extension as well
+      if (files.decode && ends_with(args[1], ".ppm"))
+        options.netpbm = QOIS_PNM_PPM;
+      else if (files.decode && ends_with(args[1], ".pam"))
+        options.netpbm = QOIS_PNM_PAM;
+    }
+  }
+
+  // The size and channels of a PPM or PAM image come from its header
+  files.netpbm_input = !files.decode && !files.sequence &&
+                       (piped ? param_count == 0
+                              : ends_with(args[0], ".ppm") || ends_with(args[0], ".pam") || ends_with(args[0], ".pnm"));
+
+  // Check if channels is specified when decoding, encodes need the size, channels and colorspace
+  uint8_t channels = 0;
+  qois_desc desc;
+  if (files.decode && param_count > 0)
+  {
+    channels = (uint8_t)atoi(params[0]);
+    if (channels != 3 && channels != 4)
+    {
+      fprintf(stderr, "Channels override must be 3 or 4");
+      return 1;
+    }
+  }
+  else if (!files.decode && !files.netpbm_input)
+  {
+    if (param_count < 4)
+    {
+      print_usage(argv[0]);
+      return 1;
+    }
+
+    desc.width = (uint32_t)atoi(params[0]);
+    desc.height = (uint32_t)atoi(params[1]);
+    desc.channels = (uint8_t)atoi(params[2]);
+    desc.colorspace = (uint8_t)atoi(params[3]);
+
+    if (desc.channels != 3 && desc.channels != 4)
+    {
+      fprintf(stderr, "Channels must be 3 or 4\n");
+      return 1;
+    }
+  }
+
+  // Segmented containers and images behind the LZ stage are told apart by their magic
+  uint8_t magic[sizeof(qois_seg_magic)];
+  files.input_regular = is_regular_file(input);
+  bool has_magic = files.input_regular && read_at(input, magic, sizeof(magic), 0);
+  files.segmented = has_magic && memcmp(magic, qois_seg_magic, sizeof(qois_seg_magic)) == 0;
+  files.compressed = has_magic && memcmp(magic, qois_lz_magic, sizeof(qois_lz_magic)) == 0;
+
+  // Look at the output before it is created or truncated, so rejected options leave no file behind
+  if (piped)
+  {
+    files.output_regular = is_regular_file(output);
+    files.output_pipe = is_pipe(output);
+  }
+  else
+  {
+    struct stat output_info;
+    bool exists = stat(args[1], &output_info) == 0;
+    files.output_regular = !exists || S_ISREG(output_info.st_mode);
+    files.output_pipe = exists && S_ISFIFO(output_info.st_mode);
+  }
+
+  const char *invalid = check_options(&options, &files);
+  if (invalid)
+  {
+    fprintf(stderr, "%s\n", invalid);
+    return 1;
+  }
+
+  if (!piped)
+  {
+    // Writable mappings need read access to the output as well
+    output = fopen(args[1], options.mmap ? "w+b" : "wb");
+    if (!output)
+    {
+      fprintf(stderr, "Failed to open output file '%s'", args[1]);
+      return 1;
+    }
+  }
+
+  if (files.sequence)
+  {
+    int status;
+    uint32_t frames = 0;
+
+    if (files.decode)
+      status = decode_sequence(input, output, &desc, &frames);
+    else
+      status = encode_sequence(input, output, &desc, options.key_interval, &frames);
+
+    if (status == 0)
+    {
+      printf("Sequence Info:\n");
+      printf("  Width: %d\n", desc.width);
+      printf("  Height: %d\n", desc.height);
+      printf("  Channels: %d\n", desc.channels);
+      printf("  Colorspace: %d\n", desc.colorspace);
+      printf("  Frames: %u\n", frames);
+    }
+
+    if (status == 0 && options.stats)
+      print_stats(stdout);
+    if (status == 0)
+      printf("Done\n");
+
+    free(args);
+    fclose(input);
+    fclose(output);
+    return status;
+  }
+
+  // The options were checked above, so every one of them picks its own path here
+  int status;
+  if (files.decode)
+  {
+    // Segmented containers are decoded in parallel when the files allow random access
+    bool segmented = files.segmented && is_regular_file(output);
+
+    if (options.scale_x > 0)
+      status = decode_scaled(input, output, channels, options.scale_x, options.scale_y, options.netpbm, reencode,
+                             &desc);
+    else if (options.netpbm != QOIS_PNM_NONE)
+      status = decode_netpbm(input, output, channels, options.netpbm, &desc);
+    else if (files.compressed)
+      status = decode_stream(input, output, channels, &desc);
+    else if (options.rows)
+      status = decode_rows_file(input, output, options.index_path, options.first_row, options.last_row,
+                                channels, &desc);
+    else if (options.format)
+      status = decode_framebuffer(input, output, options.pixel_format, options.pitch, &desc);
+    else if (segmented && options.threads > 1)
+      status = decode_segments_parallel(input, output, channels, options.threads, &desc);
+    else if (options.index_path)
+      status = decode_indexed_parallel(input, output, options.index_path, channels, options.threads, &desc);
+    else if (options.mmap)
+      status = decode_mapped(input, output, channels, &desc);
+    else if (options.pipeline)
+      status = decode_pipelined(input, output, channels, options.ring_depth, options.buffer_size, &desc);
+    else if (options.splice)
+      status = decode_spliced(input, output, channels, &desc);
+    else
+      status = decode_stream(input, output, channels, &desc);
+  }
+  else if (files.netpbm_input)
+    status = encode_netpbm(input, output, options.segment_rows, &desc);
+  else if (options.lz_window_bits > 0)
+    status = encode_lz_stream(input, output, &desc, options.lz_window_bits);
+  else if (options.format)
+    status = encode_source_file(input, output, &desc, options.pixel_format, options.pitch);
+  else if (options.segment_rows > 0 && options.threads > 1 && files.input_regular)
+    status = encode_segments_parallel(input, output, &desc, options.segment_rows, options.threads);
+  else if (options.mmap)
+    status = encode_mapped(input, output, &desc, options.segment_rows);
+  else if (options.pipeline)
+    status = encode_pipelined(input, output, &desc, options.segment_rows, options.ring_depth, options.buffer_size);
+  else
+    status = encode_stream(input, output, &desc, options.segment_rows);
+
+  // Only decodes and Netpbm images learn the description from the input
+  if (status == 0 && (files.decode || files.netpbm_input))
+  {
+    fprintf(info, "Image Info:\n");
+    fprintf(info, "  Width: %d\n", desc.width);
+    fprintf(info, "  Height: %d\n", desc.height);
+    fprintf(info, "  Channels: %d\n", desc.channels);
+    fprintf(info, "  Colorspace: %d\n", desc.colorspace);
+  }
+
+  free(args);
+
+  if (status == 0 && options.stats)
+    print_stats(info);
+
+  if (status == 0)
+    fprintf(info, "Done\n");
+
+  // Close the files, stdout is flushed on exit
+  if (!piped)
+  {
+    fclose(input);
+    fclose(output);
+  }
+
+  return status;
 }
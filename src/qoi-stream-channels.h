@@ -0,0 +1,219 @@
+// Channel specialized cores
+//
+// Included by qoi-stream.h once for every channel count, with QOIS_CHANNELS defined to 3 or 4.
+// Every function gets the channel count as a suffix, _qois_decode_ops_3 for example. With a constant
+// pixel size the compiler can turn the pixel copies into plain stores and drop the alpha checks of RGB
+// images. The callers pick the variant once per call. There is no include guard, on purpose.
+
+#ifndef QOIS_CHANNELS
+#error "QOIS_CHANNELS must be defined before including qoi-stream-channels.h"
+#endif
+
+#define QOIS_CHANNELS_PASTE_(name, channels) name##_##channels
+#define QOIS_CHANNELS_PASTE(name, channels) QOIS_CHANNELS_PASTE_(name, channels)
+#define QOIS_CHANNELS_NAME(name) QOIS_CHANNELS_PASTE(name, QOIS_CHANNELS)
+
+  // Encodes a span of whole pixels that fits in the image, see qois_encode_pixels
+  static inline int QOIS_CHANNELS_NAME(_qois_encode_span)(qois_enc_state *state, const uint8_t *pixels,
+                                                          size_t pixel_count, uint8_t *output, size_t output_size)
+  {
+    const uint8_t channels = QOIS_CHANNELS;
+
+    qois_pixel block[QOIS_ENCODE_BLOCK];
+    int outputted = 0;
+
+    while (pixel_count > 0)
+    {
+      size_t count = pixel_count < QOIS_ENCODE_BLOCK ? pixel_count : QOIS_ENCODE_BLOCK;
+
+      if (channels == 4)
+        memcpy(block, pixels, count * sizeof(qois_pixel));
+      else
+        for (size_t i = 0; i < count; i++)
+        {
+          memcpy(&block[i], pixels + i * channels, channels);
+          block[i].a = state->current_pixel.a;
+        }
+
+      pixels += count * channels;
+      pixel_count -= count;
+
+      int result = _qois_encode_block(state, block, count, channels, output, output_size);
+      if (result < 0)
+        return result;
+
+      outputted += result;
+      PROGRESS_OUTPUT(result);
+    }
+
+    return outputted;
+  }
+
+  // Bulk decoder core, see _qois_decode_ops
+#if defined(QOIS_COMPUTED_GOTO)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpedantic"
+#endif
+  static inline int QOIS_CHANNELS_NAME(_qois_decode_ops)(qois_dec_state *state, const uint8_t *input,
+                                                         size_t input_size, uint8_t *output, size_t output_size,
+                                                         size_t *consumed)
+  {
+    const uint8_t channels = QOIS_CHANNELS;
+
+    const uint8_t *in = input;
+    const uint8_t *in_end = input + input_size;
+    uint8_t *out = output;
+    uint8_t *out_end = output + output_size;
+
+    size_t pixels_left = state->pixels_count - state->pixels_out;
+    qois_pixel *cache = state->cache;
+    uint32_t pixel = _qois_pixel_pack(&state->current_pixel);
+    qois_pixel unpacked;
+
+    const qois_op_info *info;
+    int result = 0;
+
+#if defined(QOIS_COMPUTED_GOTO)
+    static const void *const dispatch[] = {
+        [QOIS_OP_RGB - QOIS_OP_RGB] = &&op_rgb,
+        [QOIS_OP_RGBA - QOIS_OP_RGB] = &&op_rgba,
+        [QOIS_OP_INDEX - QOIS_OP_RGB] = &&op_index,
+        [QOIS_OP_DIFF - QOIS_OP_RGB] = &&op_diff,
+        [QOIS_OP_LUMA - QOIS_OP_RGB] = &&op_luma,
+        [QOIS_OP_RUN - QOIS_OP_RGB] = &&op_run,
+    };
+
+// Every op jumps straight to the handler of the next op, which gives each handler its own
+// indirect branch to predict
+#define QOIS_NEXT_OP()                                                                     \
+  if (in >= in_safe_end || pixels_left == 0 || out >= out_safe_end)                        \
+    goto next_op;                                                                          \
+  info = &qois_op_table[in[0]];                                                            \
+  goto *dispatch[info->op - QOIS_OP_RGB];
+#define QOIS_OP_CASE(label, op) label
+#else
+#define QOIS_NEXT_OP() goto next_op;
+#define QOIS_OP_CASE(label, op) case op
+#endif
+
+// Writes the decoded pixel and continues with the next op
+#define QOIS_STORE_PIXEL()                     \
+  unpacked = _qois_pixel_unpack(pixel);        \
+  memcpy(out, &unpacked, channels);            \
+  out += channels;                             \
+  cache[_qois_packed_hash(pixel)] = unpacked;  \
+  pixels_left--;                               \
+  QOIS_STATS_OP(state, info);                  \
+  QOIS_NEXT_OP()
+
+    // Past these points every op fits in the input and at least one pixel fits in the output
+    const uint8_t *in_safe_end = input_size > 4 ? in_end - 4 : input;
+    uint8_t *out_safe_end = output_size > channels ? out_end - channels : output;
+
+  next_op:
+    if (in >= in_end || pixels_left == 0 || (size_t)(out_end - out) < channels)
+      goto done;
+    info = &qois_op_table[in[0]];
+    if ((size_t)(in_end - in) < info->length)
+      goto done;
+
+#if defined(QOIS_COMPUTED_GOTO)
+    goto *dispatch[info->op - QOIS_OP_RGB];
+#else
+    switch (info->op)
+#endif
+    {
+      QOIS_OP_CASE(op_rgb, QOIS_OP_RGB) :
+      {
+        pixel = (pixel & 0xff000000u) | (uint32_t)in[1] | (uint32_t)in[2] << 8 | (uint32_t)in[3] << 16;
+        in += 4;
+        QOIS_STORE_PIXEL()
+      }
+
+      QOIS_OP_CASE(op_rgba, QOIS_OP_RGBA) :
+      {
+        pixel = (uint32_t)in[1] | (uint32_t)in[2] << 8 | (uint32_t)in[3] << 16 | (uint32_t)in[4] << 24;
+        in += 5;
+        QOIS_STORE_PIXEL()
+      }
+
+      QOIS_OP_CASE(op_index, QOIS_OP_INDEX) :
+      {
+        pixel = _qois_pixel_pack(&cache[in[0]]);
+        in += 1;
+        QOIS_STORE_PIXEL()
+      }
+
+      QOIS_OP_CASE(op_diff, QOIS_OP_DIFF) :
+      {
+        pixel = _qois_packed_add(pixel, info->diff);
+        in += 1;
+        QOIS_STORE_PIXEL()
+      }
+
+      QOIS_OP_CASE(op_luma, QOIS_OP_LUMA) :
+      {
+        pixel = _qois_packed_add(pixel, _qois_luma_diff(info, in[1]));
+        in += 2;
+        QOIS_STORE_PIXEL()
+      }
+
+      QOIS_OP_CASE(op_run, QOIS_OP_RUN) :
+      {
+        size_t length = info->run;
+        if (length > pixels_left)
+        {
+          result = -1;
+          goto done;
+        }
+
+        // The part of the run that does not fit is written before the next op, by a later call
+        size_t room = (size_t)(out_end - out) / channels;
+        size_t count = length < room ? length : room;
+
+        unpacked = _qois_pixel_unpack(pixel);
+        _qois_fill_pixels(out, &unpacked, channels, count);
+        out += count * channels;
+
+        cache[_qois_packed_hash(pixel)] = unpacked;
+        pixels_left -= count;
+        in += 1;
+        QOIS_STATS_OP(state, info);
+
+        if (count < length)
+        {
+          state->run_remaining = (uint8_t)(length - count);
+          goto done;
+        }
+        QOIS_NEXT_OP()
+      }
+
+#if !defined(QOIS_COMPUTED_GOTO)
+    default:
+      result = -1;
+      goto done;
+#endif
+    }
+
+#undef QOIS_STORE_PIXEL
+#undef QOIS_OP_CASE
+#undef QOIS_NEXT_OP
+
+  done:
+    state->current_pixel = _qois_pixel_unpack(pixel);
+    state->last_pixel = state->current_pixel;
+    state->pixels_out = state->pixels_count - pixels_left;
+
+    *consumed = (size_t)(in - input);
+    if (result < 0)
+      return result;
+    return (int)(out - output);
+  }
+#if defined(QOIS_COMPUTED_GOTO)
+#pragma GCC diagnostic pop
+#endif
+
+#undef QOIS_CHANNELS_NAME
+#undef QOIS_CHANNELS_PASTE
+#undef QOIS_CHANNELS_PASTE_
+#undef QOIS_CHANNELS
@@ -0,0 +1,303 @@
+#include "qoi-stream.h"
+
+#ifndef QOIS_STREAM_INDEX_H
+#define QOIS_STREAM_INDEX_H
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+  // Checkpoint index
+  //
+  // A sidecar index for plain QOI files, made in a single pass over the file. Every interval pixels
+  // the decoder state is saved at the next op boundary, which is all a decoder needs to start in the
+  // middle of the file. Decoding the parts between checkpoints can then be spread over multiple threads.
+  //
+  // Layout: qois_index_header, followed by the checkpoints until the end of the index.
+  // Checkpoints are only taken between ops, so op_data and op_position never need to be saved.
+
+  // Constants
+
+  static const uint8_t qois_index_magic[4] = {'q', 'o', 'i', 'x'};
+
+  // Types
+
+  typedef struct __attribute__((packed)) _qois_index_header
+  {
+    uint8_t magic[4];
+    uint32_t width;      // Big endian
+    uint32_t height;     // Big endian
+    uint32_t interval;   // Big endian
+    uint64_t input_size; // Big endian, size of the indexed QOI file
+  } qois_index_header;
+
+  typedef struct __attribute__((packed)) _qois_checkpoint_data
+  {
+    uint64_t input_offset; // Big endian
+    uint64_t pixel_offset; // Big endian
+    qois_pixel pixel;
+    qois_pixel cache[64];
+  } qois_checkpoint_data;
+
+  typedef struct _qois_checkpoint
+  {
+    // Offset of the next op in the QOI file
+    uint64_t input_offset;
+    // Amount of pixels decoded before the next op
+    uint64_t pixel_offset;
+
+    qois_pixel pixel;
+    qois_pixel cache[64];
+  } qois_checkpoint;
+
+  typedef struct _qois_index_state
+  {
+    qois_dec_state dec;
+
+    uint32_t interval;
+    uint64_t input_offset;
+    uint64_t next_checkpoint;
+  } qois_index_state;
+
+  // Util functions
+
+  static inline int qois_index_write_header(const qois_desc *desc, uint32_t interval, uint64_t input_size,
+                                            uint8_t *output, size_t output_size)
+  {
+    ASSERT_OUTPUT_AVAILABLE(sizeof(qois_index_header));
+
+    qois_index_header *header = (qois_index_header *)output;
+
+    memcpy(header->magic, qois_index_magic, sizeof(qois_index_magic));
+
+    header->width = NATIVE_TO_BIG_ENDIAN(desc->width);
+    header->height = NATIVE_TO_BIG_ENDIAN(desc->height);
+    header->interval = NATIVE_TO_BIG_ENDIAN(interval);
+    header->input_size = NATIVE_TO_BIG_ENDIAN_64(input_size);
+
+    return sizeof(qois_index_header);
+  }
+
+  // Reads an index header, and checks that it belongs to the given image
+  static inline bool qois_index_read_header(const uint8_t *data, size_t size,
+                                            const qois_desc *desc, uint64_t input_size, uint32_t *interval)
+  {
+    if (size < sizeof(qois_index_header))
+      return false;
+
+    qois_index_header *header = (qois_index_header *)data;
+    if (memcmp(header->magic, qois_index_magic, sizeof(qois_index_magic)) != 0)
+      return false;
+
+    *interval = BIG_ENDIAN_TO_NATIVE(header->interval);
+
+    return BIG_ENDIAN_TO_NATIVE(header->width) == desc->width &&
+           BIG_ENDIAN_TO_NATIVE(header->height) == desc->height &&
+           BIG_ENDIAN_TO_NATIVE_64(header->input_size) == input_size &&
+           *interval > 0;
+  }
+
+  static inline void qois_checkpoint_write(const qois_checkpoint *checkpoint, uint8_t *output)
+  {
+    qois_checkpoint_data data;
+    data.input_offset = NATIVE_TO_BIG_ENDIAN_64(checkpoint->input_offset);
+    data.pixel_offset = NATIVE_TO_BIG_ENDIAN_64(checkpoint->pixel_offset);
+    data.pixel = checkpoint->pixel;
+    memcpy(data.cache, checkpoint->cache, sizeof(data.cache));
+
+    memcpy(output, &data, sizeof(data));
+  }
+
+  static inline void qois_checkpoint_read(const uint8_t *input, qois_checkpoint *checkpoint)
+  {
+    qois_checkpoint_data data;
+    memcpy(&data, input, sizeof(data));
+
+    checkpoint->input_offset = BIG_ENDIAN_TO_NATIVE_64(data.input_offset);
+    checkpoint->pixel_offset = BIG_ENDIAN_TO_NATIVE_64(data.pixel_offset);
+    checkpoint->pixel = data.pixel;
+    memcpy(checkpoint->cache, data.cache, sizeof(checkpoint->cache));
+  }
+
+  // Puts a decoder in the state saved in the checkpoint, desc is the description of the image.
+  // Decoding continues with the byte at checkpoint->input_offset.
+  static inline void qois_dec_state_restore(qois_dec_state *state, const qois_desc *desc,
+                                            const qois_checkpoint *checkpoint, uint8_t channels)
+  {
+    state->desc = *desc;
+    if (channels != 0)
+      state->desc.channels = channels;
+
+    state->state = QOIS_OP_NONE;
+    state->op_data = 0;
+    state->op_position = 0;
+    state->pixels_out = (size_t)checkpoint->pixel_offset;
+    state->pixels_count = (size_t)desc->width * desc->height;
+    state->run_remaining = 0;
+
+    state->current_pixel = checkpoint->pixel;
+    state->last_pixel = checkpoint->pixel;
+    memcpy(state->cache, checkpoint->cache, sizeof(state->cache));
+
+#ifdef QOIS_STATS
+    qois_stats_reset(&state->stats);
+#endif
+
+    if (state->pixels_out >= state->pixels_count)
+      state->state = QOIS_STATE_FOOTER;
+  }
+
+  // Index functions
+
+  void qois_index_state_init(qois_index_state *state, uint32_t interval)
+  {
+    qois_dec_state_init(&state->dec, 0);
+
+    state->interval = interval > 0 ? interval : 1;
+    state->input_offset = 0;
+    state->next_checkpoint = 0;
+  }
+
+  // Reads the QOI file one buffer at a time, and writes a serialized checkpoint to the output
+  // every time one is due. Returns the amount of bytes written, or -1 on error.
+  // Stops early when the output can not hold the next checkpoint, consumed is set to the amount of input used.
+  static inline int qois_index_buffer(qois_index_state *state, const uint8_t *input, size_t input_size,
+                                      uint8_t *output, size_t output_size, size_t *consumed)
+  {
+    size_t input_pos = 0;
+    size_t output_pos = 0;
+
+    if (output_size > INT_MAX)
+      output_size = INT_MAX;
+
+    while (state->dec.state != QOIS_STATE_DONE)
+    {
+      if (state->dec.state == QOIS_OP_NONE &&
+          state->dec.pixels_out >= state->next_checkpoint &&
+          state->dec.pixels_out < state->dec.pixels_count)
+      {
+        if (output_size - output_pos < sizeof(qois_checkpoint_data))
+          break;
+
+        qois_checkpoint checkpoint;
+        checkpoint.input_offset = state->input_offset;
+        checkpoint.pixel_offset = state->dec.pixels_out;
+        checkpoint.pixel = state->dec.current_pixel;
+        memcpy(checkpoint.cache, state->dec.cache, sizeof(checkpoint.cache));
+
+        qois_checkpoint_write(&checkpoint, output + output_pos);
+        output_pos += sizeof(qois_checkpoint_data);
+
+        state->next_checkpoint = (state->dec.pixels_out / state->interval + 1) * state->interval;
+      }
+
+      if (input_pos >= input_size)
+        break;
+
+      size_t used = 0;
+      if (qois_skip_buffer(&state->dec, input + input_pos, input_size - input_pos,
+                           (size_t)state->next_checkpoint, &used) < 0)
+      {
+        *consumed = input_pos + used;
+        return -1;
+      }
+
+      input_pos += used;
+      state->input_offset += used;
+    }
+
+    *consumed = input_pos;
+    return (int)output_pos;
+  }
+
+  // Row range functions
+
+  // Finds the last checkpoint at or before the pixel, or NULL if there is none
+  static inline const qois_checkpoint *_qois_find_checkpoint(const qois_checkpoint *checkpoints, size_t checkpoint_count,
+                                                             uint64_t pixel)
+  {
+    size_t low = 0;
+    size_t high = checkpoint_count;
+    while (low < high)
+    {
+      size_t middle = low + (high - low) / 2;
+      if (checkpoints[middle].pixel_offset <= pixel)
+        low = middle + 1;
+      else
+        high = middle;
+    }
+
+    return low > 0 ? &checkpoints[low - 1] : NULL;
+  }
+
+  // Decodes rows y0 up to (not including) y1 of the QOI file in data, and writes them to the output.
+  // Decoding starts at the closest checkpoint before the band, or at the header if checkpoints is NULL,
+  // everything before the band is skipped without writing pixels.
+  // Channels overrides the output channels when not 0. Returns the amount of bytes written, or -1 on error.
+  static inline int qois_decode_rows(const uint8_t *data, size_t size,
+                                     const qois_checkpoint *checkpoints, size_t checkpoint_count,
+                                     uint32_t y0, uint32_t y1, uint8_t channels,
+                                     uint8_t *output, size_t output_size)
+  {
+    qois_desc desc;
+    if (!qois_get_desc(data, size, &desc) || y0 > y1 || y1 > desc.height)
+      return -1;
+
+    if (channels == 0)
+      channels = desc.channels;
+
+    size_t start = (size_t)y0 * desc.width;
+    size_t end = (size_t)y1 * desc.width;
+    if ((end - start) * channels > INT_MAX || output_size < (end - start) * channels)
+      return -1;
+
+    qois_dec_state state;
+    size_t input_pos = 0;
+
+    const qois_checkpoint *checkpoint = _qois_find_checkpoint(checkpoints, checkpoint_count, start);
+    if (checkpoint && checkpoint->input_offset >= sizeof(qois_header) && checkpoint->input_offset < size)
+    {
+      qois_dec_state_restore(&state, &desc, checkpoint, channels);
+      input_pos = (size_t)checkpoint->input_offset;
+    }
+    else
+      qois_dec_state_init(&state, channels);
+
+    size_t consumed = 0;
+    if (qois_skip_buffer(&state, data + input_pos, size - input_pos, start, &consumed) < 0)
+      return -1;
+    input_pos += consumed;
+
+    size_t pixel = start;
+    while (pixel < end)
+    {
+      // A run that crosses the current pixel was already decoded, all of its pixels are the current pixel
+      if (state.pixels_out > pixel)
+      {
+        size_t count = (state.pixels_out < end ? state.pixels_out : end) - pixel;
+        _qois_fill_pixels(output + (pixel - start) * channels, &state.current_pixel, channels, count);
+        pixel += count;
+        continue;
+      }
+
+      if (state.state != QOIS_OP_NONE || input_pos >= size)
+        return -1;
+
+      // A run that crosses the end of the band is written partially
+      int outputted = qois_decode_buffer(&state, data + input_pos, size - input_pos,
+                                         output + (pixel - start) * channels, (end - pixel) * channels, &consumed);
+      if (outputted < 0 || (outputted == 0 && consumed == 0))
+        return -1;
+      input_pos += consumed;
+      pixel += (size_t)outputted / channels;
+    }
+
+    return (int)((end - start) * channels);
+  }
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,474 @@
+#include "qoi-stream.h"
+
+#ifndef QOIS_STREAM_LZ_H
+#define QOIS_STREAM_LZ_H
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+  // LZ stage
+  //
+  // A small streaming LZ77 compressor and decompressor, to be chained after the encoder and before the decoder.
+  // Both sides push bytes through like qois_decode_buffer and can be stopped and resumed at any byte.
+  // Memory is fixed by the window size and given by the caller, see qois_lz_enc_memory_size.
+  //
+  // Layout: qois_lz_header, then groups of a flag byte followed by 8 items, the last group may be shorter.
+  // Bit i of the flag byte (lowest first) is set when item i is a match, otherwise it is a single literal byte.
+  // A match is either 0LLLDDDD DDDDDDDD, a length of 3 to 10 at a distance of up to 4095,
+  // or 1LLLLLLL DDDDDDDD DDDDDDDD (big endian distance), a length of 4 to 131 at a distance of up to 65535.
+  // The short form with a distance of 0 ends the stream.
+
+  // Constants
+
+  static const uint8_t qois_lz_magic[4] = {'q', 'o', 'i', 'z'};
+
+#define QOIS_LZ_MIN_WINDOW_BITS 8
+#define QOIS_LZ_MAX_WINDOW_BITS 16
+#define QOIS_LZ_MAX_HASH_BITS 12
+
+#define QOIS_LZ_MIN_MATCH 3
+#define QOIS_LZ_MAX_SHORT_MATCH 10
+#define QOIS_LZ_MAX_SHORT_DISTANCE 4095
+#define QOIS_LZ_MAX_MATCH 131
+
+  // Types
+
+  typedef struct __attribute__((packed)) _qois_lz_header
+  {
+    uint8_t magic[4];
+    uint8_t window_bits;
+  } qois_lz_header;
+
+  typedef struct _qois_lz_enc_state
+  {
+    qois_state state;
+    uint8_t window_bits;
+    uint8_t hash_bits;
+
+    // Caller provided, the ring holds twice the window and is followed by the hash heads
+    uint8_t *ring;
+    uint16_t *heads;
+
+    // Absolute positions of the next byte to compress, and of the end of the bytes pushed so far
+    uint64_t pos;
+    uint64_t end;
+
+    // The group in progress, it is written to the output once it is complete
+    uint8_t group[1 + 8 * 3];
+    uint8_t group_size;
+    uint8_t group_items;
+    uint8_t group_written;
+  } qois_lz_enc_state;
+
+  typedef struct _qois_lz_dec_state
+  {
+    qois_state state;
+    uint8_t window_bits;
+    uint8_t max_window_bits;
+
+    uint8_t header_position;
+    uint8_t header[sizeof(qois_lz_header)];
+
+    // Caller provided, holds the last window of output
+    uint8_t *ring;
+    uint64_t pos;
+
+    // Flags of the group in progress and the items of it still to come
+    uint8_t flags;
+    uint8_t items_left;
+    uint8_t item[3];
+    uint8_t item_position;
+
+    // Bytes of the last match that did not fit in the output yet
+    uint8_t match_remaining;
+    uint16_t match_distance;
+  } qois_lz_dec_state;
+
+  // Util functions
+
+  static inline uint8_t _qois_lz_hash_bits(uint8_t window_bits)
+  {
+    return window_bits < QOIS_LZ_MAX_HASH_BITS ? window_bits : QOIS_LZ_MAX_HASH_BITS;
+  }
+
+  // Memory needed by the compressor for the given window, the memory must be aligned for uint16_t
+  static inline size_t qois_lz_enc_memory_size(uint8_t window_bits)
+  {
+    return ((size_t)2 << window_bits) + ((size_t)1 << _qois_lz_hash_bits(window_bits)) * sizeof(uint16_t);
+  }
+
+  // Memory needed by the decompressor for the largest window it accepts
+  static inline size_t qois_lz_dec_memory_size(uint8_t max_window_bits)
+  {
+    return (size_t)1 << max_window_bits;
+  }
+
+  // Returns the maximum amount of bytes the compressed form of size bytes can take, with the header and end
+  static inline size_t qois_lz_compress_bound(size_t size)
+  {
+    return sizeof(qois_lz_header) + size + (size + 8) / 8 + 2 + 1;
+  }
+
+  static inline bool qois_is_qoi_lz(const uint8_t *data, size_t size)
+  {
+    if (size < sizeof(qois_lz_header))
+      return false;
+
+    qois_lz_header *header = (qois_lz_header *)data;
+    return memcmp(header->magic, qois_lz_magic, sizeof(qois_lz_magic)) == 0;
+  }
+
+  // Encode functions
+
+  // The window is 1 << window_bits bytes, from QOIS_LZ_MIN_WINDOW_BITS up to QOIS_LZ_MAX_WINDOW_BITS.
+  // The memory must hold qois_lz_enc_memory_size bytes.
+  void qois_lz_enc_state_init(qois_lz_enc_state *state, uint8_t window_bits, void *memory)
+  {
+    state->state = QOIS_STATE_HEADER;
+    state->window_bits = window_bits;
+    state->hash_bits = _qois_lz_hash_bits(window_bits);
+
+    state->ring = memory;
+    state->heads = (uint16_t *)(state->ring + ((size_t)2 << window_bits));
+    memset(state->heads, 0, ((size_t)1 << state->hash_bits) * sizeof(uint16_t));
+
+    state->pos = 0;
+    state->end = 0;
+
+    // The header goes out through the group, so it can be split over multiple outputs like the groups
+    qois_lz_header header;
+    memcpy(header.magic, qois_lz_magic, sizeof(qois_lz_magic));
+    header.window_bits = window_bits;
+
+    memcpy(state->group, &header, sizeof(header));
+    state->group_size = sizeof(header);
+    state->group_items = 0;
+    state->group_written = 0;
+  }
+
+  static inline uint8_t _qois_lz_ring_byte(const qois_lz_enc_state *state, uint64_t pos)
+  {
+    return state->ring[pos & (((uint64_t)2 << state->window_bits) - 1)];
+  }
+
+  static inline uint32_t _qois_lz_hash(const qois_lz_enc_state *state, uint64_t pos)
+  {
+    uint32_t value = (uint32_t)_qois_lz_ring_byte(state, pos) | (uint32_t)_qois_lz_ring_byte(state, pos + 1) << 8 |
+                     (uint32_t)_qois_lz_ring_byte(state, pos + 2) << 16;
+    return (value * 2654435761u) >> (32 - state->hash_bits);
+  }
+
+  // Writes as much of the completed group as fits, returns false if the output is full
+  static inline bool _qois_lz_flush_group(qois_lz_enc_state *state, uint8_t *output, size_t output_size,
+                                          size_t *output_pos)
+  {
+    size_t count = (size_t)(state->group_size - state->group_written);
+    if (count > output_size - *output_pos)
+      count = output_size - *output_pos;
+
+    memcpy(output + *output_pos, state->group + state->group_written, count);
+    *output_pos += count;
+    state->group_written = (uint8_t)(state->group_written + count);
+
+    if (state->group_written < state->group_size)
+      return false;
+
+    state->group[0] = 0;
+    state->group_size = 1;
+    state->group_items = 0;
+    state->group_written = 0;
+    return true;
+  }
+
+  static inline void _qois_lz_add_match(qois_lz_enc_state *state, size_t length, size_t distance)
+  {
+    uint8_t *item = state->group + state->group_size;
+    state->group[0] = (uint8_t)(state->group[0] | 1 << state->group_items);
+    state->group_items++;
+
+    if (length <= QOIS_LZ_MAX_SHORT_MATCH && distance <= QOIS_LZ_MAX_SHORT_DISTANCE)
+    {
+      item[0] = (uint8_t)((length - QOIS_LZ_MIN_MATCH) << 4 | distance >> 8);
+      item[1] = (uint8_t)distance;
+      state->group_size = (uint8_t)(state->group_size + 2);
+    }
+    else
+    {
+      item[0] = (uint8_t)(0x80 | (length - QOIS_LZ_MIN_MATCH - 1));
+      item[1] = (uint8_t)(distance >> 8);
+      item[2] = (uint8_t)distance;
+      state->group_size = (uint8_t)(state->group_size + 3);
+    }
+  }
+
+  // Finds the longest match for the bytes at pos with a single hash probe, and inserts pos in the hash heads
+  static inline size_t _qois_lz_find_match(qois_lz_enc_state *state, size_t *distance)
+  {
+    size_t available = (size_t)(state->end - state->pos);
+    if (available < QOIS_LZ_MIN_MATCH)
+      return 0;
+
+    uint32_t hash = _qois_lz_hash(state, state->pos);
+    uint16_t candidate = state->heads[hash];
+    state->heads[hash] = (uint16_t)state->pos;
+
+    // Stale heads only point at older bytes, the match is checked byte by byte anyway
+    size_t found = (uint16_t)((uint16_t)state->pos - candidate);
+    if (found == 0 || found >= ((size_t)1 << state->window_bits) || found > state->pos)
+      return 0;
+
+    size_t max_length = available < QOIS_LZ_MAX_MATCH ? available : QOIS_LZ_MAX_MATCH;
+    size_t length = 0;
+    while (length < max_length &&
+           _qois_lz_ring_byte(state, state->pos + length) == _qois_lz_ring_byte(state, state->pos - found + length))
+      length++;
+
+    // Matches that need the long form only pay off from 4 bytes
+    if (length < QOIS_LZ_MIN_MATCH || (length == QOIS_LZ_MIN_MATCH && found > QOIS_LZ_MAX_SHORT_DISTANCE))
+      return 0;
+
+    *distance = found;
+    return length;
+  }
+
+  static inline int _qois_lz_compress(qois_lz_enc_state *state, const uint8_t *input, size_t input_size,
+                                      bool finish, uint8_t *output, size_t output_size, size_t *consumed)
+  {
+    const uint64_t ring_mask = ((uint64_t)2 << state->window_bits) - 1;
+    size_t input_pos = 0;
+    size_t output_pos = 0;
+
+    if (output_size > INT_MAX)
+      output_size = INT_MAX;
+
+    if (state->state == QOIS_STATE_HEADER)
+    {
+      if (!_qois_lz_flush_group(state, output, output_size, &output_pos))
+      {
+        *consumed = 0;
+        return (int)output_pos;
+      }
+      state->state = QOIS_OP_NONE;
+    }
+
+    while (state->state == QOIS_OP_NONE)
+    {
+      if (state->group_items == 8 && !_qois_lz_flush_group(state, output, output_size, &output_pos))
+        break;
+
+      // Keep a full match of lookahead, the ring has room for it next to the window
+      while (input_pos < input_size && state->end - state->pos < QOIS_LZ_MAX_MATCH)
+        state->ring[state->end++ & ring_mask] = input[input_pos++];
+
+      if (state->end - state->pos < QOIS_LZ_MAX_MATCH && !finish)
+        break;
+
+      if (state->pos == state->end)
+      {
+        // The end marker closes the last group
+        _qois_lz_add_match(state, QOIS_LZ_MIN_MATCH, 0);
+        state->state = QOIS_STATE_FOOTER;
+        break;
+      }
+
+      size_t distance = 0;
+      size_t length = _qois_lz_find_match(state, &distance);
+      if (length == 0)
+      {
+        state->group[state->group_size++] = _qois_lz_ring_byte(state, state->pos);
+        state->group_items++;
+        state->pos++;
+        continue;
+      }
+
+      _qois_lz_add_match(state, length, distance);
+
+      // Every position in the match goes in the heads, so later repeats can find it
+      for (uint64_t end = state->pos + length; ++state->pos < end;)
+        if (state->end - state->pos >= QOIS_LZ_MIN_MATCH)
+          state->heads[_qois_lz_hash(state, state->pos)] = (uint16_t)state->pos;
+    }
+
+    if (state->state == QOIS_STATE_FOOTER && _qois_lz_flush_group(state, output, output_size, &output_pos))
+      state->state = QOIS_STATE_DONE;
+
+    *consumed = input_pos;
+    return (int)output_pos;
+  }
+
+  // Compresses the input, keeping up to QOIS_LZ_MAX_MATCH bytes back until more input arrives or the
+  // stream is finished with qois_lz_compress_finish. Returns the amount of bytes written.
+  // The amount of input bytes used is stored in consumed, this is less than input_size if the output is full.
+  static inline int qois_lz_compress(qois_lz_enc_state *state, const uint8_t *input, size_t input_size,
+                                     uint8_t *output, size_t output_size, size_t *consumed)
+  {
+    return _qois_lz_compress(state, input, input_size, false, output, output_size, consumed);
+  }
+
+  // Compresses the last of the input and ends the stream. Call it again with the rest of the input until
+  // state->state is QOIS_STATE_DONE. Returns the amount of bytes written.
+  static inline int qois_lz_compress_finish(qois_lz_enc_state *state, const uint8_t *input, size_t input_size,
+                                            uint8_t *output, size_t output_size, size_t *consumed)
+  {
+    return _qois_lz_compress(state, input, input_size, true, output, output_size, consumed);
+  }
+
+  // Decode functions
+
+  // Streams with a window of up to 1 << max_window_bits are accepted, the memory must hold
+  // qois_lz_dec_memory_size bytes.
+  void qois_lz_dec_state_init(qois_lz_dec_state *state, uint8_t max_window_bits, void *memory)
+  {
+    state->state = QOIS_STATE_HEADER;
+    state->window_bits = 0;
+    state->max_window_bits = max_window_bits;
+    state->header_position = 0;
+
+    state->ring = memory;
+    state->pos = 0;
+
+    state->flags = 0;
+    state->items_left = 0;
+    state->item_position = 0;
+
+    state->match_remaining = 0;
+    state->match_distance = 0;
+  }
+
+  // Copies as much of the match in progress as fits in the output
+  static inline size_t _qois_lz_copy_match(qois_lz_dec_state *state, uint8_t *output, size_t output_size)
+  {
+    const uint64_t ring_mask = ((uint64_t)1 << state->window_bits) - 1;
+
+    size_t count = state->match_remaining < output_size ? state->match_remaining : output_size;
+    for (size_t i = 0; i < count; i++)
+    {
+      uint8_t byte = state->ring[(state->pos - state->match_distance) & ring_mask];
+      state->ring[state->pos++ & ring_mask] = byte;
+      output[i] = byte;
+    }
+
+    state->match_remaining = (uint8_t)(state->match_remaining - count);
+    return count;
+  }
+
+  // Decompresses the input, returns the amount of bytes written or -1 on error. The amount of input bytes
+  // used is stored in consumed, this is less than input_size if the output is full or the stream ended.
+  // On error consumed points to the offending byte.
+  static inline int qois_lz_decompress(qois_lz_dec_state *state, const uint8_t *input, size_t input_size,
+                                       uint8_t *output, size_t output_size, size_t *consumed)
+  {
+    size_t input_pos = 0;
+    size_t output_pos = 0;
+
+    if (output_size > INT_MAX)
+      output_size = INT_MAX;
+
+    while (state->state != QOIS_STATE_DONE)
+    {
+      if (state->match_remaining > 0)
+      {
+        output_pos += _qois_lz_copy_match(state, output + output_pos, output_size - output_pos);
+        if (state->match_remaining > 0)
+          break;
+      }
+
+      if (input_pos >= input_size)
+        break;
+
+      uint8_t byte = input[input_pos];
+
+      if (state->state == QOIS_STATE_HEADER)
+      {
+        state->header[state->header_position++] = byte;
+        input_pos++;
+        if (state->header_position < sizeof(qois_lz_header))
+          continue;
+
+        qois_lz_header *header = (qois_lz_header *)state->header;
+        if (!qois_is_qoi_lz(state->header, sizeof(state->header)) ||
+            header->window_bits < QOIS_LZ_MIN_WINDOW_BITS || header->window_bits > state->max_window_bits)
+        {
+          *consumed = input_pos - 1;
+          return -1;
+        }
+
+        state->window_bits = header->window_bits;
+        state->state = QOIS_OP_NONE;
+        continue;
+      }
+
+      if (state->items_left == 0)
+      {
+        state->flags = byte;
+        state->items_left = 8;
+        input_pos++;
+        continue;
+      }
+
+      // Literals
+      if (!(state->flags & 1))
+      {
+        if (output_pos >= output_size)
+          break;
+
+        state->ring[state->pos++ & (((uint64_t)1 << state->window_bits) - 1)] = byte;
+        output[output_pos++] = byte;
+
+        state->flags >>= 1;
+        state->items_left--;
+        input_pos++;
+        continue;
+      }
+
+      // Matches
+      state->item[state->item_position++] = byte;
+      input_pos++;
+
+      uint8_t item_size = state->item[0] & 0x80 ? 3 : 2;
+      if (state->item_position < item_size)
+        continue;
+      state->item_position = 0;
+
+      size_t length, distance;
+      if (item_size == 2)
+      {
+        length = (size_t)(state->item[0] >> 4) + QOIS_LZ_MIN_MATCH;
+        distance = (size_t)(state->item[0] & 0x0f) << 8 | state->item[1];
+      }
+      else
+      {
+        length = (size_t)(state->item[0] & 0x7f) + QOIS_LZ_MIN_MATCH + 1;
+        distance = (size_t)state->item[1] << 8 | state->item[2];
+      }
+
+      state->flags >>= 1;
+      state->items_left--;
+
+      if (item_size == 2 && distance == 0)
+      {
+        state->state = QOIS_STATE_DONE;
+        break;
+      }
+
+      if (distance == 0 || distance >= ((size_t)1 << state->window_bits) || distance > state->pos)
+      {
+        *consumed = input_pos - 1;
+        return -1;
+      }
+
+      state->match_remaining = (uint8_t)length;
+      state->match_distance = (uint16_t)distance;
+    }
+
+    *consumed = input_pos;
+    return (int)output_pos;
+  }
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
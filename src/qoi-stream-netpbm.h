@@ -0,0 +1,325 @@
+#include "qoi-stream.h"
+
+#ifndef QOIS_STREAM_NETPBM_H
+#define QOIS_STREAM_NETPBM_H
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+  // Netpbm headers
+  //
+  // Reads and writes the headers of binary PPM (P6) and PAM (P7) images with 8 bit samples. The body of
+  // both is the interleaved RGB or RGBA pixels, so it can go straight into the encoder or come straight
+  // out of the decoder. The header parser takes any amount of bytes at a time, like qois_decode_buffer.
+
+  // Constants
+
+  // Size of the longest header qois_pnm_write_header writes
+#define QOIS_PNM_HEADER_BOUND 96
+
+  // Longest PPM token or PAM header line the parser accepts, comments may be longer
+#define QOIS_PNM_TOKEN_SIZE 72
+
+  // Types
+
+  typedef enum _qois_pnm_type
+  {
+    QOIS_PNM_NONE = 0,
+    QOIS_PNM_PPM,
+    QOIS_PNM_PAM,
+  } qois_pnm_type;
+
+  typedef struct _qois_pnm_parser
+  {
+    qois_state state;
+    qois_pnm_type type;
+    qois_desc desc;
+
+    // PPM token or PAM line in progress, comments are skipped up to the end of the line
+    char token[QOIS_PNM_TOKEN_SIZE];
+    uint8_t token_length;
+    bool comment;
+
+    // Width, height and maxval, in that order for PPM. PAM keeps the depth separately.
+    uint32_t values[3];
+    uint8_t value_count;
+    uint32_t depth;
+  } qois_pnm_parser;
+
+  // Init functions
+
+  void qois_pnm_parser_init(qois_pnm_parser *parser)
+  {
+    parser->state = QOIS_STATE_HEADER;
+    parser->type = QOIS_PNM_NONE;
+    _qois_desc_init(&parser->desc);
+
+    parser->token_length = 0;
+    parser->comment = false;
+
+    memset(parser->values, 0, sizeof(parser->values));
+    parser->value_count = 0;
+    parser->depth = 0;
+  }
+
+  // Util functions
+
+  static inline bool _qois_pnm_is_space(uint8_t byte)
+  {
+    return byte == ' ' || byte == '\t' || byte == '\n' || byte == '\v' || byte == '\f' || byte == '\r';
+  }
+
+  static inline bool _qois_pnm_number(const char *text, size_t length, uint32_t *value)
+  {
+    if (length == 0 || length > 10)
+      return false;
+
+    uint64_t number = 0;
+    for (size_t i = 0; i < length; i++)
+    {
+      if (text[i] < '0' || text[i] > '9')
+        return false;
+      number = number * 10 + (uint64_t)(text[i] - '0');
+    }
+
+    if (number > UINT32_MAX)
+      return false;
+
+    *value = (uint32_t)number;
+    return true;
+  }
+
+  static inline size_t _qois_pnm_append(char *header, size_t length, const char *text)
+  {
+    size_t size = strlen(text);
+    memcpy(header + length, text, size);
+    return length + size;
+  }
+
+  static inline size_t _qois_pnm_append_number(char *header, size_t length, uint32_t value)
+  {
+    char digits[10];
+    size_t count = 0;
+    do
+    {
+      digits[count++] = (char)('0' + value % 10);
+      value /= 10;
+    } while (value > 0);
+
+    while (count > 0)
+      header[length++] = digits[--count];
+    return length;
+  }
+
+  // Writes the header for an image with the description, PPM needs 3 channels
+  static inline int qois_pnm_write_header(const qois_desc *desc, qois_pnm_type type, uint8_t *output,
+                                          size_t output_size)
+  {
+    if (type == QOIS_PNM_PPM && desc->channels != 3)
+      return -1;
+    if (type != QOIS_PNM_PPM && type != QOIS_PNM_PAM)
+      return -1;
+
+    char header[QOIS_PNM_HEADER_BOUND];
+    size_t length = 0;
+
+    if (type == QOIS_PNM_PPM)
+    {
+      length = _qois_pnm_append(header, length, "P6\n");
+      length = _qois_pnm_append_number(header, length, desc->width);
+      length = _qois_pnm_append(header, length, " ");
+      length = _qois_pnm_append_number(header, length, desc->height);
+      length = _qois_pnm_append(header, length, "\n255\n");
+    }
+    else
+    {
+      length = _qois_pnm_append(header, length, "P7\nWIDTH ");
+      length = _qois_pnm_append_number(header, length, desc->width);
+      length = _qois_pnm_append(header, length, "\nHEIGHT ");
+      length = _qois_pnm_append_number(header, length, desc->height);
+      length = _qois_pnm_append(header, length, "\nDEPTH ");
+      length = _qois_pnm_append_number(header, length, desc->channels);
+      length = _qois_pnm_append(header, length, "\nMAXVAL 255\nTUPLTYPE ");
+      length = _qois_pnm_append(header, length, desc->channels == 4 ? "RGB_ALPHA" : "RGB");
+      length = _qois_pnm_append(header, length, "\nENDHDR\n");
+    }
+
+    ASSERT_OUTPUT_AVAILABLE(length);
+    memcpy(output, header, length);
+    return (int)length;
+  }
+
+  // Parse functions
+
+  // Checks the values once the header is complete and fills in the description
+  static inline int _qois_pnm_finish(qois_pnm_parser *parser)
+  {
+    uint32_t channels = parser->type == QOIS_PNM_PPM ? 3 : parser->depth;
+
+    // QOI only stores 8 bit samples, and no grayscale images
+    if (parser->values[0] == 0 || parser->values[1] == 0 || parser->values[2] != 255)
+      return -1;
+    if (channels != 3 && channels != 4)
+      return -1;
+
+    parser->desc.width = parser->values[0];
+    parser->desc.height = parser->values[1];
+    parser->desc.channels = (uint8_t)channels;
+    parser->desc.colorspace = 0;
+
+    parser->state = QOIS_STATE_DONE;
+    return 1;
+  }
+
+  static inline int _qois_pnm_parse_magic(qois_pnm_parser *parser, uint8_t byte)
+  {
+    if (!_qois_pnm_is_space(byte))
+    {
+      if (parser->token_length == 2)
+        return -1;
+      parser->token[parser->token_length++] = (char)byte;
+      return 0;
+    }
+
+    if (parser->token_length != 2 || parser->token[0] != 'P')
+      return -1;
+
+    if (parser->token[1] == '6')
+      parser->type = QOIS_PNM_PPM;
+    else if (parser->token[1] == '7')
+      parser->type = QOIS_PNM_PAM;
+    else
+      return -1;
+
+    parser->token_length = 0;
+    return 0;
+  }
+
+  static inline int _qois_pnm_parse_ppm(qois_pnm_parser *parser, uint8_t byte)
+  {
+    if (parser->comment)
+    {
+      parser->comment = byte != '\n' && byte != '\r';
+      return 0;
+    }
+
+    bool space = _qois_pnm_is_space(byte);
+    if (!space && byte != '#')
+    {
+      if (parser->token_length == QOIS_PNM_TOKEN_SIZE)
+        return -1;
+      parser->token[parser->token_length++] = (char)byte;
+      return 0;
+    }
+
+    if (parser->token_length > 0)
+    {
+      if (!_qois_pnm_number(parser->token, parser->token_length, &parser->values[parser->value_count]))
+        return -1;
+      parser->value_count++;
+      parser->token_length = 0;
+
+      // A single whitespace byte follows the maxval, the pixels start right after it
+      if (parser->value_count == 3)
+        return space ? _qois_pnm_finish(parser) : -1;
+    }
+
+    parser->comment = byte == '#';
+    return 0;
+  }
+
+  static inline int _qois_pnm_parse_pam_line(qois_pnm_parser *parser)
+  {
+    const char *line = parser->token;
+    size_t length = parser->token_length;
+
+    while (length > 0 && _qois_pnm_is_space((uint8_t)line[length - 1]))
+      length--;
+
+    size_t key_length = 0;
+    while (key_length < length && !_qois_pnm_is_space((uint8_t)line[key_length]))
+      key_length++;
+
+    size_t value_start = key_length;
+    while (value_start < length && _qois_pnm_is_space((uint8_t)line[value_start]))
+      value_start++;
+
+    const char *value = line + value_start;
+    size_t value_length = length - value_start;
+
+#define QOIS_PNM_KEY(name) (key_length == sizeof(name) - 1 && memcmp(line, name, key_length) == 0)
+    int result = 0;
+    if (QOIS_PNM_KEY("ENDHDR"))
+      result = _qois_pnm_finish(parser);
+    else if (QOIS_PNM_KEY("WIDTH"))
+      result = _qois_pnm_number(value, value_length, &parser->values[0]) ? 0 : -1;
+    else if (QOIS_PNM_KEY("HEIGHT"))
+      result = _qois_pnm_number(value, value_length, &parser->values[1]) ? 0 : -1;
+    else if (QOIS_PNM_KEY("MAXVAL"))
+      result = _qois_pnm_number(value, value_length, &parser->values[2]) ? 0 : -1;
+    else if (QOIS_PNM_KEY("DEPTH"))
+      result = _qois_pnm_number(value, value_length, &parser->depth) ? 0 : -1;
+    else if (!QOIS_PNM_KEY("TUPLTYPE"))
+      result = -1;
+#undef QOIS_PNM_KEY
+
+    parser->token_length = 0;
+    return result;
+  }
+
+  static inline int _qois_pnm_parse_pam(qois_pnm_parser *parser, uint8_t byte)
+  {
+    if (parser->comment)
+    {
+      parser->comment = byte != '\n';
+      return 0;
+    }
+
+    if (byte == '\n')
+      return parser->token_length > 0 ? _qois_pnm_parse_pam_line(parser) : 0;
+
+    // Leading whitespace is dropped, so empty lines and comments are recognized
+    if (parser->token_length == 0 && (byte == '#' || _qois_pnm_is_space(byte)))
+    {
+      parser->comment = byte == '#';
+      return 0;
+    }
+
+    if (parser->token_length == QOIS_PNM_TOKEN_SIZE)
+      return -1;
+    parser->token[parser->token_length++] = (char)byte;
+    return 0;
+  }
+
+  // Parses the header from the input, stopping at the first byte of the pixels.
+  // Returns 1 once the header is complete and the description is set, 0 if more input is needed,
+  // and -1 if the header is invalid or describes an image QOI can not hold.
+  static inline int qois_pnm_parse(qois_pnm_parser *parser, const uint8_t *input, size_t input_size,
+                                   size_t *consumed)
+  {
+    size_t input_pos = 0;
+    int result = parser->state == QOIS_STATE_DONE ? 1 : 0;
+
+    while (result == 0 && input_pos < input_size)
+    {
+      uint8_t byte = input[input_pos++];
+
+      if (parser->type == QOIS_PNM_NONE)
+        result = _qois_pnm_parse_magic(parser, byte);
+      else if (parser->type == QOIS_PNM_PPM)
+        result = _qois_pnm_parse_ppm(parser, byte);
+      else
+        result = _qois_pnm_parse_pam(parser, byte);
+    }
+
+    *consumed = result < 0 ? input_pos - 1 : input_pos;
+    return result;
+  }
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,315 @@
+#include "qoi-stream.h"
+#include "qoi-stream-target.h"
+
+#ifndef QOIS_STREAM_SCALE_H
+#define QOIS_STREAM_SCALE_H
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+  // Downscaling
+  //
+  // Decodes an image and averages every block of scale_x by scale_y pixels into a single pixel, for thumbnails.
+  // Decoded pixels are added to one row of sums right away, so memory is a row of sums and a row of pixels of
+  // the scaled image, whatever the size of the image. Runs are added at once instead of pixel by pixel.
+  // Blocks at the right and bottom edges may be smaller, they are averaged over the pixels they cover.
+
+  // Constants
+
+  // Pixels decoded at a time before they are added to the sums
+#define QOIS_SCALE_CHUNK 256
+
+  // Largest block side, so the sums of a block of opaque white pixels still fit in 32 bits
+#define QOIS_SCALE_MAX 4096
+
+  // Types
+
+  typedef struct _qois_scale_dec_state
+  {
+    qois_dec_state dec;
+    uint32_t scale_x;
+    uint32_t scale_y;
+
+    // The scaled image, set once the header is decoded
+    qois_desc desc;
+
+    // Caller provided, see qois_scale_dec_set_rows. The sums hold 4 channels for every pixel of a scaled row.
+    uint32_t *sums;
+    uint8_t *row;
+
+    // Position in the image, and the block the next pixel goes to with the pixels left in it
+    uint32_t x;
+    uint32_t y;
+    uint32_t block;
+    uint32_t block_left;
+
+    qois_row_callback callback;
+    void *user;
+
+    uint8_t chunk[QOIS_SCALE_CHUNK * sizeof(qois_pixel)];
+  } qois_scale_dec_state;
+
+  // Init functions
+
+  // The sums and the row may be NULL, decoding then stops after the header so they can be sized from state->desc.
+  // Channels overrides the channels of the scaled image when it is not 0. Both scales go from 1 to QOIS_SCALE_MAX.
+  void qois_scale_dec_state_init(qois_scale_dec_state *state, uint32_t scale_x, uint32_t scale_y, uint8_t channels,
+                                 uint32_t *sums, uint8_t *row, qois_row_callback callback, void *user)
+  {
+    qois_dec_state_init(&state->dec, 0);
+
+    state->scale_x = scale_x;
+    state->scale_y = scale_y;
+
+    _qois_desc_init(&state->desc);
+    state->desc.channels = channels;
+
+    state->sums = sums;
+    state->row = row;
+
+    state->x = 0;
+    state->y = 0;
+    state->block = 0;
+    state->block_left = 0;
+
+    state->callback = callback;
+    state->user = user;
+  }
+
+  // Util functions
+
+  static inline size_t qois_scale_sums_size(const qois_desc *desc)
+  {
+    return (size_t)desc->width * 4 * sizeof(uint32_t);
+  }
+
+  static inline size_t qois_scale_row_size(const qois_desc *desc)
+  {
+    return (size_t)desc->width * desc->channels;
+  }
+
+  static inline uint32_t _qois_scale_blocks(uint32_t size, uint32_t scale)
+  {
+    return size / scale + (size % scale != 0);
+  }
+
+  // Sets the sums and the row, before the first pixel is decoded
+  static inline void qois_scale_dec_set_rows(qois_scale_dec_state *state, uint32_t *sums, uint8_t *row)
+  {
+    state->sums = sums;
+    state->row = row;
+    memset(sums, 0, qois_scale_sums_size(&state->desc));
+  }
+
+  // Decode functions
+
+  // Averages the sums into the row and hands it to the callback, after the last image row of the block row
+  static inline int _qois_scale_emit_row(qois_scale_dec_state *state)
+  {
+    const uint32_t width = state->dec.desc.width;
+    const uint8_t channels = state->desc.channels;
+
+    uint32_t rows = state->y % state->scale_y;
+    if (rows == 0)
+      rows = state->scale_y;
+
+    uint32_t out_y = (state->y - 1) / state->scale_y;
+    uint8_t *row = state->row;
+    uint32_t *sums = state->sums;
+
+    for (uint32_t block = 0; block < state->desc.width; block++)
+    {
+      uint32_t x = block * state->scale_x;
+      uint32_t columns = width - x < state->scale_x ? width - x : state->scale_x;
+      uint32_t area = columns * rows;
+
+      for (uint8_t c = 0; c < channels; c++)
+        row[c] = (uint8_t)((sums[c] + area / 2) / area);
+
+      row += channels;
+      sums += 4;
+    }
+
+    memset(state->sums, 0, qois_scale_sums_size(&state->desc));
+    return state->callback(state->user, out_y, state->row, qois_scale_row_size(&state->desc));
+  }
+
+  // Moves past length pixels of the current block, finishing the block and the row when they are complete
+  static inline int _qois_scale_advance(qois_scale_dec_state *state, uint32_t length)
+  {
+    const qois_desc *image = &state->dec.desc;
+
+    state->x += length;
+    state->block_left -= length;
+    if (state->block_left > 0)
+      return 0;
+
+    if (state->x < image->width)
+    {
+      state->block++;
+      state->block_left = image->width - state->x < state->scale_x ? image->width - state->x : state->scale_x;
+      return 0;
+    }
+
+    state->x = 0;
+    state->y++;
+    state->block = 0;
+    state->block_left = image->width < state->scale_x ? image->width : state->scale_x;
+
+    if (state->y % state->scale_y == 0 || state->y == image->height)
+      return _qois_scale_emit_row(state);
+    return 0;
+  }
+
+  // Adds count decoded pixels with the channels of the image
+  static inline int _qois_scale_add(qois_scale_dec_state *state, const uint8_t *pixels, size_t count)
+  {
+    const uint8_t channels = state->dec.desc.channels;
+
+    while (count > 0)
+    {
+      uint32_t length = count < state->block_left ? (uint32_t)count : state->block_left;
+      uint32_t *sum = state->sums + (size_t)state->block * 4;
+
+      uint32_t r = 0, g = 0, b = 0, a = 0;
+      for (uint32_t i = 0; i < length; i++)
+      {
+        r += pixels[0];
+        g += pixels[1];
+        b += pixels[2];
+        a += channels == 4 ? pixels[3] : 0xff;
+        pixels += channels;
+      }
+
+      sum[0] += r;
+      sum[1] += g;
+      sum[2] += b;
+      sum[3] += a;
+
+      count -= length;
+      if (_qois_scale_advance(state, length) < 0)
+        return -1;
+    }
+
+    return 0;
+  }
+
+  // Adds count pixels of the same color
+  static inline int _qois_scale_add_run(qois_scale_dec_state *state, const qois_pixel *pixel, size_t count)
+  {
+    const uint32_t a = state->dec.desc.channels == 4 ? pixel->a : 0xff;
+
+    while (count > 0)
+    {
+      uint32_t length = count < state->block_left ? (uint32_t)count : state->block_left;
+      uint32_t *sum = state->sums + (size_t)state->block * 4;
+
+      sum[0] += pixel->r * length;
+      sum[1] += pixel->g * length;
+      sum[2] += pixel->b * length;
+      sum[3] += a * length;
+
+      count -= length;
+      if (_qois_scale_advance(state, length) < 0)
+        return -1;
+    }
+
+    return 0;
+  }
+
+  // Sets up the scaled image once the header of the image is decoded
+  static inline bool _qois_scale_start(qois_scale_dec_state *state)
+  {
+    const qois_desc *image = &state->dec.desc;
+
+    if (state->scale_x == 0 || state->scale_y == 0 || state->scale_x > QOIS_SCALE_MAX ||
+        state->scale_y > QOIS_SCALE_MAX)
+      return false;
+
+    state->desc.width = _qois_scale_blocks(image->width, state->scale_x);
+    state->desc.height = _qois_scale_blocks(image->height, state->scale_y);
+    if (state->desc.channels == 0)
+      state->desc.channels = image->channels;
+    state->desc.colorspace = image->colorspace;
+
+    state->block_left = image->width < state->scale_x ? image->width : state->scale_x;
+    if (state->sums)
+      memset(state->sums, 0, qois_scale_sums_size(&state->desc));
+    return true;
+  }
+
+  // Decodes the input and calls the callback with every completed row of the scaled image.
+  // Returns 0, or -1 on error.
+  static inline int qois_scale_decode_buffer(qois_scale_dec_state *state, const uint8_t *input, size_t input_size,
+                                             size_t *consumed)
+  {
+    qois_dec_state *dec = &state->dec;
+    const size_t chunk_size = sizeof(state->chunk) / sizeof(qois_pixel) * dec->desc.channels;
+    size_t input_pos = 0;
+
+    // The header is decoded a byte at a time, so decoding can stop right after it
+    while (input_pos < input_size && dec->state == QOIS_STATE_HEADER)
+    {
+      size_t used = 0;
+      if (qois_decode_buffer(dec, input + input_pos, 1, state->chunk, 0, &used) < 0)
+      {
+        *consumed = input_pos;
+        return -1;
+      }
+      input_pos += used;
+
+      if (dec->state != QOIS_STATE_HEADER && !_qois_scale_start(state))
+      {
+        *consumed = input_pos;
+        return -1;
+      }
+    }
+
+    while (dec->state != QOIS_STATE_HEADER && dec->state != QOIS_STATE_DONE && state->sums && state->row)
+    {
+      size_t used = 0;
+      int outputted = qois_decode_buffer(dec, input + input_pos, input_size - input_pos, state->chunk,
+                                         (size_t)chunk_size, &used);
+      input_pos += used;
+      if (outputted < 0 || _qois_scale_add(state, state->chunk, (size_t)outputted / dec->desc.channels) < 0)
+      {
+        *consumed = input_pos;
+        return -1;
+      }
+
+      // The rest of a run that did not fit in the chunk is added without writing it out, like qois_decode_flush
+      bool run = dec->run_remaining > 0;
+      if (run)
+      {
+        size_t count = dec->run_remaining;
+        dec->run_remaining = 0;
+        dec->pixels_out += count;
+        if (dec->pixels_out >= dec->pixels_count)
+        {
+          dec->state = QOIS_STATE_FOOTER;
+          dec->op_position = 0;
+        }
+
+        if (_qois_scale_add_run(state, &dec->current_pixel, count) < 0)
+        {
+          *consumed = input_pos;
+          return -1;
+        }
+      }
+
+      // Without a full chunk or a run the decoder needs more input
+      if (!run && (size_t)outputted < chunk_size)
+        break;
+    }
+
+    *consumed = input_pos;
+    return 0;
+  }
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
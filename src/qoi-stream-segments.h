@@ -0,0 +1,496 @@
+#include "qoi-stream.h"
+
+#ifndef QOIS_STREAM_SEGMENTS_H
+#define QOIS_STREAM_SEGMENTS_H
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+  // Segmented container
+  //
+  // The image is split into segments of a fixed amount of rows. Every segment is stored as a complete
+  // QOI image, encoded with a freshly initialized encoder state, so each segment can be encoded and
+  // decoded independently of the others (for example on separate cores) and the results concatenated.
+  //
+  // Layout: qois_seg_header, the segments back to back, then a table with for every segment
+  // its byte offset in the container and the offset of its first pixel in the image.
+  // The table size follows from the header, so it can be found from the end of the file.
+
+  // Constants
+
+  static const uint8_t qois_seg_magic[4] = {'q', 'o', 'i', 's'};
+
+  // Types
+
+  typedef struct __attribute__((packed)) _qois_seg_header
+  {
+    uint8_t magic[4];
+    uint32_t width;  // Big endian
+    uint32_t height; // Big endian
+    uint8_t channels;
+    uint8_t colorspace;
+    uint32_t segment_rows; // Big endian
+  } qois_seg_header;
+
+  typedef struct __attribute__((packed)) _qois_seg_table_entry
+  {
+    uint64_t byte_offset;  // Big endian
+    uint64_t pixel_offset; // Big endian
+  } qois_seg_table_entry;
+
+  typedef struct _qois_seg_info
+  {
+    qois_desc desc;
+    uint32_t segment_rows;
+    uint32_t segment_count;
+  } qois_seg_info;
+
+  typedef struct _qois_seg_entry
+  {
+    uint64_t byte_offset;
+    uint64_t pixel_offset;
+  } qois_seg_entry;
+
+  typedef struct _qois_seg_enc_state
+  {
+    qois_seg_info info;
+    qois_state state;
+
+    uint32_t segment;
+    uint64_t bytes_out;
+
+    // Caller provided, holds segment_count entries
+    qois_seg_entry *table;
+
+    qois_enc_state enc;
+
+#ifdef QOIS_STATS
+    // Statistics of the finished segments
+    qois_stats stats;
+#endif
+  } qois_seg_enc_state;
+
+  typedef struct _qois_seg_dec_state
+  {
+    qois_seg_info info;
+    qois_state state;
+
+    uint8_t channels;
+    uint8_t header_position;
+    uint8_t header[sizeof(qois_seg_header)];
+
+    uint32_t segment;
+    uint64_t table_left;
+
+    qois_dec_state dec;
+
+#ifdef QOIS_STATS
+    // Statistics of the finished segments
+    qois_stats stats;
+#endif
+  } qois_seg_dec_state;
+
+  // Util functions
+
+  static inline void qois_seg_info_init(qois_seg_info *info,
+                                        uint32_t width, uint32_t height, uint8_t channels, uint8_t colorspace,
+                                        uint32_t segment_rows)
+  {
+    info->desc.width = width;
+    info->desc.height = height;
+    info->desc.channels = channels;
+    info->desc.colorspace = colorspace;
+    info->segment_rows = segment_rows;
+    info->segment_count = segment_rows > 0 ? (uint32_t)(((uint64_t)height + segment_rows - 1) / segment_rows) : 0;
+  }
+
+  // Amount of rows in the given segment, only the last segment can be shorter
+  static inline uint32_t qois_seg_rows(const qois_seg_info *info, uint32_t segment)
+  {
+    uint32_t first_row = segment * info->segment_rows;
+    uint32_t rows_left = info->desc.height - first_row;
+    return rows_left < info->segment_rows ? rows_left : info->segment_rows;
+  }
+
+  static inline uint64_t qois_seg_pixel_offset(const qois_seg_info *info, uint32_t segment)
+  {
+    return (uint64_t)segment * info->segment_rows * info->desc.width;
+  }
+
+  static inline size_t qois_seg_table_size(const qois_seg_info *info)
+  {
+    return (size_t)info->segment_count * sizeof(qois_seg_table_entry);
+  }
+
+  static inline bool qois_is_qoi_segmented(const uint8_t *data, size_t size)
+  {
+    if (size < sizeof(qois_seg_header))
+      return false;
+
+    qois_seg_header *header = (qois_seg_header *)data;
+    return memcmp(header->magic, qois_seg_magic, sizeof(qois_seg_magic)) == 0;
+  }
+
+  static inline int qois_seg_write_header(const qois_seg_info *info, uint8_t *output, size_t output_size)
+  {
+    ASSERT_OUTPUT_AVAILABLE(sizeof(qois_seg_header));
+
+    qois_seg_header *header = (qois_seg_header *)output;
+
+    memcpy(header->magic, qois_seg_magic, sizeof(qois_seg_magic));
+
+    header->width = NATIVE_TO_BIG_ENDIAN(info->desc.width);
+    header->height = NATIVE_TO_BIG_ENDIAN(info->desc.height);
+    header->channels = info->desc.channels;
+    header->colorspace = info->desc.colorspace;
+    header->segment_rows = NATIVE_TO_BIG_ENDIAN(info->segment_rows);
+
+    return sizeof(qois_seg_header);
+  }
+
+  static inline bool qois_seg_read_header(const uint8_t *data, size_t size, qois_seg_info *info)
+  {
+    if (!qois_is_qoi_segmented(data, size))
+      return false;
+
+    qois_seg_header *header = (qois_seg_header *)data;
+    qois_seg_info_init(info,
+                       BIG_ENDIAN_TO_NATIVE(header->width), BIG_ENDIAN_TO_NATIVE(header->height),
+                       header->channels, header->colorspace,
+                       BIG_ENDIAN_TO_NATIVE(header->segment_rows));
+
+    if (info->desc.channels != 3 && info->desc.channels != 4)
+      return false;
+    if (info->desc.colorspace != 0 && info->desc.colorspace != 1)
+      return false;
+    if (info->segment_rows == 0 && info->desc.height != 0)
+      return false;
+
+    return true;
+  }
+
+  static inline int qois_seg_write_table(const qois_seg_info *info, const qois_seg_entry *table,
+                                         uint8_t *output, size_t output_size)
+  {
+    if (qois_seg_table_size(info) > INT_MAX)
+      return -1;
+    ASSERT_OUTPUT_AVAILABLE(qois_seg_table_size(info));
+
+    for (uint32_t i = 0; i < info->segment_count; i++)
+    {
+      qois_seg_table_entry entry;
+      entry.byte_offset = NATIVE_TO_BIG_ENDIAN_64(table[i].byte_offset);
+      entry.pixel_offset = NATIVE_TO_BIG_ENDIAN_64(table[i].pixel_offset);
+
+      memcpy(output + i * sizeof(entry), &entry, sizeof(entry));
+    }
+
+    return (int)qois_seg_table_size(info);
+  }
+
+  // Reads the table at the end of a container of container_size bytes, data points to the table itself.
+  // Returns false if the table does not describe a valid layout of the container.
+  static inline bool qois_seg_read_table(const qois_seg_info *info, const uint8_t *data, size_t size,
+                                         uint64_t container_size, qois_seg_entry *table)
+  {
+    if (size < qois_seg_table_size(info) || container_size < sizeof(qois_seg_header) + qois_seg_table_size(info))
+      return false;
+
+    uint64_t table_offset = container_size - qois_seg_table_size(info);
+    uint64_t next_offset = sizeof(qois_seg_header);
+
+    for (uint32_t i = 0; i < info->segment_count; i++)
+    {
+      qois_seg_table_entry entry;
+      memcpy(&entry, data + i * sizeof(entry), sizeof(entry));
+
+      table[i].byte_offset = BIG_ENDIAN_TO_NATIVE_64(entry.byte_offset);
+      table[i].pixel_offset = BIG_ENDIAN_TO_NATIVE_64(entry.pixel_offset);
+
+      // Segments follow each other directly and each one holds at least a header and footer
+      if (table[i].byte_offset != next_offset || table[i].pixel_offset != qois_seg_pixel_offset(info, i))
+        return false;
+      if (i + 1 < info->segment_count)
+      {
+        memcpy(&entry, data + (i + 1) * sizeof(entry), sizeof(entry));
+        next_offset = BIG_ENDIAN_TO_NATIVE_64(entry.byte_offset);
+      }
+      else
+        next_offset = table_offset;
+
+      if (next_offset < table[i].byte_offset + sizeof(qois_header) + sizeof(qois_end_magic))
+        return false;
+    }
+
+    return next_offset == table_offset;
+  }
+
+  // Size in bytes of the given segment, the table is needed to know where it ends
+  static inline uint64_t qois_seg_size(const qois_seg_info *info, const qois_seg_entry *table, uint32_t segment,
+                                       uint64_t container_size)
+  {
+    uint64_t end = segment + 1 < info->segment_count
+                       ? table[segment + 1].byte_offset
+                       : container_size - qois_seg_table_size(info);
+    return end - table[segment].byte_offset;
+  }
+
+  // Encode functions
+
+  // The table must hold segment_count entries (see qois_seg_info_init), it is filled while encoding
+  void qois_seg_enc_state_init(qois_seg_enc_state *state,
+                               uint32_t width, uint32_t height, uint8_t channels, uint8_t colorspace,
+                               uint32_t segment_rows, qois_seg_entry *table)
+  {
+    qois_seg_info_init(&state->info, width, height, channels, colorspace, segment_rows);
+
+    state->state = QOIS_STATE_HEADER;
+    state->segment = 0;
+    state->bytes_out = 0;
+    state->table = table;
+
+#ifdef QOIS_STATS
+    qois_stats_reset(&state->stats);
+#endif
+  }
+
+  // Returns the maximum amount of bytes qois_seg_encode_pixels can output for the given amount of pixels
+  static inline size_t qois_seg_encode_pixels_bound(const qois_seg_enc_state *state, size_t pixel_count)
+  {
+    size_t segment_pixels = (size_t)state->info.segment_rows * state->info.desc.width;
+    size_t segments = segment_pixels > 0 ? pixel_count / segment_pixels + 2 : 1;
+
+    return sizeof(qois_seg_header) +
+           segments * (sizeof(qois_header) + sizeof(qois_end_magic)) +
+           pixel_count * (size_t)(state->info.desc.channels + 2) +
+           qois_seg_table_size(&state->info);
+  }
+
+  static inline void _qois_seg_start_segment(qois_seg_enc_state *state)
+  {
+    state->table[state->segment].byte_offset = state->bytes_out;
+    state->table[state->segment].pixel_offset = qois_seg_pixel_offset(&state->info, state->segment);
+
+#ifdef QOIS_STATS
+    if (state->segment > 0)
+      qois_stats_add(&state->stats, &state->enc.stats);
+#endif
+
+    qois_enc_state_init(&state->enc, state->info.desc.width, qois_seg_rows(&state->info, state->segment),
+                        state->info.desc.channels, state->info.desc.colorspace);
+  }
+
+  // Encodes a span of whole pixels into the container, starting new segments as needed.
+  // Returns the amount of bytes written, or -1 on error.
+  static inline int qois_seg_encode_pixels(qois_seg_enc_state *state, const uint8_t *pixels, size_t pixel_count,
+                                           uint8_t *output, size_t output_size)
+  {
+    if (qois_seg_encode_pixels_bound(state, pixel_count) > INT_MAX)
+      return -1;
+    ASSERT_OUTPUT_AVAILABLE(qois_seg_encode_pixels_bound(state, pixel_count));
+
+    int outputted = 0;
+
+    if (state->state == QOIS_STATE_HEADER)
+    {
+      int result = qois_seg_write_header(&state->info, output, output_size);
+      if (result < 0)
+        return result;
+
+      outputted += result;
+      state->bytes_out += (uint64_t)result;
+      PROGRESS_OUTPUT(result);
+
+      if (state->info.segment_count > 0)
+      {
+        _qois_seg_start_segment(state);
+        state->state = QOIS_OP_NONE;
+      }
+      else
+        state->state = QOIS_STATE_FOOTER;
+    }
+
+    while (state->state == QOIS_OP_NONE)
+    {
+      size_t segment_left = state->enc.pixels_count - state->enc.pixels_in;
+      size_t count = pixel_count < segment_left ? pixel_count : segment_left;
+
+      int result = qois_encode_pixels(&state->enc, pixels, count, output, output_size);
+      if (result < 0)
+        return result;
+
+      outputted += result;
+      state->bytes_out += (uint64_t)result;
+      PROGRESS_OUTPUT(result);
+
+      pixels += count * state->info.desc.channels;
+      pixel_count -= count;
+
+      if (state->enc.state != QOIS_STATE_DONE)
+        break;
+
+      state->segment++;
+      if (state->segment < state->info.segment_count)
+        _qois_seg_start_segment(state);
+      else
+        state->state = QOIS_STATE_FOOTER;
+    }
+
+    if (state->state == QOIS_STATE_FOOTER)
+    {
+      int result = qois_seg_write_table(&state->info, state->table, output, output_size);
+      if (result < 0)
+        return result;
+
+      outputted += result;
+      state->bytes_out += (uint64_t)result;
+
+      state->state = QOIS_STATE_DONE;
+    }
+
+    return outputted;
+  }
+
+  // Decode functions
+
+  void qois_seg_dec_state_init(qois_seg_dec_state *state, uint8_t channels)
+  {
+    qois_seg_info_init(&state->info, 0, 0, 0, 0, 0);
+
+    state->state = QOIS_STATE_HEADER;
+    state->channels = channels;
+    state->header_position = 0;
+    state->segment = 0;
+    state->table_left = 0;
+
+#ifdef QOIS_STATS
+    qois_stats_reset(&state->stats);
+#endif
+  }
+
+  // Decodes a container front to back on a single stream, the same way as qois_decode_buffer.
+  // The segment table at the end is skipped.
+  static inline int qois_seg_decode_buffer(qois_seg_dec_state *state, const uint8_t *input, size_t input_size,
+                                           uint8_t *output, size_t output_size, size_t *consumed)
+  {
+    size_t input_pos = 0;
+    size_t output_pos = 0;
+
+    if (output_size > INT_MAX)
+      output_size = INT_MAX;
+
+    while (input_pos < input_size && state->state != QOIS_STATE_DONE)
+    {
+      if (state->state == QOIS_STATE_HEADER)
+      {
+        state->header[state->header_position++] = input[input_pos++];
+        if (state->header_position < sizeof(qois_seg_header))
+          continue;
+
+        if (!qois_seg_read_header(state->header, sizeof(state->header), &state->info))
+        {
+          *consumed = input_pos - 1;
+          return -1;
+        }
+
+        state->table_left = qois_seg_table_size(&state->info);
+        if (state->info.segment_count > 0)
+        {
+          qois_dec_state_init(&state->dec, state->channels);
+          state->state = QOIS_OP_NONE;
+        }
+        else
+          state->state = QOIS_STATE_FOOTER;
+      }
+      else if (state->state == QOIS_OP_NONE)
+      {
+        size_t used = 0;
+        int result = qois_decode_buffer(&state->dec, input + input_pos, input_size - input_pos,
+                                        output + output_pos, output_size - output_pos, &used);
+        if (result < 0)
+        {
+          *consumed = input_pos + used;
+          return -1;
+        }
+
+        input_pos += used;
+        output_pos += (size_t)result;
+
+        if (state->dec.state != QOIS_STATE_DONE)
+          break;
+
+        // Every segment has to match its place in the container
+        if (state->dec.desc.width != state->info.desc.width ||
+            state->dec.desc.height != qois_seg_rows(&state->info, state->segment))
+        {
+          *consumed = input_pos;
+          return -1;
+        }
+
+        state->segment++;
+        if (state->segment < state->info.segment_count)
+        {
+#ifdef QOIS_STATS
+          qois_stats_add(&state->stats, &state->dec.stats);
+#endif
+          qois_dec_state_init(&state->dec, state->channels);
+        }
+        else
+          state->state = QOIS_STATE_FOOTER;
+      }
+      else
+      {
+        size_t skip = input_size - input_pos;
+        if (skip > state->table_left)
+          skip = (size_t)state->table_left;
+
+        input_pos += skip;
+        state->table_left -= skip;
+      }
+
+      if (state->state == QOIS_STATE_FOOTER && state->table_left == 0)
+        state->state = QOIS_STATE_DONE;
+    }
+
+    *consumed = input_pos;
+    return (int)output_pos;
+  }
+
+#ifdef QOIS_STATS
+  // Statistics functions
+
+  // The statistics of all segments so far, including the one in progress
+  static inline void qois_seg_enc_get_stats(const qois_seg_enc_state *state, qois_stats *stats)
+  {
+    *stats = state->stats;
+    if (state->state != QOIS_STATE_HEADER && state->info.segment_count > 0)
+      qois_stats_add(stats, &state->enc.stats);
+  }
+
+  static inline void qois_seg_enc_reset_stats(qois_seg_enc_state *state)
+  {
+    qois_stats_reset(&state->stats);
+    qois_stats_reset(&state->enc.stats);
+  }
+
+  static inline void qois_seg_dec_get_stats(const qois_seg_dec_state *state, qois_stats *stats)
+  {
+    *stats = state->stats;
+    if (state->state != QOIS_STATE_HEADER && state->info.segment_count > 0)
+      qois_stats_add(stats, &state->dec.stats);
+  }
+
+  static inline void qois_seg_dec_reset_stats(qois_seg_dec_state *state)
+  {
+    qois_stats_reset(&state->stats);
+    qois_stats_reset(&state->dec.stats);
+  }
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,650 @@
+#include "qoi-stream.h"
+
+#ifndef QOIS_STREAM_SEQUENCE_H
+#define QOIS_STREAM_SEQUENCE_H
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+  // Frame sequences
+  //
+  // A sequence of frames of the same size, for video or screen captures. The cache and the last pixel
+  // carry over from one frame to the next, and rows are compared with the previous frame. Only the span
+  // from the first to the last changed pixel of a row is encoded, unchanged rows take a single byte.
+  // Key frames encode every row in full with a fresh cache, so decoding can start at any key frame.
+  //
+  // Layout: qois_seq_header, then every frame as a frame tag followed by height rows, ended by QOIS_SEQ_END.
+  // A row is either QOIS_SEQ_ROW_SAME, or QOIS_SEQ_ROW_SPAN followed by the first changed pixel and
+  // the length of the span (both 32 bit big endian), and then the QOI ops of the pixels in the span.
+  // Runs never cross the end of a span. Before the first frame the previous frame is all zero bytes.
+
+  // Constants
+
+  static const uint8_t qois_seq_magic[4] = {'q', 'o', 'i', 'v'};
+
+#define QOIS_SEQ_END 0x00
+#define QOIS_SEQ_FRAME 0x01
+#define QOIS_SEQ_KEY_FRAME 0x02
+
+#define QOIS_SEQ_ROW_SAME 0x00
+#define QOIS_SEQ_ROW_SPAN 0x01
+
+  // Types
+
+  typedef struct __attribute__((packed)) _qois_seq_header
+  {
+    uint8_t magic[4];
+    uint32_t width;  // Big endian
+    uint32_t height; // Big endian
+    uint8_t channels;
+    uint8_t colorspace;
+  } qois_seq_header;
+
+  // Part of the sequence the decoder is in, between the header and the end
+  typedef enum _qois_seq_part
+  {
+    QOIS_SEQ_PART_FRAME = 0,
+    QOIS_SEQ_PART_ROW,
+    QOIS_SEQ_PART_SPAN,
+    QOIS_SEQ_PART_OPS,
+  } qois_seq_part;
+
+  // Changed area of the last frame, empty when x0 == x1
+  typedef struct _qois_seq_rect
+  {
+    uint32_t x0;
+    uint32_t y0;
+    uint32_t x1;
+    uint32_t y1;
+  } qois_seq_rect;
+
+  typedef struct _qois_seq_enc_state
+  {
+    qois_desc desc;
+    qois_state state;
+
+    bool in_frame;
+    bool key_frame;
+    uint32_t y;
+    uint32_t frames;
+
+    // Caller provided, holds the previous frame as width * height * channels bytes
+    uint8_t *previous;
+
+    qois_enc_state enc;
+  } qois_seq_enc_state;
+
+  typedef struct _qois_seq_dec_state
+  {
+    qois_desc desc;
+    qois_state state;
+    qois_seq_part part;
+
+    uint8_t header_position;
+    uint8_t header[sizeof(qois_seq_header)];
+    uint8_t span_position;
+    uint8_t span[8];
+
+    uint32_t y;
+    uint32_t x0;
+    uint32_t frames;
+
+    // Caller provided, holds the frame as width * height * channels bytes, see qois_seq_dec_set_frame
+    uint8_t *frame;
+    size_t frame_size;
+
+    qois_seq_rect changed;
+
+    qois_dec_state dec;
+  } qois_seq_dec_state;
+
+  // Util functions
+
+  static inline size_t qois_seq_frame_size(const qois_desc *desc)
+  {
+    return (size_t)desc->width * desc->height * desc->channels;
+  }
+
+  static inline bool qois_is_qoi_sequence(const uint8_t *data, size_t size)
+  {
+    if (size < sizeof(qois_seq_header))
+      return false;
+
+    qois_seq_header *header = (qois_seq_header *)data;
+    return memcmp(header->magic, qois_seq_magic, sizeof(qois_seq_magic)) == 0;
+  }
+
+  static inline int qois_seq_write_header(const qois_desc *desc, uint8_t *output, size_t output_size)
+  {
+    ASSERT_OUTPUT_AVAILABLE(sizeof(qois_seq_header));
+
+    qois_seq_header *header = (qois_seq_header *)output;
+
+    memcpy(header->magic, qois_seq_magic, sizeof(qois_seq_magic));
+
+    header->width = NATIVE_TO_BIG_ENDIAN(desc->width);
+    header->height = NATIVE_TO_BIG_ENDIAN(desc->height);
+    header->channels = desc->channels;
+    header->colorspace = desc->colorspace;
+
+    return sizeof(qois_seq_header);
+  }
+
+  static inline bool qois_seq_read_header(const uint8_t *data, size_t size, qois_desc *desc)
+  {
+    if (!qois_is_qoi_sequence(data, size))
+      return false;
+
+    qois_seq_header *header = (qois_seq_header *)data;
+    desc->width = BIG_ENDIAN_TO_NATIVE(header->width);
+    desc->height = BIG_ENDIAN_TO_NATIVE(header->height);
+    desc->channels = header->channels;
+    desc->colorspace = header->colorspace;
+
+    if (desc->channels != 3 && desc->channels != 4)
+      return false;
+    if (desc->colorspace != 0 && desc->colorspace != 1)
+      return false;
+
+    return true;
+  }
+
+  // Finds the pixels from x0 up to x1 of the row that differ from the previous row.
+  // Returns false if the rows are the same.
+  static inline bool _qois_seq_row_span(const uint8_t *row, const uint8_t *previous, uint32_t width,
+                                        uint8_t channels, uint32_t *x0, uint32_t *x1)
+  {
+    size_t size = (size_t)width * channels;
+    size_t first = 0;
+    size_t last = size;
+
+    // Compare 8 bytes at a time from both ends, then narrow down to the byte
+    for (; first + 8 <= size; first += 8)
+    {
+      uint64_t a, b;
+      memcpy(&a, row + first, sizeof(a));
+      memcpy(&b, previous + first, sizeof(b));
+      if (a != b)
+        break;
+    }
+    while (first < size && row[first] == previous[first])
+      first++;
+
+    if (first == size)
+      return false;
+
+    for (; last >= first + 8; last -= 8)
+    {
+      uint64_t a, b;
+      memcpy(&a, row + last - 8, sizeof(a));
+      memcpy(&b, previous + last - 8, sizeof(b));
+      if (a != b)
+        break;
+    }
+    while (row[last - 1] == previous[last - 1])
+      last--;
+
+    *x0 = (uint32_t)(first / channels);
+    *x1 = (uint32_t)((last - 1) / channels + 1);
+    return true;
+  }
+
+  static inline void _qois_seq_reset_pixels(qois_pixel *current_pixel, qois_pixel *last_pixel, qois_pixel *cache)
+  {
+    _qois_pixel_init(current_pixel);
+    _qois_pixel_init(last_pixel);
+    memset(cache, 0, sizeof(qois_pixel) * 64);
+  }
+
+  // Encode functions
+
+  // The previous frame must hold qois_seq_frame_size bytes, it is cleared here and kept up to date while encoding
+  void qois_seq_enc_state_init(qois_seq_enc_state *state,
+                               uint32_t width, uint32_t height, uint8_t channels, uint8_t colorspace,
+                               uint8_t *previous)
+  {
+    state->desc.width = width;
+    state->desc.height = height;
+    state->desc.channels = channels;
+    state->desc.colorspace = colorspace;
+
+    state->state = QOIS_STATE_HEADER;
+    state->in_frame = false;
+    state->key_frame = false;
+    state->y = 0;
+    state->frames = 0;
+    state->previous = previous;
+
+    memset(previous, 0, qois_seq_frame_size(&state->desc));
+
+    // The pixel count is set for every span
+    qois_enc_state_init(&state->enc, width, height, channels, colorspace);
+    state->enc.state = QOIS_OP_NONE;
+  }
+
+  // Returns the maximum amount of bytes qois_seq_encode_row can output
+  static inline size_t qois_seq_encode_row_bound(const qois_seq_enc_state *state)
+  {
+    return 1 + 8 + (size_t)state->desc.width * (size_t)(state->desc.channels + 2);
+  }
+
+  // Returns the maximum amount of bytes qois_seq_encode_frame can output
+  static inline size_t qois_seq_encode_frame_bound(const qois_seq_enc_state *state)
+  {
+    return sizeof(qois_seq_header) + 1 + (size_t)state->desc.height * qois_seq_encode_row_bound(state);
+  }
+
+  // Starts the next frame, writing the sequence header first if needed. A key frame encodes every row
+  // in full and starts with a fresh cache. Returns the amount of bytes written, or -1 on error.
+  static inline int qois_seq_begin_frame(qois_seq_enc_state *state, bool key_frame, uint8_t *output, size_t output_size)
+  {
+    if (state->in_frame || state->state == QOIS_STATE_DONE)
+      return -1;
+
+    ASSERT_OUTPUT_AVAILABLE(sizeof(qois_seq_header) + 1);
+
+    int outputted = 0;
+
+    if (state->state == QOIS_STATE_HEADER)
+    {
+      int result = qois_seq_write_header(&state->desc, output, output_size);
+      if (result < 0)
+        return result;
+
+      outputted += result;
+      PROGRESS_OUTPUT(result);
+
+      state->state = QOIS_OP_NONE;
+    }
+
+    output[0] = key_frame ? QOIS_SEQ_KEY_FRAME : QOIS_SEQ_FRAME;
+    outputted += 1;
+
+    if (key_frame)
+      _qois_seq_reset_pixels(&state->enc.current_pixel, &state->enc.last_pixel, state->enc.cache);
+
+    state->in_frame = state->desc.height > 0;
+    state->key_frame = key_frame;
+    state->y = 0;
+    state->frames++;
+
+    return outputted;
+  }
+
+  // Encodes the next row of the frame, the row holds width pixels in the channel layout of the sequence.
+  // Returns the amount of bytes written, or -1 on error. The output must hold qois_seq_encode_row_bound.
+  static inline int qois_seq_encode_row(qois_seq_enc_state *state, const uint8_t *row,
+                                        uint8_t *output, size_t output_size)
+  {
+    if (!state->in_frame)
+      return -1;
+
+    if (qois_seq_encode_row_bound(state) > INT_MAX)
+      return -1;
+    ASSERT_OUTPUT_AVAILABLE(qois_seq_encode_row_bound(state));
+
+    const uint8_t channels = state->desc.channels;
+    uint8_t *previous = state->previous + (size_t)state->y * state->desc.width * channels;
+
+    uint32_t x0 = 0;
+    uint32_t x1 = state->desc.width;
+    bool changed = state->key_frame || _qois_seq_row_span(row, previous, state->desc.width, channels, &x0, &x1);
+
+    if (++state->y == state->desc.height)
+      state->in_frame = false;
+
+    if (!changed || x0 == x1)
+    {
+      output[0] = QOIS_SEQ_ROW_SAME;
+      return 1;
+    }
+
+    output[0] = QOIS_SEQ_ROW_SPAN;
+    uint32_t x0_big = NATIVE_TO_BIG_ENDIAN(x0);
+    uint32_t length_big = NATIVE_TO_BIG_ENDIAN(x1 - x0);
+    memcpy(output + 1, &x0_big, sizeof(x0_big));
+    memcpy(output + 5, &length_big, sizeof(length_big));
+
+    int outputted = 9;
+    PROGRESS_OUTPUT(9);
+
+    // The span is encoded as if it were a whole image, so its last run is written at its end
+    const uint8_t *pixels = row + (size_t)x0 * channels;
+    state->enc.pixels_in = 0;
+    state->enc.pixels_count = x1 - x0;
+
+    int result = channels == 3
+                     ? _qois_encode_span_3(&state->enc, pixels, x1 - x0, output, output_size)
+                     : _qois_encode_span_4(&state->enc, pixels, x1 - x0, output, output_size);
+    if (result < 0)
+      return result;
+
+    memcpy(previous + (size_t)x0 * channels, pixels, (size_t)(x1 - x0) * channels);
+
+    return outputted + result;
+  }
+
+  // Encodes a whole frame with the given row pitch, see qois_seq_begin_frame.
+  // Returns the amount of bytes written, or -1 on error. The output must hold qois_seq_encode_frame_bound.
+  static inline int qois_seq_encode_frame(qois_seq_enc_state *state, const uint8_t *pixels, size_t pitch,
+                                          bool key_frame, uint8_t *output, size_t output_size)
+  {
+    if (qois_seq_encode_frame_bound(state) > INT_MAX)
+      return -1;
+    ASSERT_OUTPUT_AVAILABLE(qois_seq_encode_frame_bound(state));
+
+    int outputted = qois_seq_begin_frame(state, key_frame, output, output_size);
+    if (outputted < 0)
+      return outputted;
+    PROGRESS_OUTPUT(outputted);
+
+    for (uint32_t y = 0; y < state->desc.height; y++)
+    {
+      int result = qois_seq_encode_row(state, pixels + (size_t)y * pitch, output, output_size);
+      if (result < 0)
+        return result;
+
+      outputted += result;
+      PROGRESS_OUTPUT(result);
+    }
+
+    return outputted;
+  }
+
+  // Ends the sequence, writing the header first if there were no frames. Returns the amount of bytes written.
+  static inline int qois_seq_end(qois_seq_enc_state *state, uint8_t *output, size_t output_size)
+  {
+    if (state->in_frame || state->state == QOIS_STATE_DONE)
+      return -1;
+
+    ASSERT_OUTPUT_AVAILABLE(sizeof(qois_seq_header) + 1);
+
+    int outputted = 0;
+
+    if (state->state == QOIS_STATE_HEADER)
+    {
+      int result = qois_seq_write_header(&state->desc, output, output_size);
+      if (result < 0)
+        return result;
+
+      outputted += result;
+      PROGRESS_OUTPUT(result);
+    }
+
+    output[0] = QOIS_SEQ_END;
+    state->state = QOIS_STATE_DONE;
+
+    return outputted + 1;
+  }
+
+  // Decode functions
+
+  // The frame may be NULL, decoding then stops after the header so the frame can be sized from state->desc
+  void qois_seq_dec_state_init(qois_seq_dec_state *state, uint8_t *frame, size_t frame_size)
+  {
+    _qois_desc_init(&state->desc);
+
+    state->state = QOIS_STATE_HEADER;
+    state->part = QOIS_SEQ_PART_FRAME;
+    state->header_position = 0;
+    state->span_position = 0;
+    state->y = 0;
+    state->x0 = 0;
+    state->frames = 0;
+    state->frame = frame;
+    state->frame_size = frame_size;
+
+    state->changed.x0 = state->changed.y0 = state->changed.x1 = state->changed.y1 = 0;
+
+    qois_dec_state_init(&state->dec, 0);
+  }
+
+  // Sets the frame before the first frame is decoded, it is cleared to match the start of the sequence
+  static inline void qois_seq_dec_set_frame(qois_seq_dec_state *state, uint8_t *frame, size_t frame_size)
+  {
+    state->frame = frame;
+    state->frame_size = frame_size;
+
+    if (frame && frame_size >= qois_seq_frame_size(&state->desc))
+      memset(frame, 0, qois_seq_frame_size(&state->desc));
+  }
+
+  static inline void _qois_seq_grow_rect(qois_seq_rect *rect, uint32_t x0, uint32_t y, uint32_t x1)
+  {
+    if (rect->x0 == rect->x1)
+    {
+      rect->x0 = x0;
+      rect->x1 = x1;
+      rect->y0 = y;
+    }
+    else
+    {
+      rect->x0 = x0 < rect->x0 ? x0 : rect->x0;
+      rect->x1 = x1 > rect->x1 ? x1 : rect->x1;
+    }
+    rect->y1 = y + 1;
+  }
+
+  // Moves on to the next row, returns true when the frame is complete
+  static inline bool _qois_seq_next_row(qois_seq_dec_state *state)
+  {
+    state->part = QOIS_SEQ_PART_ROW;
+    if (++state->y < state->desc.height)
+      return false;
+
+    state->part = QOIS_SEQ_PART_FRAME;
+    state->frames++;
+    return true;
+  }
+
+  // Decodes the ops of the current span straight into its place in the frame
+  static inline int _qois_seq_decode_span(qois_seq_dec_state *state, const uint8_t *input, size_t input_size,
+                                          size_t *consumed)
+  {
+    qois_dec_state *dec = &state->dec;
+    const uint8_t channels = state->desc.channels;
+    uint8_t *span = state->frame + ((size_t)state->y * state->desc.width + state->x0) * channels;
+
+    size_t input_pos = 0;
+
+    while (input_pos < input_size && dec->pixels_out < dec->pixels_count)
+    {
+      // The output ends with the span, so runs always fit and never leave pixels pending
+      uint8_t *output = span + dec->pixels_out * channels;
+      size_t output_size = (dec->pixels_count - dec->pixels_out) * channels;
+
+      if (dec->state == QOIS_OP_NONE)
+      {
+        size_t used = 0;
+        int result = _qois_decode_ops(dec, input + input_pos, input_size - input_pos, output, output_size, &used);
+        input_pos += used;
+        if (result < 0)
+        {
+          *consumed = input_pos;
+          return -1;
+        }
+
+        if (input_pos >= input_size || dec->pixels_out >= dec->pixels_count)
+          break;
+
+        output = span + dec->pixels_out * channels;
+        output_size = (dec->pixels_count - dec->pixels_out) * channels;
+      }
+
+      // Ops split over multiple input buffers
+      if (_qois_decode_op_byte(dec, input[input_pos], output, output_size) < 0)
+      {
+        *consumed = input_pos;
+        return -1;
+      }
+      input_pos++;
+    }
+
+    *consumed = input_pos;
+    return 0;
+  }
+
+  // Decodes the input into the frame, which always holds the last decoded frame with the changed rows updated.
+  // Returns 1 when a frame has been completed, decoding stops right after it so the frame can be used,
+  // 0 when more input is needed or the sequence ended, or -1 on error. The input bytes used are stored in consumed.
+  // Stops early after the header when no frame is set, or when the frame is too small.
+  static inline int qois_seq_decode_buffer(qois_seq_dec_state *state, const uint8_t *input, size_t input_size,
+                                           size_t *consumed)
+  {
+    size_t input_pos = 0;
+
+    while (input_pos < input_size && state->state != QOIS_STATE_DONE)
+    {
+      if (state->state == QOIS_STATE_HEADER)
+      {
+        state->header[state->header_position++] = input[input_pos++];
+        if (state->header_position < sizeof(qois_seq_header))
+          continue;
+
+        if (!qois_seq_read_header(state->header, sizeof(state->header), &state->desc))
+        {
+          *consumed = input_pos - 1;
+          return -1;
+        }
+
+        qois_dec_state_init(&state->dec, state->desc.channels);
+        state->dec.desc = state->desc;
+        state->dec.state = QOIS_OP_NONE;
+        state->state = QOIS_OP_NONE;
+
+        if (state->frame)
+          qois_seq_dec_set_frame(state, state->frame, state->frame_size);
+        continue;
+      }
+
+      if (!state->frame || state->frame_size < qois_seq_frame_size(&state->desc))
+        break;
+
+      uint8_t byte = input[input_pos];
+
+      switch (state->part)
+      {
+      case QOIS_SEQ_PART_FRAME:
+        input_pos++;
+        if (byte == QOIS_SEQ_END)
+        {
+          state->state = QOIS_STATE_DONE;
+          break;
+        }
+        if (byte != QOIS_SEQ_FRAME && byte != QOIS_SEQ_KEY_FRAME)
+        {
+          *consumed = input_pos - 1;
+          return -1;
+        }
+
+        if (byte == QOIS_SEQ_KEY_FRAME)
+          _qois_seq_reset_pixels(&state->dec.current_pixel, &state->dec.last_pixel, state->dec.cache);
+
+        state->y = 0;
+        state->changed.x0 = state->changed.y0 = state->changed.x1 = state->changed.y1 = 0;
+        state->part = QOIS_SEQ_PART_ROW;
+
+        if (state->desc.height == 0)
+        {
+          state->part = QOIS_SEQ_PART_FRAME;
+          state->frames++;
+          *consumed = input_pos;
+          return 1;
+        }
+        break;
+
+      case QOIS_SEQ_PART_ROW:
+        input_pos++;
+        if (byte == QOIS_SEQ_ROW_SAME)
+        {
+          if (_qois_seq_next_row(state))
+          {
+            *consumed = input_pos;
+            return 1;
+          }
+        }
+        else if (byte == QOIS_SEQ_ROW_SPAN)
+        {
+          state->span_position = 0;
+          state->part = QOIS_SEQ_PART_SPAN;
+        }
+        else
+        {
+          *consumed = input_pos - 1;
+          return -1;
+        }
+        break;
+
+      case QOIS_SEQ_PART_SPAN:
+      {
+        state->span[state->span_position++] = byte;
+        input_pos++;
+        if (state->span_position < sizeof(state->span))
+          break;
+
+        uint32_t x0, length;
+        memcpy(&x0, state->span, sizeof(x0));
+        memcpy(&length, state->span + 4, sizeof(length));
+        x0 = BIG_ENDIAN_TO_NATIVE(x0);
+        length = BIG_ENDIAN_TO_NATIVE(length);
+
+        if (length == 0 || x0 > state->desc.width || length > state->desc.width - x0)
+        {
+          *consumed = input_pos - 1;
+          return -1;
+        }
+
+        state->x0 = x0;
+        state->dec.pixels_out = 0;
+        state->dec.pixels_count = length;
+        state->part = QOIS_SEQ_PART_OPS;
+        _qois_seq_grow_rect(&state->changed, x0, state->y, x0 + length);
+        break;
+      }
+
+      case QOIS_SEQ_PART_OPS:
+      {
+        size_t used = 0;
+        int result = _qois_seq_decode_span(state, input + input_pos, input_size - input_pos, &used);
+        input_pos += used;
+        if (result < 0)
+        {
+          *consumed = input_pos;
+          return -1;
+        }
+
+        if (state->dec.pixels_out >= state->dec.pixels_count && _qois_seq_next_row(state))
+        {
+          *consumed = input_pos;
+          return 1;
+        }
+        break;
+      }
+      }
+    }
+
+    *consumed = input_pos;
+    return 0;
+  }
+
+#ifdef QOIS_STATS
+  // Statistics functions
+
+  static inline void qois_seq_enc_get_stats(const qois_seq_enc_state *state, qois_stats *stats)
+  {
+    *stats = state->enc.stats;
+  }
+
+  static inline void qois_seq_dec_get_stats(const qois_seq_dec_state *state, qois_stats *stats)
+  {
+    *stats = state->dec.stats;
+  }
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,203 @@
+#include "qoi-stream.h"
+#include "qoi-stream-target.h"
+
+#ifndef QOIS_STREAM_SOURCE_H
+#define QOIS_STREAM_SOURCE_H
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+  // Encoder sources
+  //
+  // Encodes straight from strided, planar or BGRA/BGRX images, or from rows pulled through a callback.
+  // The pixels are gathered into the encoder blocks that qois_encode_pixels fills as well, so no
+  // repacked copy of the image is made.
+
+  // Types
+
+  // Sets the planes of row y, a negative return value stops encoding with an error
+  typedef int (*qois_source_callback)(void *user, uint32_t y, const uint8_t **planes);
+
+  typedef struct _qois_source
+  {
+    // First row of every plane. Interleaved sources only use planes[0], planar sources have one byte
+    // per pixel in the r, g, b and a planes, where the a plane may be NULL for opaque images.
+    const uint8_t *planes[4];
+    // Distance in bytes from the start of one row to the next, in every plane
+    size_t pitch;
+    // Pixel format of interleaved sources, RGB, RGBA, BGRA or BGRX
+    qois_format format;
+    bool planar;
+
+    // When set, the planes of every row are asked from the callback instead
+    qois_source_callback callback;
+    void *user;
+  } qois_source;
+
+  // Init functions
+
+  static inline void qois_source_init(qois_source *source, const uint8_t *pixels, size_t pitch, qois_format format)
+  {
+    source->planes[0] = pixels;
+    source->planes[1] = NULL;
+    source->planes[2] = NULL;
+    source->planes[3] = NULL;
+    source->pitch = pitch;
+    source->format = format;
+    source->planar = false;
+    source->callback = NULL;
+    source->user = NULL;
+  }
+
+  static inline void qois_source_init_planar(qois_source *source, const uint8_t *r, const uint8_t *g,
+                                             const uint8_t *b, const uint8_t *a, size_t pitch)
+  {
+    qois_source_init(source, r, pitch, QOIS_FORMAT_RGBA);
+    source->planes[1] = g;
+    source->planes[2] = b;
+    source->planes[3] = a;
+    source->planar = true;
+  }
+
+  static inline void qois_source_init_callback(qois_source *source, qois_format format, bool planar,
+                                               qois_source_callback callback, void *user)
+  {
+    qois_source_init(source, NULL, 0, format);
+    source->planar = planar;
+    source->callback = callback;
+    source->user = user;
+  }
+
+  // Encode functions
+
+  // Loads count pixels of a row, starting at pixel x. Opaque sets the alpha of every pixel to 0xff.
+  static inline void _qois_source_load(const qois_source *source, const uint8_t *const *planes, size_t x,
+                                       size_t count, bool opaque, qois_pixel *block)
+  {
+    if (source->planar)
+    {
+      for (size_t i = 0; i < count; i++)
+      {
+        block[i].r = planes[0][x + i];
+        block[i].g = planes[1][x + i];
+        block[i].b = planes[2][x + i];
+        block[i].a = planes[3] && !opaque ? planes[3][x + i] : 0xff;
+      }
+      return;
+    }
+
+    const uint8_t size = qois_format_size(source->format);
+    const uint8_t *pixels = planes[0] + x * size;
+
+    switch (source->format)
+    {
+    case QOIS_FORMAT_RGBA:
+      memcpy(block, pixels, count * sizeof(qois_pixel));
+      if (opaque)
+        for (size_t i = 0; i < count; i++)
+          block[i].a = 0xff;
+      break;
+    case QOIS_FORMAT_BGRA:
+    case QOIS_FORMAT_BGRX:
+      for (size_t i = 0; i < count; i++)
+      {
+        block[i].r = pixels[i * 4 + 2];
+        block[i].g = pixels[i * 4 + 1];
+        block[i].b = pixels[i * 4 + 0];
+        block[i].a = source->format == QOIS_FORMAT_BGRA && !opaque ? pixels[i * 4 + 3] : 0xff;
+      }
+      break;
+    default:
+      for (size_t i = 0; i < count; i++)
+      {
+        memcpy(&block[i], pixels + i * 3, 3);
+        block[i].a = 0xff;
+      }
+      break;
+    }
+  }
+
+  // Encodes the next row_count rows of the image from the source. Encoding has to be at the start of a row,
+  // the output must hold qois_encode_pixels_bound of the rows. Rows past the end of the image are ignored.
+  // Returns the amount of bytes written, or -1 on error.
+  static inline int qois_encode_rows(qois_enc_state *state, const qois_source *source, uint32_t row_count,
+                                     uint8_t *output, size_t output_size)
+  {
+    const uint32_t width = state->desc.width;
+
+    if (state->state == QOIS_STATE_DONE)
+      return 0;
+    if (state->pixel_position != 0 || (width > 0 && state->pixels_in % width != 0))
+      return -1;
+    if (!source->planar && source->format != QOIS_FORMAT_RGB && source->format != QOIS_FORMAT_RGBA &&
+        source->format != QOIS_FORMAT_BGRA && source->format != QOIS_FORMAT_BGRX)
+      return -1;
+
+    uint32_t y = width > 0 ? (uint32_t)(state->pixels_in / width) : 0;
+    if (row_count > state->desc.height - y)
+      row_count = state->desc.height - y;
+
+    size_t pixel_count = (size_t)row_count * width;
+    if (qois_encode_pixels_bound(state, pixel_count) > INT_MAX)
+      return -1;
+    ASSERT_OUTPUT_AVAILABLE(qois_encode_pixels_bound(state, pixel_count));
+
+    int outputted = 0;
+
+    if (state->state == QOIS_STATE_HEADER)
+    {
+      int result = _qois_encode_header(state, output, output_size);
+      if (result < 0)
+        return result;
+
+      outputted += result;
+      PROGRESS_OUTPUT(result);
+
+      state->state = QOIS_OP_NONE;
+    }
+
+    const bool opaque = state->desc.channels == 3;
+
+    qois_pixel block[QOIS_ENCODE_BLOCK];
+
+    for (uint32_t row = 0; row < row_count && width > 0; row++, y++)
+    {
+      const uint8_t *planes[4];
+      if (source->callback)
+      {
+        planes[3] = NULL;
+        if (source->callback(source->user, y, planes) < 0)
+          return -1;
+      }
+      else
+        for (int i = 0; i < 4; i++)
+          planes[i] = source->planes[i] ? source->planes[i] + (size_t)y * source->pitch : NULL;
+
+      for (size_t x = 0; x < width; x += QOIS_ENCODE_BLOCK)
+      {
+        size_t count = width - x < QOIS_ENCODE_BLOCK ? width - x : QOIS_ENCODE_BLOCK;
+        _qois_source_load(source, planes, x, count, opaque, block);
+
+        int result = _qois_encode_block(state, block, count, state->desc.channels, output, output_size);
+        if (result < 0)
+          return result;
+
+        outputted += result;
+        PROGRESS_OUTPUT(result);
+      }
+    }
+
+    int result = _qois_encode_footer(state, output, output_size);
+    if (result < 0)
+      return result;
+
+    return outputted + result;
+  }
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
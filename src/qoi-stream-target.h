@@ -0,0 +1,650 @@
+#include "qoi-stream.h"
+
+#ifndef QOIS_STREAM_TARGET_H
+#define QOIS_STREAM_TARGET_H
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+  // Framebuffer targets
+  //
+  // Decodes straight into a framebuffer with a row pitch and a pixel format that may differ from the image.
+  // The conversion is done once per op, so runs are converted once and then repeated.
+
+  // Types
+
+  typedef enum _qois_format
+  {
+    QOIS_FORMAT_RGB = 0,
+    QOIS_FORMAT_RGBA,
+    QOIS_FORMAT_BGRA,
+    QOIS_FORMAT_BGRX,   // Like BGRA, with the alpha byte always 0xff
+    QOIS_FORMAT_RGB565, // 16 bits little endian, red in the high bits
+    QOIS_FORMAT_A8,     // Only the alpha channel
+  } qois_format;
+
+  typedef struct _qois_target
+  {
+    // First byte of the first row, the target must hold height rows of pitch bytes
+    uint8_t *pixels;
+    // Distance in bytes from the start of one row to the next
+    size_t pitch;
+    qois_format format;
+  } qois_target;
+
+  // Called with every completed row, a negative return value stops decoding with an error
+  typedef int (*qois_row_callback)(void *user, uint32_t y, const uint8_t *row, size_t row_size);
+
+  typedef struct _qois_row_dec_state
+  {
+    qois_dec_state dec;
+    qois_format format;
+
+    // Holds one row of pixels in the format, see qois_row_dec_set_row
+    uint8_t *row;
+    size_t row_size;
+
+    // Pixels in the row so far, and the index of the row
+    uint32_t x;
+    uint32_t y;
+
+    qois_row_callback callback;
+    void *user;
+  } qois_row_dec_state;
+
+  // Util functions
+
+  static inline uint8_t qois_format_size(qois_format format)
+  {
+    switch (format)
+    {
+    case QOIS_FORMAT_RGB:
+      return 3;
+    case QOIS_FORMAT_RGB565:
+      return 2;
+    case QOIS_FORMAT_A8:
+      return 1;
+    default:
+      return 4;
+    }
+  }
+
+  static inline qois_format qois_format_from_channels(uint8_t channels)
+  {
+    return channels == 3 ? QOIS_FORMAT_RGB : QOIS_FORMAT_RGBA;
+  }
+
+  static inline void qois_target_init(qois_target *target, uint8_t *pixels, size_t pitch, qois_format format)
+  {
+    target->pixels = pixels;
+    target->pitch = pitch;
+    target->format = format;
+  }
+
+  // Returns the pixel in the byte layout of the format, so it can be stored with _qois_fill_pixels
+  static inline qois_pixel _qois_convert_pixel(const qois_pixel *pixel, qois_format format)
+  {
+    qois_pixel converted = *pixel;
+
+    switch (format)
+    {
+    case QOIS_FORMAT_BGRA:
+    case QOIS_FORMAT_BGRX:
+      converted.r = pixel->b;
+      converted.b = pixel->r;
+      if (format == QOIS_FORMAT_BGRX)
+        converted.a = 0xff;
+      break;
+    case QOIS_FORMAT_RGB565:
+    {
+      uint16_t value = (uint16_t)((pixel->r >> 3) << 11 | (pixel->g >> 2) << 5 | (pixel->b >> 3));
+      converted.r = (uint8_t)value;
+      converted.g = (uint8_t)(value >> 8);
+      break;
+    }
+    case QOIS_FORMAT_A8:
+      converted.r = pixel->a;
+      break;
+    default:
+      break;
+    }
+
+    return converted;
+  }
+
+  // Stores a single converted pixel, with a constant size for every format so no memcpy call is made
+  static inline void _qois_store_converted(uint8_t *output, const qois_pixel *converted, uint8_t size)
+  {
+    switch (size)
+    {
+    case 4:
+      memcpy(output, converted, 4);
+      break;
+    case 3:
+      memcpy(output, converted, 3);
+      break;
+    case 2:
+      memcpy(output, converted, 2);
+      break;
+    default:
+      output[0] = converted->r;
+      break;
+    }
+  }
+
+  // Writes count converted pixels starting at the given pixel of the image, continuing on the next rows
+  static inline void _qois_target_fill(const qois_target *target, uint32_t width, size_t position,
+                                       const qois_pixel *converted, size_t count)
+  {
+    const uint8_t size = qois_format_size(target->format);
+
+    size_t x = position % width;
+    uint8_t *row = target->pixels + (position / width) * target->pitch;
+
+    while (count > 0)
+    {
+      size_t length = width - x < count ? width - x : count;
+      _qois_fill_pixels(row + x * size, converted, size, length);
+
+      count -= length;
+      x = 0;
+      row += target->pitch;
+    }
+  }
+
+  // Decode functions
+
+  // Applies a complete op to the pixel, returns the amount of pixels it stands for or -1 on error
+  static inline int _qois_target_op(const qois_op_info *info, const uint8_t *in, const qois_pixel *cache,
+                                    qois_pixel *pixel)
+  {
+    switch (info->op)
+    {
+    case QOIS_OP_RGBA:
+      pixel->a = in[4];
+      // fall through
+    case QOIS_OP_RGB:
+      pixel->r = in[1];
+      pixel->g = in[2];
+      pixel->b = in[3];
+      return 1;
+    case QOIS_OP_INDEX:
+      *pixel = cache[in[0]];
+      return 1;
+    case QOIS_OP_DIFF:
+      *pixel = _qois_pixel_unpack(_qois_packed_add(_qois_pixel_pack(pixel), info->diff));
+      return 1;
+    case QOIS_OP_LUMA:
+      *pixel = _qois_pixel_unpack(_qois_packed_add(_qois_pixel_pack(pixel), _qois_luma_diff(info, in[1])));
+      return 1;
+    case QOIS_OP_RUN:
+      return info->run;
+    default:
+      return -1;
+    }
+  }
+
+  // Decodes complete ops of RGB and RGBA targets with _qois_decode_ops, one row of the target at a time
+  static inline int _qois_decode_ops_target_channels(qois_dec_state *state, const uint8_t *input, size_t input_size,
+                                                     const qois_target *target, size_t *consumed)
+  {
+    const uint32_t width = state->desc.width;
+    const uint8_t size = state->desc.channels;
+
+    size_t input_pos = 0;
+    int result = 0;
+
+    while (input_pos < input_size && state->pixels_out < state->pixels_count)
+    {
+      size_t x = state->pixels_out % width;
+      uint8_t *row = target->pixels + (state->pixels_out / width) * target->pitch;
+
+      size_t used = 0;
+      int outputted = _qois_decode_ops(state, input + input_pos, input_size - input_pos,
+                                       row + x * size, (width - x) * size, &used);
+      input_pos += used;
+      if (outputted < 0)
+      {
+        result = -1;
+        break;
+      }
+
+      // The rest of a run that crosses the end of the row goes straight to the next rows
+      if (state->run_remaining > 0)
+      {
+        _qois_target_fill(target, width, state->pixels_out, &state->current_pixel, state->run_remaining);
+        state->pixels_out += state->run_remaining;
+        state->run_remaining = 0;
+        continue;
+      }
+
+      // Anything else than a full row is left for the byte path
+      if (x + (size_t)outputted / size != width)
+        break;
+    }
+
+    *consumed = input_pos;
+    return result;
+  }
+
+  // Decodes complete ops into the target, converting every pixel to the format
+  static inline int _qois_decode_ops_target(qois_dec_state *state, const uint8_t *input, size_t input_size,
+                                            const qois_target *target, size_t *consumed)
+  {
+    const uint32_t width = state->desc.width;
+    const qois_format format = target->format;
+    const uint8_t size = qois_format_size(format);
+
+    if (format == QOIS_FORMAT_RGB || format == QOIS_FORMAT_RGBA)
+      return _qois_decode_ops_target_channels(state, input, input_size, target, consumed);
+
+    const uint8_t *in = input;
+    const uint8_t *in_end = input + input_size;
+
+    size_t pixels_out = state->pixels_out;
+    qois_pixel *cache = state->cache;
+    qois_pixel pixel = state->current_pixel;
+    int result = 0;
+
+    size_t x = pixels_out % width;
+    uint8_t *row = target->pixels + (pixels_out / width) * target->pitch;
+
+    while (in < in_end && pixels_out < state->pixels_count)
+    {
+      const qois_op_info *info = &qois_op_table[in[0]];
+      if ((size_t)(in_end - in) < info->length)
+        break;
+
+      int count = _qois_target_op(info, in, cache, &pixel);
+      if (count < 0 || pixels_out + (size_t)count > state->pixels_count)
+      {
+        result = -1;
+        break;
+      }
+
+      qois_pixel converted = _qois_convert_pixel(&pixel, format);
+      if (count == 1)
+      {
+        _qois_store_converted(row + x * size, &converted, size);
+        if (++x == width)
+        {
+          x = 0;
+          row += target->pitch;
+        }
+      }
+      else
+      {
+        _qois_target_fill(target, width, pixels_out, &converted, (size_t)count);
+
+        x += (size_t)count;
+        while (x >= width)
+        {
+          x -= width;
+          row += target->pitch;
+        }
+      }
+
+      cache[_qois_pixel_hash(&pixel)] = pixel;
+      QOIS_STATS_OP(state, info);
+      pixels_out += (size_t)count;
+      in += info->length;
+    }
+
+    state->current_pixel = pixel;
+    state->last_pixel = pixel;
+    state->pixels_out = pixels_out;
+
+    *consumed = (size_t)(in - input);
+    return result;
+  }
+
+  // Decodes the input into the target, which must be large enough for the whole image.
+  // The state stays resumable between calls, every call continues at state->pixels_out.
+  // Returns the amount of pixels written, or -1 on error. The amount of input bytes used is stored in consumed.
+  static inline int qois_decode_target(qois_dec_state *state, const uint8_t *input, size_t input_size,
+                                       const qois_target *target, size_t *consumed)
+  {
+    size_t input_pos = 0;
+    size_t pixels_start = state->pixels_out;
+
+    while (input_pos < input_size && state->state != QOIS_STATE_DONE)
+    {
+      // The decoder writes RGB and RGBA rows itself, with the channels of the format
+      if (state->state >= QOIS_OP_NONE && (target->format == QOIS_FORMAT_RGB || target->format == QOIS_FORMAT_RGBA))
+        state->desc.channels = qois_format_size(target->format);
+
+      if (state->state == QOIS_OP_NONE && state->pixels_out < state->pixels_count)
+      {
+        size_t used = 0;
+        int result = _qois_decode_ops_target(state, input + input_pos, input_size - input_pos, target, &used);
+        input_pos += used;
+        if (result < 0)
+        {
+          *consumed = input_pos;
+          return -1;
+        }
+
+        if (state->pixels_out >= state->pixels_count)
+        {
+          state->state = QOIS_STATE_FOOTER;
+          state->op_position = 0;
+        }
+
+        if (input_pos >= input_size)
+          break;
+      }
+
+      uint8_t byte = input[input_pos];
+
+      if (state->state >= QOIS_OP_NONE)
+      {
+        // Only ops split over multiple input buffers end up here, so at most a single pixel is written
+        // to the scratch pixel, which is then converted into the target
+        uint8_t scratch[sizeof(qois_pixel)];
+        size_t pixels_before = state->pixels_out;
+        if (_qois_decode_op_byte(state, byte, scratch, sizeof(scratch)) < 0)
+        {
+          *consumed = input_pos;
+          return -1;
+        }
+
+        if (state->pixels_out > pixels_before)
+        {
+          qois_pixel converted = _qois_convert_pixel(&state->current_pixel, target->format);
+          _qois_target_fill(target, state->desc.width, pixels_before, &converted, state->pixels_out - pixels_before);
+        }
+
+        if (state->pixels_out >= state->pixels_count)
+        {
+          state->state = QOIS_STATE_FOOTER;
+          state->op_position = 0;
+        }
+      }
+      else if (_qois_decode_frame_byte(state, byte) < 0)
+      {
+        *consumed = input_pos;
+        return -1;
+      }
+
+      input_pos++;
+    }
+
+    *consumed = input_pos;
+    return (int)(state->pixels_out - pixels_start);
+  }
+
+  // Row callback functions
+  //
+  // Decodes one row at a time into a single row buffer, and hands every completed row to the callback.
+  // Memory use is fixed at one row plus the decoder state, whatever the size of the input buffers.
+
+  // The row may be NULL, decoding then stops after the header so the row can be sized from state->dec.desc
+  void qois_row_dec_state_init(qois_row_dec_state *state, qois_format format, uint8_t *row, size_t row_size,
+                               qois_row_callback callback, void *user)
+  {
+    qois_dec_state_init(&state->dec, 0);
+
+    state->format = format;
+    state->row = row;
+    state->row_size = row_size;
+    state->x = 0;
+    state->y = 0;
+    state->callback = callback;
+    state->user = user;
+  }
+
+  // Sets the format and the row, before the first pixel is decoded
+  static inline void qois_row_dec_set_row(qois_row_dec_state *state, qois_format format, uint8_t *row, size_t row_size)
+  {
+    state->format = format;
+    state->row = row;
+    state->row_size = row_size;
+  }
+
+  // Writes count converted pixels to the row, calling the callback for every row that is completed
+  static inline int _qois_row_emit(qois_row_dec_state *state, const qois_pixel *converted, size_t count)
+  {
+    const uint32_t width = state->dec.desc.width;
+    const uint8_t size = qois_format_size(state->format);
+
+    while (count > 0)
+    {
+      size_t length = width - state->x < count ? width - state->x : count;
+      _qois_fill_pixels(state->row + (size_t)state->x * size, converted, size, length);
+
+      count -= length;
+      state->x += (uint32_t)length;
+
+      if (state->x == width)
+      {
+        if (state->callback(state->user, state->y, state->row, (size_t)width * size) < 0)
+          return -1;
+        state->x = 0;
+        state->y++;
+      }
+    }
+
+    return 0;
+  }
+
+  // Decodes complete ops of RGB and RGBA images with _qois_decode_ops, using the rest of the row as its output
+  static inline int _qois_decode_ops_rows_channels(qois_row_dec_state *state, const uint8_t *input, size_t input_size,
+                                                   size_t *consumed)
+  {
+    qois_dec_state *dec = &state->dec;
+    const uint32_t width = dec->desc.width;
+    const uint8_t size = dec->desc.channels;
+
+    size_t input_pos = 0;
+    int result = 0;
+
+    while (input_pos < input_size && dec->pixels_out < dec->pixels_count)
+    {
+      size_t used = 0;
+      int outputted = _qois_decode_ops(dec, input + input_pos, input_size - input_pos,
+                                       state->row + (size_t)state->x * size, (size_t)(width - state->x) * size, &used);
+      input_pos += used;
+      if (outputted < 0)
+      {
+        result = -1;
+        break;
+      }
+
+      state->x += (uint32_t)outputted / size;
+      bool row_done = state->x == width;
+      if (row_done)
+      {
+        if (state->callback(state->user, state->y, state->row, (size_t)width * size) < 0)
+        {
+          result = -1;
+          break;
+        }
+        state->x = 0;
+        state->y++;
+      }
+
+      // The rest of a run that crosses the end of the row goes straight to the next rows
+      if (dec->run_remaining > 0)
+      {
+        size_t count = dec->run_remaining;
+        dec->pixels_out += count;
+        dec->run_remaining = 0;
+
+        if (_qois_row_emit(state, &dec->current_pixel, count) < 0)
+        {
+          result = -1;
+          break;
+        }
+        continue;
+      }
+
+      // Anything else than a full row is left for the byte path
+      if (!row_done)
+        break;
+    }
+
+    *consumed = input_pos;
+    return result;
+  }
+
+  // Decodes complete ops into the row, converting every pixel to the format
+  static inline int _qois_decode_ops_rows(qois_row_dec_state *state, const uint8_t *input, size_t input_size,
+                                          size_t *consumed)
+  {
+    qois_dec_state *dec = &state->dec;
+    const uint32_t width = dec->desc.width;
+    const qois_format format = state->format;
+    const uint8_t size = qois_format_size(format);
+    uint8_t *row = state->row;
+
+    if (format == QOIS_FORMAT_RGB || format == QOIS_FORMAT_RGBA)
+      return _qois_decode_ops_rows_channels(state, input, input_size, consumed);
+
+    const uint8_t *in = input;
+    const uint8_t *in_end = input + input_size;
+
+    // Kept in locals, as the stores to the row may alias the state
+    size_t pixels_out = dec->pixels_out;
+    const size_t pixels_count = dec->pixels_count;
+    uint32_t x = state->x;
+    qois_pixel *cache = dec->cache;
+    qois_pixel pixel = dec->current_pixel;
+    int result = 0;
+
+    while (in < in_end && pixels_out < pixels_count)
+    {
+      const qois_op_info *info = &qois_op_table[in[0]];
+      if ((size_t)(in_end - in) < info->length)
+        break;
+
+      int count = _qois_target_op(info, in, cache, &pixel);
+      if (count < 0 || pixels_out + (size_t)count > pixels_count)
+      {
+        result = -1;
+        break;
+      }
+
+      cache[_qois_pixel_hash(&pixel)] = pixel;
+      QOIS_STATS_OP(dec, info);
+      pixels_out += (size_t)count;
+      in += info->length;
+
+      // Single pixels that do not complete the row are stored without the row bookkeeping
+      qois_pixel converted = _qois_convert_pixel(&pixel, format);
+      if (count == 1 && x + 1 < width)
+      {
+        _qois_store_converted(row + (size_t)x * size, &converted, size);
+        x++;
+        continue;
+      }
+
+      state->x = x;
+      if (_qois_row_emit(state, &converted, (size_t)count) < 0)
+      {
+        result = -1;
+        break;
+      }
+      x = state->x;
+    }
+
+    state->x = x;
+    dec->pixels_out = pixels_out;
+    dec->current_pixel = pixel;
+    dec->last_pixel = pixel;
+
+    *consumed = (size_t)(in - input);
+    return result;
+  }
+
+  // Decodes the input, calling the callback for every completed row.
+  // Returns the amount of rows completed, or -1 on error. The amount of input bytes used is stored in consumed.
+  // Stops early after the header when no row is set, or when the row is too small for the image.
+  static inline int qois_row_decode_buffer(qois_row_dec_state *state, const uint8_t *input, size_t input_size,
+                                           size_t *consumed)
+  {
+    qois_dec_state *dec = &state->dec;
+    size_t input_pos = 0;
+    uint32_t rows_start = state->y;
+
+    while (input_pos < input_size && dec->state != QOIS_STATE_DONE)
+    {
+      if (dec->state >= QOIS_OP_NONE)
+      {
+        if (!state->row || state->row_size < (size_t)dec->desc.width * qois_format_size(state->format))
+          break;
+
+        // The decoder writes RGB and RGBA rows itself, with the channels of the format
+        if (state->format == QOIS_FORMAT_RGB || state->format == QOIS_FORMAT_RGBA)
+          dec->desc.channels = qois_format_size(state->format);
+      }
+
+      if (dec->state == QOIS_OP_NONE && dec->pixels_out < dec->pixels_count)
+      {
+        size_t used = 0;
+        int result = _qois_decode_ops_rows(state, input + input_pos, input_size - input_pos, &used);
+        input_pos += used;
+        if (result < 0)
+        {
+          *consumed = input_pos;
+          return -1;
+        }
+
+        if (dec->pixels_out >= dec->pixels_count)
+        {
+          dec->state = QOIS_STATE_FOOTER;
+          dec->op_position = 0;
+        }
+
+        if (input_pos >= input_size)
+          break;
+      }
+
+      uint8_t byte = input[input_pos];
+
+      if (dec->state >= QOIS_OP_NONE)
+      {
+        // Only ops split over multiple input buffers end up here, like in qois_decode_target
+        uint8_t scratch[sizeof(qois_pixel)];
+        size_t pixels_before = dec->pixels_out;
+        if (_qois_decode_op_byte(dec, byte, scratch, sizeof(scratch)) < 0)
+        {
+          *consumed = input_pos;
+          return -1;
+        }
+
+        if (dec->pixels_out > pixels_before)
+        {
+          qois_pixel converted = _qois_convert_pixel(&dec->current_pixel, state->format);
+          if (_qois_row_emit(state, &converted, dec->pixels_out - pixels_before) < 0)
+          {
+            *consumed = input_pos + 1;
+            return -1;
+          }
+        }
+
+        if (dec->pixels_out >= dec->pixels_count)
+        {
+          dec->state = QOIS_STATE_FOOTER;
+          dec->op_position = 0;
+        }
+      }
+      else if (_qois_decode_frame_byte(dec, byte) < 0)
+      {
+        *consumed = input_pos;
+        return -1;
+      }
+
+      input_pos++;
+    }
+
+    *consumed = input_pos;
+    return (int)(state->y - rows_start);
+  }
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -1,10 +1,23 @@
 #include <stdint.h>
 #include <string.h>
 #include <stdbool.h>
+#include <limits.h>
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+// Use computed goto for op dispatch in the bulk decoder, define QOIS_NO_COMPUTED_GOTO to use a switch instead
+#if defined(__GNUC__) && !defined(QOIS_NO_COMPUTED_GOTO)
+#define QOIS_COMPUTED_GOTO
+#endif
 
 // Enable this to always check if the provided buffers are big enough for the output
 // #define SAFE_BUFFER
 
+// Enable this to count the ops, runs and cache hits of every encoder and decoder, see qois_stats
+// #define QOIS_STATS
+
 #ifndef QOIS_STREAM_H
 #define QOIS_STREAM_H
 
@@ -33,9 +46,15 @@ extern "C"
 #if defined(__BYTE_ORDER__) && defined(__ORDER_BIG_ENDIAN__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
 #define NATIVE_TO_BIG_ENDIAN(value) (value)
 #define BIG_ENDIAN_TO_NATIVE(value) (value)
+#define NATIVE_TO_BIG_ENDIAN_64(value) (value)
+#define BIG_ENDIAN_TO_NATIVE_64(value) (value)
+#define NATIVE_TO_LITTLE_ENDIAN_64(value) __builtin_bswap64(value)
 #else
 #define NATIVE_TO_BIG_ENDIAN(value) __builtin_bswap32(value)
 #define BIG_ENDIAN_TO_NATIVE(value) __builtin_bswap32(value)
+#define NATIVE_TO_BIG_ENDIAN_64(value) __builtin_bswap64(value)
+#define BIG_ENDIAN_TO_NATIVE_64(value) __builtin_bswap64(value)
+#define NATIVE_TO_LITTLE_ENDIAN_64(value) (value)
 #endif
 
   // Constants
@@ -86,6 +105,19 @@ extern "C"
     uint8_t a;
   } qois_pixel;
 
+#ifdef QOIS_STATS
+  typedef struct _qois_stats
+  {
+    // Ops written or read, indexed by op - QOIS_OP_RGB
+    uint64_t ops[6];
+    // Runs by length, runs[0] counts the runs of a single pixel
+    uint64_t runs[62];
+    // Pixels covered by the ops, and the size of the ops without the header and footer
+    uint64_t pixels;
+    uint64_t bytes;
+  } qois_stats;
+#endif
+
   typedef struct _qois_dec_state
   {
     qois_desc desc;
@@ -93,6 +125,9 @@ extern "C"
 
     uint8_t op_data;
     uint8_t op_position;
+    // Pixels of the last run that did not fit in the output yet, they are written before the next op.
+    // Kept next to op_position, where it fits in padding that was already there.
+    uint8_t run_remaining;
 
     size_t pixels_out;
     size_t pixels_count;
@@ -101,6 +136,10 @@ extern "C"
     qois_pixel last_pixel;
 
     qois_pixel cache[64];
+
+#ifdef QOIS_STATS
+    qois_stats stats;
+#endif
   } qois_dec_state;
 
   typedef struct _qois_enc_state
@@ -118,19 +157,133 @@ extern "C"
     qois_pixel last_pixel;
 
     qois_pixel cache[64];
+
+#ifdef QOIS_STATS
+    qois_stats stats;
+#endif
   } qois_enc_state;
 
   // Util functions
 
+  // Packed pixels
+  //
+  // The cores work on pixels packed in a uint32_t, red in the lowest byte and alpha in the highest.
+  // On little endian systems this is the memory layout of qois_pixel, so packing is a single load.
+
+  static inline uint32_t _qois_pixel_pack(const qois_pixel *pixel)
+  {
+    return (uint32_t)pixel->r | (uint32_t)pixel->g << 8 | (uint32_t)pixel->b << 16 | (uint32_t)pixel->a << 24;
+  }
+
+  static inline qois_pixel _qois_pixel_unpack(uint32_t value)
+  {
+    qois_pixel pixel;
+    pixel.r = (uint8_t)value;
+    pixel.g = (uint8_t)(value >> 8);
+    pixel.b = (uint8_t)(value >> 16);
+    pixel.a = (uint8_t)(value >> 24);
+    return pixel;
+  }
+
+  // Adds or subtracts every byte on its own, without carries between the channels
+  static inline uint32_t _qois_packed_add(uint32_t a, uint32_t b)
+  {
+    return ((a & 0x7f7f7f7fu) + (b & 0x7f7f7f7fu)) ^ ((a ^ b) & 0x80808080u);
+  }
+
+  static inline uint32_t _qois_packed_sub(uint32_t a, uint32_t b)
+  {
+    return ((a | 0x80808080u) - (b & 0x7f7f7f7fu)) ^ ((a ^ ~b) & 0x80808080u);
+  }
+
+  // r * 3 + g * 5 + b * 7 + a * 11 in a single multiply. The channels are spread over 16 bit lanes,
+  // so every weighted channel lands in the top lane and the lower lanes never carry into it.
+  static inline uint8_t _qois_packed_hash(uint32_t value)
+  {
+    uint64_t lanes = (value & 0x00ff00ffu) | (uint64_t)(value & 0xff00ff00u) << 24;
+    return (uint8_t)(((lanes * 0x000300070005000bull) >> 48) & 63);
+  }
+
   // Returns true if pixel is the same
-  static inline bool _qois_pixel_cmp(qois_pixel *a, qois_pixel *b)
+  static inline bool _qois_pixel_cmp(const qois_pixel *a, const qois_pixel *b)
   {
-    return memcmp(a, b, sizeof(qois_pixel)) == 0;
+    return _qois_pixel_pack(a) == _qois_pixel_pack(b);
   }
 
-  static inline uint8_t _qois_pixel_hash(qois_pixel *pixel)
+  static inline uint8_t _qois_pixel_hash(const qois_pixel *pixel)
   {
-    return (uint8_t)((pixel->r * 3 + pixel->g * 5 + pixel->b * 7 + pixel->a * 11) % 64);
+    return _qois_packed_hash(_qois_pixel_pack(pixel));
+  }
+
+  // Writes count copies of a pixel, using the first channels bytes of the pixel
+  static inline void _qois_fill_pixels(uint8_t *output, const qois_pixel *pixel, uint8_t channels, size_t count)
+  {
+    // Short runs are cheaper to write one pixel at a time
+    if (count < 16)
+    {
+      for (; count > 0; count--, output += channels)
+        memcpy(output, pixel, channels);
+      return;
+    }
+
+    // Repeat the pixel over three 8 byte words. Twice over they make 48 bytes, a whole amount of 1 to 4
+    // byte pixels and of 16 byte vectors. The words are built in registers, so the vector stores do not
+    // wait on a pattern in memory. Target formats fill with 1 and 2 byte pixels as well.
+    uint64_t value = _qois_pixel_pack(pixel);
+    uint64_t words[3];
+    if (channels != 3)
+    {
+      if (channels == 1)
+        value = (value & 0xffu) * 0x0101010101010101ull;
+      else if (channels == 2)
+        value = (value & 0xffffu) * 0x0001000100010001ull;
+      else
+        value |= value << 32;
+      words[0] = words[1] = words[2] = NATIVE_TO_LITTLE_ENDIAN_64(value);
+    }
+    else
+    {
+      value &= 0x00ffffffu;
+      words[0] = NATIVE_TO_LITTLE_ENDIAN_64(value | value << 24 | value << 48);
+      words[1] = NATIVE_TO_LITTLE_ENDIAN_64(value >> 16 | value << 8 | value << 32 | value << 56);
+      words[2] = NATIVE_TO_LITTLE_ENDIAN_64(value >> 8 | value << 16 | value << 40);
+    }
+
+    size_t size = count * channels;
+
+#if defined(__AVX2__)
+    const long long word0 = (long long)words[0], word1 = (long long)words[1], word2 = (long long)words[2];
+    __m256i wide0 = _mm256_set_epi64x(word0, word2, word1, word0);
+    __m256i wide1 = _mm256_set_epi64x(word1, word0, word2, word1);
+    __m256i wide2 = _mm256_set_epi64x(word2, word1, word0, word2);
+    for (; size >= 96; size -= 96, output += 96)
+    {
+      _mm256_storeu_si256((__m256i *)(output + 0), wide0);
+      _mm256_storeu_si256((__m256i *)(output + 32), wide1);
+      _mm256_storeu_si256((__m256i *)(output + 64), wide2);
+    }
+#endif
+
+#if defined(__SSE2__)
+    __m128i narrow0 = _mm_set_epi64x((long long)words[1], (long long)words[0]);
+    __m128i narrow1 = _mm_set_epi64x((long long)words[0], (long long)words[2]);
+    __m128i narrow2 = _mm_set_epi64x((long long)words[2], (long long)words[1]);
+    for (; size >= 48; size -= 48, output += 48)
+    {
+      _mm_storeu_si128((__m128i *)(output + 0), narrow0);
+      _mm_storeu_si128((__m128i *)(output + 16), narrow1);
+      _mm_storeu_si128((__m128i *)(output + 32), narrow2);
+    }
+#endif
+
+    // Every block started at a pixel boundary, so the tail starts with a whole pixel as well
+    for (size_t i = 0; size > 0; i = (i + 1) % 3)
+    {
+      size_t length = size < 8 ? size : 8;
+      memcpy(output, &words[i], length);
+      output += length;
+      size -= length;
+    }
   }
 
   // Init functions
@@ -169,6 +322,10 @@ extern "C"
     _qois_pixel_init(&state->current_pixel);
     _qois_pixel_init(&state->last_pixel);
     memset(state->cache, 0, sizeof(state->cache));
+
+#ifdef QOIS_STATS
+    memset(&state->stats, 0, sizeof(state->stats));
+#endif
   }
 
   void qois_dec_state_init(qois_dec_state *state, uint8_t channels)
@@ -182,10 +339,15 @@ extern "C"
     state->op_position = 0;
     state->pixels_out = 0;
     state->pixels_count = 0;
+    state->run_remaining = 0;
 
     _qois_pixel_init(&state->current_pixel);
     _qois_pixel_init(&state->last_pixel);
     memset(state->cache, 0, sizeof(state->cache));
+
+#ifdef QOIS_STATS
+    memset(&state->stats, 0, sizeof(state->stats));
+#endif
   }
 
   // Util functions
@@ -212,6 +374,129 @@ extern "C"
     return true;
   }
 
+  // Precomputed information about every opcode, used by the bulk decoder and the statistics
+  typedef struct _qois_op_info
+  {
+    uint8_t op;     // qois_state of the op
+    uint8_t length; // Length of the op in bytes, including the opcode
+    uint8_t run;    // Amount of pixels of a run
+    // Packed color differences of DIFF, LUMA has its green difference in all three color bytes
+    uint32_t diff;
+  } qois_op_info;
+
+#define QOIS_OP_INFO(op)                                                                \
+  {                                                                                     \
+    (uint8_t)((op) == 0xff   ? QOIS_OP_RGBA                                             \
+              : (op) == 0xfe ? QOIS_OP_RGB                                              \
+              : (op) <= 0x3f ? QOIS_OP_INDEX                                            \
+              : (op) <= 0x7f ? QOIS_OP_DIFF                                             \
+              : (op) <= 0xbf ? QOIS_OP_LUMA                                             \
+                             : QOIS_OP_RUN),                                            \
+        (uint8_t)((op) == 0xff ? 5 : (op) == 0xfe ? 4 : ((op)&0xc0) == 0x80 ? 2 : 1),   \
+        (uint8_t)(((op)&0x3f) + 1),                                                     \
+        ((op)&0xc0) == 0x80 ? (uint32_t)((((op)&0x3f) - 32) & 0xff) * 0x00010101u       \
+                            : ((uint32_t)((((op) >> 4) & 0x03) - 2) & 0xffu) |          \
+                                  ((uint32_t)((((op) >> 2) & 0x03) - 2) & 0xffu) << 8 | \
+                                  ((uint32_t)((((op) >> 0) & 0x03) - 2) & 0xffu) << 16  \
+  }
+#define QOIS_OP_INFO_4(op) QOIS_OP_INFO(op), QOIS_OP_INFO((op) + 1), QOIS_OP_INFO((op) + 2), QOIS_OP_INFO((op) + 3)
+#define QOIS_OP_INFO_16(op) QOIS_OP_INFO_4(op), QOIS_OP_INFO_4((op) + 4), QOIS_OP_INFO_4((op) + 8), QOIS_OP_INFO_4((op) + 12)
+#define QOIS_OP_INFO_64(op) QOIS_OP_INFO_16(op), QOIS_OP_INFO_16((op) + 16), QOIS_OP_INFO_16((op) + 32), QOIS_OP_INFO_16((op) + 48)
+
+  static const qois_op_info qois_op_table[256] = {
+      QOIS_OP_INFO_64(0x00),
+      QOIS_OP_INFO_64(0x40),
+      QOIS_OP_INFO_64(0x80),
+      QOIS_OP_INFO_64(0xc0),
+  };
+
+#undef QOIS_OP_INFO_64
+#undef QOIS_OP_INFO_16
+#undef QOIS_OP_INFO_4
+#undef QOIS_OP_INFO
+
+  // Packed color differences of a LUMA op, from its table entry and its second byte
+  static inline uint32_t _qois_luma_diff(const qois_op_info *info, uint8_t byte)
+  {
+    uint32_t red_blue = ((uint32_t)((byte >> 4) - 8) & 0xffu) | ((uint32_t)((byte & 0x0f) - 8) & 0xffu) << 16;
+    return _qois_packed_add(info->diff, red_blue);
+  }
+
+#ifdef QOIS_STATS
+#define QOIS_STATS_OP(state, info) _qois_stats_op(&(state)->stats, (info))
+#else
+#define QOIS_STATS_OP(state, info) (void)0
+#endif
+
+#ifdef QOIS_STATS
+  // Statistics functions
+
+  static inline void _qois_stats_op(qois_stats *stats, const qois_op_info *info)
+  {
+    stats->ops[info->op - QOIS_OP_RGB]++;
+    stats->bytes += info->length;
+
+    if (info->op == QOIS_OP_RUN)
+    {
+      stats->runs[info->run - 1]++;
+      stats->pixels += info->run;
+    }
+    else
+      stats->pixels++;
+  }
+
+  static inline void qois_stats_reset(qois_stats *stats)
+  {
+    memset(stats, 0, sizeof(qois_stats));
+  }
+
+  static inline void qois_stats_add(qois_stats *total, const qois_stats *stats)
+  {
+    for (size_t i = 0; i < sizeof(stats->ops) / sizeof(stats->ops[0]); i++)
+      total->ops[i] += stats->ops[i];
+    for (size_t i = 0; i < sizeof(stats->runs) / sizeof(stats->runs[0]); i++)
+      total->runs[i] += stats->runs[i];
+    total->pixels += stats->pixels;
+    total->bytes += stats->bytes;
+  }
+
+  // Share of the pixels outside of runs that were found in the cache
+  static inline double qois_stats_cache_hit_rate(const qois_stats *stats)
+  {
+    uint64_t lookups = 0;
+    for (size_t i = 0; i < sizeof(stats->ops) / sizeof(stats->ops[0]); i++)
+      lookups += stats->ops[i];
+    lookups -= stats->ops[QOIS_OP_RUN - QOIS_OP_RGB];
+
+    return lookups > 0 ? (double)stats->ops[QOIS_OP_INDEX - QOIS_OP_RGB] / (double)lookups : 0;
+  }
+
+  static inline double qois_stats_bytes_per_pixel(const qois_stats *stats)
+  {
+    return stats->pixels > 0 ? (double)stats->bytes / (double)stats->pixels : 0;
+  }
+
+  static inline void qois_enc_get_stats(const qois_enc_state *state, qois_stats *stats)
+  {
+    *stats = state->stats;
+  }
+
+  static inline void qois_enc_reset_stats(qois_enc_state *state)
+  {
+    qois_stats_reset(&state->stats);
+  }
+
+  static inline void qois_dec_get_stats(const qois_dec_state *state, qois_stats *stats)
+  {
+    *stats = state->stats;
+  }
+
+  static inline void qois_dec_reset_stats(qois_dec_state *state)
+  {
+    qois_stats_reset(&state->stats);
+  }
+#endif
+
   // Encode functions
 
   static inline int _qois_encode_header(qois_enc_state *state, uint8_t *output, size_t output_size)
@@ -234,9 +519,11 @@ extern "C"
   {
     ASSERT_OUTPUT_AVAILABLE(1);
 
-    if (state->run_length == 1)
+    // A run of one is written as an index op, but only if the decoder will have the
+    // pixel in its cache. This is not the case when the image starts with the initial pixel
+    uint8_t hash = _qois_pixel_hash(&state->last_pixel);
+    if (state->run_length == 1 && _qois_pixel_cmp(&state->last_pixel, &state->cache[hash]))
     {
-      uint8_t hash = _qois_pixel_hash(&state->last_pixel);
       output[0] = 0x00 | hash;
     }
     else
@@ -244,27 +531,143 @@ extern "C"
       output[0] = 0xc0 | (state->run_length - 1);
     }
 
+    QOIS_STATS_OP(state, &qois_op_table[output[0]]);
     state->run_length = 0;
 
     return 1;
   }
 
-  static inline int _qois_encode_pixel_byte(qois_enc_state *state, uint8_t byte, uint8_t *output, size_t output_size)
+  // Op classification flags of a pixel compared to the previous pixel
+#define QOIS_CLASS_EQUAL 0x01
+#define QOIS_CLASS_ALPHA 0x02
+#define QOIS_CLASS_DIFF 0x04
+#define QOIS_CLASS_LUMA 0x08
+
+// Amount of pixels qois_encode_pixels classifies at once
+#define QOIS_ENCODE_BLOCK 16
+
+  // Packed channel differences of the pixel against the previous one, and the checks of the DIFF and LUMA ops
+  // on them. These are the same as the SSE2 checks of _qois_encode_classify, on a single packed pixel.
+  static inline uint32_t _qois_encode_diff_bytes(uint32_t diff)
   {
-    // Put the byte in the current pixel in RGBA order
-    ((uint8_t *)(&state->current_pixel))[state->pixel_position] = byte;
-    state->pixel_position++;
+    return _qois_packed_add(diff, 0x00020202u);
+  }
 
-    if (state->pixel_position < state->desc.channels)
-      return 0;
-    state->pixel_position = 0;
+  static inline uint32_t _qois_encode_luma_bytes(uint32_t diff)
+  {
+    uint32_t green = (diff >> 8) & 0xffu;
+    return _qois_packed_add(_qois_packed_sub(diff, green * 0x00010001u), 0x00082008u);
+  }
+
+  static inline uint8_t _qois_encode_classify_pixel(const qois_pixel *pixel, const qois_pixel *previous)
+  {
+    uint32_t current = _qois_pixel_pack(pixel);
+    uint32_t last = _qois_pixel_pack(previous);
+    if (current == last)
+      return QOIS_CLASS_EQUAL;
+
+    uint32_t diff = _qois_packed_sub(current, last);
+
+    // DIFF: every color difference + 2 fits in 2 bits
+    // LUMA: red and blue relative to green + 8 fit in 4 bits, green + 32 fits in 6 bits
+    return (uint8_t)((diff & 0xff000000u ? QOIS_CLASS_ALPHA : 0) |
+                     ((_qois_encode_diff_bytes(diff) & 0x00fcfcfcu) == 0 ? QOIS_CLASS_DIFF : 0) |
+                     ((_qois_encode_luma_bytes(diff) & 0x00f0c0f0u) == 0 ? QOIS_CLASS_LUMA : 0));
+  }
+
+  // Classifies a block of RGBA pixels against their previous pixel and computes their hashes
+  static inline void _qois_encode_classify(const qois_pixel *pixels, const qois_pixel *previous, size_t count,
+                                           uint8_t *flags, uint8_t *hashes)
+  {
+    size_t i = 0;
+
+#if defined(__SSE2__)
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i alpha_mask = _mm_set1_epi32((int)0xff000000);
+    const __m128i diff_bias = _mm_set1_epi32(0x00020202);
+    const __m128i diff_mask = _mm_set1_epi32(0x00fcfcfc);
+    const __m128i green_mask = _mm_set1_epi32(0x0000ff00);
+    const __m128i luma_bias = _mm_set1_epi32(0x00082008);
+    const __m128i luma_mask = _mm_set1_epi32(0x00f0c0f0);
+    const __m128i hash_weights = _mm_setr_epi16(3, 5, 7, 11, 3, 5, 7, 11);
+    const __m128i hash_mask = _mm_set1_epi32(63);
+
+    int32_t previous_value;
+    memcpy(&previous_value, previous, sizeof(previous_value));
+    __m128i carry = _mm_cvtsi32_si128(previous_value);
+
+    for (; i + 4 <= count; i += 4)
+    {
+      __m128i current = _mm_loadu_si128((const __m128i *)(pixels + i));
+      __m128i last = _mm_or_si128(_mm_slli_si128(current, 4), carry);
+      carry = _mm_srli_si128(current, 12);
+
+      // Per channel wrapping differences, the same as the int8_t math of the scalar path
+      __m128i diff = _mm_sub_epi8(current, last);
+
+      int equal = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(current, last)));
+      int alpha_same = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(_mm_and_si128(diff, alpha_mask), zero)));
+
+      // DIFF: every color difference + 2 fits in 2 bits
+      __m128i diff_biased = _mm_add_epi8(diff, diff_bias);
+      int diff_ok = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(_mm_and_si128(diff_biased, diff_mask), zero)));
+
+      // LUMA: red and blue relative to green + 8 fit in 4 bits, green + 32 fits in 6 bits
+      __m128i green = _mm_and_si128(diff, green_mask);
+      __m128i green_rb = _mm_or_si128(_mm_srli_epi32(green, 8), _mm_slli_epi32(green, 8));
+      __m128i luma_biased = _mm_add_epi8(_mm_sub_epi8(diff, green_rb), luma_bias);
+      int luma_ok = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(_mm_and_si128(luma_biased, luma_mask), zero)));
+
+      // Hash: r * 3 + g * 5 + b * 7 + a * 11, as 16 bit multiply adds of the channel pairs
+      __m128i sums_low = _mm_madd_epi16(_mm_unpacklo_epi8(current, zero), hash_weights);
+      __m128i sums_high = _mm_madd_epi16(_mm_unpackhi_epi8(current, zero), hash_weights);
+      sums_low = _mm_add_epi32(sums_low, _mm_srli_epi64(sums_low, 32));
+      sums_high = _mm_add_epi32(sums_high, _mm_srli_epi64(sums_high, 32));
+      __m128i sums = _mm_castps_si128(_mm_shuffle_ps(_mm_castsi128_ps(sums_low), _mm_castsi128_ps(sums_high),
+                                                     _MM_SHUFFLE(2, 0, 2, 0)));
+      sums = _mm_and_si128(sums, hash_mask);
+      sums = _mm_packus_epi16(_mm_packs_epi32(sums, zero), zero);
+
+      int32_t hash_values = _mm_cvtsi128_si32(sums);
+      memcpy(hashes + i, &hash_values, sizeof(hash_values));
+
+      for (int j = 0; j < 4; j++)
+      {
+        if (equal & (1 << j))
+        {
+          flags[i + (size_t)j] = QOIS_CLASS_EQUAL;
+          continue;
+        }
+
+        flags[i + (size_t)j] = (uint8_t)((alpha_same & (1 << j) ? 0 : QOIS_CLASS_ALPHA) |
+                                         (diff_ok & (1 << j) ? QOIS_CLASS_DIFF : 0) |
+                                         (luma_ok & (1 << j) ? QOIS_CLASS_LUMA : 0));
+      }
+    }
+
+    if (i > 0)
+      previous = &pixels[i - 1];
+#endif
+
+    for (; i < count; i++)
+    {
+      flags[i] = _qois_encode_classify_pixel(&pixels[i], previous);
+      hashes[i] = _qois_pixel_hash(&pixels[i]);
+      previous = &pixels[i];
+    }
+  }
+
+  // Encodes the pixel in state->current_pixel, using its classification against state->last_pixel
+  static inline int _qois_encode_classified_pixel(qois_enc_state *state, uint8_t flags, uint8_t hash,
+                                                  uint8_t channels, uint8_t *output, size_t output_size)
+  {
     state->pixels_in++;
 
     int outputted = 0;
 
     // RUN LENGTH
 
-    if (_qois_pixel_cmp(&state->current_pixel, &state->last_pixel))
+    if (flags & QOIS_CLASS_EQUAL)
     {
       state->run_length++;
       if (state->run_length < 62 && state->pixels_in < state->pixels_count)
@@ -290,23 +693,20 @@ extern "C"
 
     // INDEX
 
+    if (_qois_pixel_cmp(&state->current_pixel, &state->cache[hash]))
     {
-      uint8_t hash = _qois_pixel_hash(&state->current_pixel);
-      if (_qois_pixel_cmp(&state->current_pixel, &state->cache[hash]))
-      {
-        ASSERT_OUTPUT_AVAILABLE(1);
+      ASSERT_OUTPUT_AVAILABLE(1);
 
-        output[0] = 0x00 | hash;
-        outputted += 1;
-        goto finish_pixel;
-      }
+      output[0] = 0x00 | hash;
+      outputted += 1;
+      goto finish_pixel;
     }
 
     // RGBA
 
-    if (state->desc.channels > 3 && state->current_pixel.a != state->last_pixel.a)
+    if (channels > 3 && (flags & QOIS_CLASS_ALPHA))
     {
-      ASSERT_OUTPUT_AVAILABLE(2);
+      ASSERT_OUTPUT_AVAILABLE(5);
 
       output[0] = 0xff;
       output[1] = state->current_pixel.r;
@@ -318,24 +718,19 @@ extern "C"
       goto finish_pixel;
     }
 
+    if (flags & (QOIS_CLASS_DIFF | QOIS_CLASS_LUMA))
     {
-      // DIFF
+      uint32_t diff = _qois_packed_sub(_qois_pixel_pack(&state->current_pixel), _qois_pixel_pack(&state->last_pixel));
 
-      int8_t red_diff = (int8_t)(state->current_pixel.r - state->last_pixel.r);
-      int8_t green_diff = (int8_t)(state->current_pixel.g - state->last_pixel.g);
-      int8_t blue_diff = (int8_t)(state->current_pixel.b - state->last_pixel.b);
+      // DIFF
 
-      if (
-          red_diff <= 1 && red_diff >= -2 &&
-          green_diff <= 1 && green_diff >= -2 &&
-          blue_diff <= 1 && blue_diff >= -2)
+      if (flags & QOIS_CLASS_DIFF)
       {
+        uint32_t bytes = _qois_encode_diff_bytes(diff);
+
         ASSERT_OUTPUT_AVAILABLE(1);
 
-        output[0] = (uint8_t)0x40 |
-                    (uint8_t)((red_diff + 2) << 4) |
-                    (uint8_t)((green_diff + 2) << 2) |
-                    (uint8_t)((blue_diff + 2) << 0);
+        output[0] = (uint8_t)(0x40 | (bytes & 0x03) << 4 | (bytes >> 8 & 0x03) << 2 | (bytes >> 16 & 0x03));
 
         outputted += 1;
         goto finish_pixel;
@@ -343,22 +738,15 @@ extern "C"
 
       // LUMA
 
-      int8_t dr_dg = (int8_t)(red_diff - green_diff);
-      int8_t db_dg = (int8_t)(blue_diff - green_diff);
+      uint32_t bytes = _qois_encode_luma_bytes(diff);
 
-      if (
-          dr_dg >= -8 && dr_dg <= 7 &&
-          green_diff >= -32 && green_diff <= 31 &&
-          db_dg >= -8 && db_dg <= 7)
-      {
-        ASSERT_OUTPUT_AVAILABLE(2);
+      ASSERT_OUTPUT_AVAILABLE(2);
 
-        output[0] = 0x80 | (uint8_t)(green_diff + 32);
-        output[1] = ((uint8_t)(dr_dg + 8) << 4) | ((uint8_t)(db_dg + 8) << 0);
+      output[0] = (uint8_t)(0x80 | (bytes >> 8 & 0x3f));
+      output[1] = (uint8_t)((bytes & 0x0f) << 4 | (bytes >> 16 & 0x0f));
 
-        outputted += 2;
-        goto finish_pixel;
-      }
+      outputted += 2;
+      goto finish_pixel;
     }
 
     // RGB
@@ -375,17 +763,39 @@ extern "C"
       goto finish_pixel;
     }
 
-    {
-    finish_pixel:;
+  finish_pixel:
+    // Runs are counted when they are written
+    if (!(flags & QOIS_CLASS_EQUAL))
+      QOIS_STATS_OP(state, &qois_op_table[output[0]]);
 
-      uint8_t hash = _qois_pixel_hash(&state->current_pixel);
-      state->cache[hash] = state->current_pixel;
-      state->last_pixel = state->current_pixel;
-    }
+    state->cache[hash] = state->current_pixel;
+    state->last_pixel = state->current_pixel;
 
     return outputted;
   }
 
+  // Encodes the pixel in state->current_pixel
+  static inline int _qois_encode_pixel(qois_enc_state *state, uint8_t *output, size_t output_size)
+  {
+    uint8_t flags = _qois_encode_classify_pixel(&state->current_pixel, &state->last_pixel);
+    uint8_t hash = _qois_pixel_hash(&state->current_pixel);
+
+    return _qois_encode_classified_pixel(state, flags, hash, state->desc.channels, output, output_size);
+  }
+
+  static inline int _qois_encode_pixel_byte(qois_enc_state *state, uint8_t byte, uint8_t *output, size_t output_size)
+  {
+    // Put the byte in the current pixel in RGBA order
+    ((uint8_t *)(&state->current_pixel))[state->pixel_position] = byte;
+    state->pixel_position++;
+
+    if (state->pixel_position < state->desc.channels)
+      return 0;
+    state->pixel_position = 0;
+
+    return _qois_encode_pixel(state, output, output_size);
+  }
+
   static inline int qois_encode_byte(qois_enc_state *state, uint8_t byte, uint8_t *output, size_t output_size)
   {
     int outputted = 0;
@@ -428,6 +838,122 @@ extern "C"
     return outputted;
   }
 
+  // Returns the maximum amount of bytes qois_encode_pixels can output for the given amount of pixels
+  static inline size_t qois_encode_pixels_bound(const qois_enc_state *state, size_t pixel_count)
+  {
+    // Worst case every pixel finishes a run of one and is then written as a full RGB(A) op
+    return sizeof(qois_header) + pixel_count * (size_t)(state->desc.channels + 2) + sizeof(qois_end_magic);
+  }
+
+  // Encodes a block of at most QOIS_ENCODE_BLOCK pixels that are already loaded. Returns the amount of bytes
+  // written, the output must hold qois_encode_pixels_bound of the block.
+  static inline int _qois_encode_block(qois_enc_state *state, const qois_pixel *block, size_t count,
+                                       uint8_t channels, uint8_t *output, size_t output_size)
+  {
+    uint8_t flags[QOIS_ENCODE_BLOCK];
+    uint8_t hashes[QOIS_ENCODE_BLOCK];
+
+    _qois_encode_classify(block, &state->last_pixel, count, flags, hashes);
+
+    // A block that only continues the current run does not need to look at each pixel
+    bool all_equal = true;
+    for (size_t i = 0; i < count; i++)
+      all_equal &= flags[i] == QOIS_CLASS_EQUAL;
+
+    if (all_equal && state->run_length + count < 62 && state->pixels_in + count < state->pixels_count)
+    {
+      state->run_length = (uint8_t)(state->run_length + count);
+      state->pixels_in += count;
+      return 0;
+    }
+
+    int outputted = 0;
+    for (size_t i = 0; i < count; i++)
+    {
+      state->current_pixel = block[i];
+
+      int result = _qois_encode_classified_pixel(state, flags[i], hashes[i], channels, output, output_size);
+      if (result < 0)
+        return result;
+
+      outputted += result;
+      PROGRESS_OUTPUT(result);
+    }
+
+    return outputted;
+  }
+
+  // Writes the end marker once every pixel is encoded, returns the amount of bytes written or -1 on error
+  static inline int _qois_encode_footer(qois_enc_state *state, uint8_t *output, size_t output_size)
+  {
+    if (state->pixels_in != state->pixels_count)
+      return 0;
+
+    ASSERT_OUTPUT_AVAILABLE(sizeof(qois_end_magic));
+
+    memcpy(output, qois_end_magic, sizeof(qois_end_magic));
+
+    state->state = QOIS_STATE_DONE;
+    return (int)sizeof(qois_end_magic);
+  }
+
+  // Channel specialized encoder and decoder cores, _qois_encode_span_3 and _qois_decode_ops_3 for example
+
+#define QOIS_CHANNELS 3
+#include "qoi-stream-channels.h"
+#define QOIS_CHANNELS 4
+#include "qoi-stream-channels.h"
+
+  // Encodes a span of whole pixels in the channel layout of the image. The span may end anywhere
+  // in the image, the next call (or qois_encode_byte) continues where this one stopped.
+  // Pixels past the end of the image are ignored. Returns the amount of bytes written, or -1 on error.
+  static inline int qois_encode_pixels(qois_enc_state *state, const uint8_t *pixels, size_t pixel_count,
+                                       uint8_t *output, size_t output_size)
+  {
+    // The span has to start at a pixel boundary
+    if (state->pixel_position != 0)
+      return -1;
+    if (state->state == QOIS_STATE_DONE)
+      return 0;
+
+    size_t pixels_left = state->pixels_count - state->pixels_in;
+    if (pixel_count > pixels_left)
+      pixel_count = pixels_left;
+
+    if (qois_encode_pixels_bound(state, pixel_count) > INT_MAX)
+      return -1;
+    ASSERT_OUTPUT_AVAILABLE(qois_encode_pixels_bound(state, pixel_count));
+
+    int outputted = 0;
+
+    if (state->state == QOIS_STATE_HEADER)
+    {
+      int result = _qois_encode_header(state, output, output_size);
+      if (result < 0)
+        return result;
+
+      outputted += result;
+      PROGRESS_OUTPUT(result);
+
+      state->state = QOIS_OP_NONE;
+    }
+
+    int result = state->desc.channels == 3
+                     ? _qois_encode_span_3(state, pixels, pixel_count, output, output_size)
+                     : _qois_encode_span_4(state, pixels, pixel_count, output, output_size);
+    if (result < 0)
+      return result;
+
+    outputted += result;
+    PROGRESS_OUTPUT(result);
+
+    result = _qois_encode_footer(state, output, output_size);
+    if (result < 0)
+      return result;
+
+    return outputted + result;
+  }
+
   // Decode functions
 
   static inline int _qois_decode_header_byte(qois_dec_state *state, uint8_t byte)
@@ -497,19 +1023,7 @@ extern "C"
 
   static inline qois_state _qois_parse_op(uint8_t opcode)
   {
-    if (opcode == 0xff)
-      return QOIS_OP_RGBA;
-    if (opcode == 0xfe)
-      return QOIS_OP_RGB;
-    if (opcode <= 0x3f)
-      return QOIS_OP_INDEX;
-    if (opcode <= 0x7f)
-      return QOIS_OP_DIFF;
-    if (opcode <= 0xbf)
-      return QOIS_OP_LUMA;
-    if (opcode <= 0xfd)
-      return QOIS_OP_RUN;
-    return QOIS_OP_NONE;
+    return (qois_state)qois_op_table[opcode].op;
   }
 
   static inline int _qois_decode_copy_current_pixel(qois_dec_state *state, uint8_t *output, size_t output_size, size_t offset)
@@ -531,14 +1045,8 @@ extern "C"
   {
     ASSERT_OUTPUT_AVAILABLE((offset + count) * state->desc.channels);
 
-    uint8_t channels = state->desc.channels;
-
     output += offset * state->desc.channels;
-    uint8_t *output_end = output + count * state->desc.channels;
-
-    qois_pixel *current_pixel = &state->current_pixel;
-    for (; output < output_end; output += channels)
-      memcpy(output + offset, current_pixel, channels);
+    _qois_fill_pixels(output, &state->current_pixel, state->desc.channels, count);
 
     uint8_t hash = _qois_pixel_hash(&state->current_pixel);
     state->cache[hash] = state->current_pixel;
@@ -551,12 +1059,15 @@ extern "C"
     uint32_t pixels_outputted = 0;
     if (state->state == QOIS_OP_NONE)
     {
+      // The current pixel keeps the previous value, so ops that do not
+      // specify alpha (or any channel) carry it over from the last pixel
       state->last_pixel = state->current_pixel;
-      _qois_pixel_init(&state->current_pixel);
 
       state->state = _qois_parse_op(byte);
       state->op_data = byte & 0x3f;
       state->op_position = 0;
+
+      QOIS_STATS_OP(state, &qois_op_table[byte]);
     }
 
     switch (state->state)
@@ -668,9 +1179,17 @@ extern "C"
       state->current_pixel = state->last_pixel;
 
       uint8_t length = state->op_data + 1;
-      if (_qois_decode_copy_current_pixel_n(state, output, output_size, 0, length) < 0)
+      if (state->pixels_out + length > state->pixels_count)
         return -1;
-      pixels_outputted += length;
+
+      // The part of the run that does not fit is left for qois_decode_flush
+      size_t room = output_size / state->desc.channels;
+      uint8_t count = room < length ? (uint8_t)room : length;
+
+      if (_qois_decode_copy_current_pixel_n(state, output, output_size, 0, count) < 0)
+        return -1;
+      pixels_outputted += count;
+      state->run_remaining = (uint8_t)(length - count);
 
       state->state = QOIS_OP_NONE;
     }
@@ -685,15 +1204,51 @@ extern "C"
     return (int)(pixels_outputted * state->desc.channels);
   }
 
+  // Returns the amount of pixels of the last run that still have to be written with qois_decode_flush
+  static inline size_t qois_decode_pending(const qois_dec_state *state)
+  {
+    return state->run_remaining;
+  }
+
+  // Writes as many of the pending run pixels as fit in the output, returns the amount of bytes written
+  static inline int qois_decode_flush(qois_dec_state *state, uint8_t *output, size_t output_size)
+  {
+    size_t room = output_size / state->desc.channels;
+    size_t count = room < state->run_remaining ? room : state->run_remaining;
+    if (count == 0)
+      return 0;
+
+    _qois_fill_pixels(output, &state->current_pixel, state->desc.channels, count);
+    state->run_remaining = (uint8_t)(state->run_remaining - count);
+    state->pixels_out += count;
+
+    if (state->run_remaining == 0 && state->pixels_out >= state->pixels_count)
+    {
+      state->state = QOIS_STATE_FOOTER;
+      state->op_position = 0;
+    }
+
+    return (int)(count * state->desc.channels);
+  }
+
+  // Decodes a single byte, the output has to hold at least one pixel.
+  // A run that does not fit in the output is written only partially, so the returned count can be less
+  // than the pixels the byte stands for. Callers that pass a small output must check qois_decode_pending
+  // after every byte, and write the rest with qois_decode_flush before the next byte, a byte passed while
+  // a run is pending returns -1. An output of 62 pixels always fits a whole run.
+  // Returns the amount of bytes written, or -1 on error.
   static inline int qois_decode_byte(qois_dec_state *state, uint8_t byte, uint8_t *output, size_t output_size)
   {
-    ASSERT_OUTPUT_AVAILABLE(state->desc.channels * 64);
+    ASSERT_OUTPUT_AVAILABLE(state->desc.channels);
+
+    if (state->run_remaining > 0)
+      return -1;
 
     if (state->state >= QOIS_OP_NONE)
     {
       int outputted = _qois_decode_op_byte(state, byte, output, output_size);
 
-      if (state->pixels_out >= state->pixels_count)
+      if (state->pixels_out >= state->pixels_count && state->run_remaining == 0)
       {
         state->state = QOIS_STATE_FOOTER;
         state->op_position = 0;
@@ -706,7 +1261,10 @@ extern "C"
         return -1;
 
       if (state->op_position == sizeof(qois_header))
-        state->state = QOIS_OP_NONE;
+      {
+        state->state = state->pixels_count > 0 ? QOIS_OP_NONE : QOIS_STATE_FOOTER;
+        state->op_position = 0;
+      }
     }
     else if (state->state == QOIS_STATE_FOOTER)
     {
@@ -724,6 +1282,291 @@ extern "C"
     return 0;
   }
 
+  // Bulk decode functions
+
+  // Decodes as many complete ops as possible from the input, starting at an op boundary.
+  // Stops at the end of the image, when the next op is not fully available in the input,
+  // or when the output is full. A run that does not fit is written partially, see run_remaining.
+  // Ops are dispatched through qois_op_table, with computed goto when the compiler supports it.
+  static inline int _qois_decode_ops(qois_dec_state *state, const uint8_t *input, size_t input_size,
+                                     uint8_t *output, size_t output_size, size_t *consumed)
+  {
+    if (state->desc.channels == 3)
+      return _qois_decode_ops_3(state, input, input_size, output, output_size, consumed);
+    return _qois_decode_ops_4(state, input, input_size, output, output_size, consumed);
+  }
+
+  // Handles a header or footer byte for the bulk decoders
+  static inline int _qois_decode_frame_byte(qois_dec_state *state, uint8_t byte)
+  {
+    if (state->state == QOIS_STATE_HEADER)
+    {
+      if (_qois_decode_header_byte(state, byte) == -1)
+        return -1;
+
+      if (state->op_position == sizeof(qois_header))
+      {
+        state->state = state->pixels_count > 0 ? QOIS_OP_NONE : QOIS_STATE_FOOTER;
+        state->op_position = 0;
+      }
+    }
+    else if (state->state == QOIS_STATE_FOOTER)
+    {
+      if (_qois_decode_footer_byte(state, byte) == -1)
+        return -1;
+
+      if (state->op_position == sizeof(qois_end_magic))
+        state->state = QOIS_STATE_DONE;
+    }
+    else
+      return -1;
+
+    return 0;
+  }
+
+  // Decodes a whole input buffer in one call, the state stays resumable between calls and can be
+  // mixed with qois_decode_byte. Returns the amount of bytes written to the output, or -1 on error.
+  // The amount of input bytes used is stored in consumed, this is less than input_size if the
+  // output buffer is full or the image is done. On error consumed points to the offending byte.
+  // The output can have any size, runs that do not fit are continued by the next call.
+  static inline int qois_decode_buffer(qois_dec_state *state, const uint8_t *input, size_t input_size,
+                                       uint8_t *output, size_t output_size, size_t *consumed)
+  {
+    size_t input_pos = 0;
+    size_t output_pos = 0;
+
+    if (output_size > INT_MAX)
+      output_size = INT_MAX;
+
+    while (state->state != QOIS_STATE_DONE)
+    {
+      // The rest of a run from the previous call comes first, even without new input
+      if (state->run_remaining > 0)
+      {
+        output_pos += (size_t)qois_decode_flush(state, output + output_pos, output_size - output_pos);
+        if (state->run_remaining > 0)
+          break;
+      }
+
+      if (input_pos >= input_size)
+        break;
+
+      if (state->state == QOIS_OP_NONE && state->pixels_out < state->pixels_count)
+      {
+        size_t used = 0;
+        int result = _qois_decode_ops(state, input + input_pos, input_size - input_pos,
+                                      output + output_pos, output_size - output_pos, &used);
+        if (result < 0)
+        {
+          *consumed = input_pos + used;
+          return -1;
+        }
+
+        input_pos += used;
+        output_pos += (size_t)result;
+
+        if (state->run_remaining > 0)
+          break;
+
+        if (state->pixels_out >= state->pixels_count)
+        {
+          state->state = QOIS_STATE_FOOTER;
+          state->op_position = 0;
+        }
+
+        if (input_pos >= input_size)
+          break;
+      }
+
+      // Everything the fast path can not handle goes through the byte decoder:
+      // the header, the footer and ops that are split over multiple input buffers
+      uint8_t byte = input[input_pos];
+
+      if (state->state >= QOIS_OP_NONE)
+      {
+        if (output_size - output_pos < state->desc.channels)
+          break;
+
+        int result = _qois_decode_op_byte(state, byte, output + output_pos, output_size - output_pos);
+        if (result < 0)
+        {
+          *consumed = input_pos;
+          return -1;
+        }
+        output_pos += (size_t)result;
+
+        if (state->run_remaining > 0)
+        {
+          input_pos++;
+          break;
+        }
+
+        if (state->pixels_out >= state->pixels_count)
+        {
+          state->state = QOIS_STATE_FOOTER;
+          state->op_position = 0;
+        }
+      }
+      else if (_qois_decode_frame_byte(state, byte) < 0)
+      {
+        *consumed = input_pos;
+        return -1;
+      }
+
+      input_pos++;
+    }
+
+    *consumed = input_pos;
+    return (int)output_pos;
+  }
+
+  // Skip decode functions
+
+  // Decodes complete ops without writing any pixels, only keeping the cache and current pixel up to date.
+  // Stops at the first op boundary where at least pixel_target pixels have been decoded.
+  static inline int _qois_skip_ops(qois_dec_state *state, const uint8_t *input, size_t input_size,
+                                   size_t pixel_target, size_t *consumed)
+  {
+    const uint8_t *in = input;
+    const uint8_t *in_end = input + input_size;
+
+    size_t pixels_out = state->pixels_out;
+    qois_pixel *cache = state->cache;
+    uint32_t pixel = _qois_pixel_pack(&state->current_pixel);
+    int result = 0;
+
+    if (pixel_target > state->pixels_count)
+      pixel_target = state->pixels_count;
+
+    while (in < in_end && pixels_out < pixel_target)
+    {
+      const qois_op_info *info = &qois_op_table[in[0]];
+      if ((size_t)(in_end - in) < info->length)
+        break;
+
+      switch (info->op)
+      {
+      case QOIS_OP_RGBA:
+        pixel = (pixel & 0x00ffffffu) | (uint32_t)in[4] << 24;
+        // fall through
+      case QOIS_OP_RGB:
+        pixel = (pixel & 0xff000000u) | (uint32_t)in[1] | (uint32_t)in[2] << 8 | (uint32_t)in[3] << 16;
+        break;
+      case QOIS_OP_INDEX:
+        pixel = _qois_pixel_pack(&cache[in[0]]);
+        break;
+      case QOIS_OP_DIFF:
+        pixel = _qois_packed_add(pixel, info->diff);
+        break;
+      case QOIS_OP_LUMA:
+        pixel = _qois_packed_add(pixel, _qois_luma_diff(info, in[1]));
+        break;
+      case QOIS_OP_RUN:
+        if (pixels_out + info->run > state->pixels_count)
+        {
+          result = -1;
+          goto done;
+        }
+        pixels_out += info->run - 1U;
+        break;
+      default:
+        result = -1;
+        goto done;
+      }
+
+      cache[_qois_packed_hash(pixel)] = _qois_pixel_unpack(pixel);
+      QOIS_STATS_OP(state, info);
+      pixels_out++;
+      in += info->length;
+    }
+
+  done:
+    state->current_pixel = _qois_pixel_unpack(pixel);
+    state->last_pixel = state->current_pixel;
+    state->pixels_out = pixels_out;
+
+    *consumed = (size_t)(in - input);
+    return result;
+  }
+
+  // Moves the decoder forward without writing pixels, until at least pixel_target pixels have been
+  // decoded. It stops at an op boundary, so a run may take it past the target (see pixels_out).
+  // Returns 0 on success or -1 on error, the amount of input bytes used is stored in consumed.
+  static inline int qois_skip_buffer(qois_dec_state *state, const uint8_t *input, size_t input_size,
+                                     size_t pixel_target, size_t *consumed)
+  {
+    size_t input_pos = 0;
+
+    // The rest of a partially written run counts as decoded
+    if (state->run_remaining > 0)
+    {
+      state->pixels_out += state->run_remaining;
+      state->run_remaining = 0;
+
+      if (state->pixels_out >= state->pixels_count)
+      {
+        state->state = QOIS_STATE_FOOTER;
+        state->op_position = 0;
+      }
+    }
+
+    while (input_pos < input_size && state->state != QOIS_STATE_DONE)
+    {
+      if (state->state == QOIS_OP_NONE)
+      {
+        if (state->pixels_out >= pixel_target)
+          break;
+
+        size_t used = 0;
+        int result = _qois_skip_ops(state, input + input_pos, input_size - input_pos, pixel_target, &used);
+        input_pos += used;
+        if (result < 0)
+        {
+          *consumed = input_pos;
+          return -1;
+        }
+
+        if (state->pixels_out >= state->pixels_count)
+        {
+          state->state = QOIS_STATE_FOOTER;
+          state->op_position = 0;
+        }
+
+        if (input_pos >= input_size || state->pixels_out >= pixel_target)
+          continue;
+      }
+
+      uint8_t byte = input[input_pos];
+
+      if (state->state >= QOIS_OP_NONE)
+      {
+        // Only ops split over multiple input buffers end up here, so at most a single pixel is written
+        uint8_t scratch[sizeof(qois_pixel)];
+        if (_qois_decode_op_byte(state, byte, scratch, sizeof(scratch)) < 0)
+        {
+          *consumed = input_pos;
+          return -1;
+        }
+
+        if (state->pixels_out >= state->pixels_count)
+        {
+          state->state = QOIS_STATE_FOOTER;
+          state->op_position = 0;
+        }
+      }
+      else if (_qois_decode_frame_byte(state, byte) < 0)
+      {
+        *consumed = input_pos;
+        return -1;
+      }
+
+      input_pos++;
+    }
+
+    *consumed = input_pos;
+    return 0;
+  }
+
 #ifdef __cplusplus
 }
 #endif